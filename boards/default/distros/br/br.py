@@ -40,8 +40,33 @@ initTemplate = string.Template("""#!/bin/sh
 SYSLOGD_ARGS=-n
 KLOGD_ARGS=-n
 
+# Copy the workload's 'outputs' to the shared results directory. This also
+# runs on shutdown since run scripts usually end with poweroff.
+saveOutputs() {
+    if [ -f /firemarshal/.outputs ]; then
+        while read -r out; do
+            [ -e "$$out" ] && cp -a "$$out" /firemarshal/
+        done < /firemarshal/.outputs
+        sync
+    fi
+}
+
 start() {
+    # Results directory shared by the host (see the 'live-outputs' option)
+    if grep -qs firemarshal /sys/bus/virtio/drivers/9pnet_virtio/*/mount_tag; then
+        mkdir -p /firemarshal
+        mount -t 9p -o trans=virtio,version=9p2000.L firemarshal /firemarshal
+    fi
+
+    # 'marshal dev' replaces the workload run with its module reload agent
+    if [ -x /firemarshal/devloop.sh ]; then
+        /firemarshal/devloop.sh
+        return
+    fi
+
     echo "launching firemarshal workload run/command" && /firemarshal.sh $args && echo "firemarshal workload run/command done"
+
+    saveOutputs
 }
 
 case "$$1" in
@@ -49,7 +74,7 @@ case "$$1" in
   start
   ;;
   stop)
-  #stop
+  saveOutputs
   ;;
   restart|reload)
   start
@@ -178,6 +203,8 @@ class Builder:
             f.write('BR2_TOOLCHAIN_EXTERNAL_GCC_'+toolVer['gcc']+'=y\n')
             f.write('BR2_JLEVEL='+str(wlutil.getOpt('jlevel'))+'\n')
             f.write('BR2_PACKAGE_HOST_E2FSPROGS'+'=y\n')
+            # Timestamps and build paths come from $SOURCE_DATE_EPOCH (see wlutil.buildEnv)
+            f.write('BR2_REPRODUCIBLE'+'=y\n')
 
         # Default Configuration (allows us to bump BR independently of our configs)
         defconfig = wlutil.getOpt('gen-dir') / 'brDefConfig'
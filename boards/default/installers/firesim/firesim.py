@@ -58,7 +58,7 @@ def install(targetCfg, opts):
                     'bootbinary': fullRel(fsTargetDir, jCfg['bin'])
                     }
             if 'img' in jCfg:
-                wls[slot]["rootfs"] = fullRel(fsTargetDir, jCfg['img'])
+                wls[slot]["rootfs"] = fullRel(fsTargetDir, wlutil.rawImg(jCfg['img']))
             else:
                 wls[slot]["rootfs"] = dummyPath
 
@@ -77,7 +77,7 @@ def install(targetCfg, opts):
         fsCfg["common_bootbinary"] = fullRel(fsTargetDir, targetCfg['bin'])
 
         if 'img' in targetCfg:
-            fsCfg["common_rootfs"] = fullRel(fsTargetDir, targetCfg['img'])
+            fsCfg["common_rootfs"] = fullRel(fsTargetDir, wlutil.rawImg(targetCfg['img']))
         else:
             fsCfg["common_rootfs"] = dummyPath
 
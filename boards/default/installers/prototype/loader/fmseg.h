@@ -0,0 +1,44 @@
+// Segmented prototype image format (see ../segimg.py for the writer).
+// All fields are little-endian.
+
+#ifndef FMSEG_H
+#define FMSEG_H
+
+#include <stdint.h>
+
+#define FMSEG_MAGIC   0x47534d46u  // 'FMSG'
+#define FMSEG_VERSION 1
+
+// Segment flags
+#define FMSEG_RLE  (1u << 0)  // payload is run-length encoded
+#define FMSEG_ZERO (1u << 1)  // no payload, clear mem_len bytes
+
+struct fmseg_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t nseg;
+    uint64_t entry;
+    uint32_t hdr_crc;    // CRC32 of header (with hdr_crc = 0) and segment table
+    uint32_t total_len;  // bytes in the image, including payloads
+    uint64_t reserved;
+};
+
+struct fmseg_entry {
+    uint64_t load_addr;
+    uint64_t mem_len;    // bytes in memory once unpacked
+    uint32_t file_off;   // payload offset from the start of the image
+    uint32_t file_len;   // payload bytes in the image
+    uint32_t flags;
+    uint32_t crc;        // CRC32 of the unpacked data (data segments only)
+};
+
+// Loader status codes, left in fmseg_status for a debugger to read
+#define FMSEG_OK           0
+#define FMSEG_ERR_MAGIC    1
+#define FMSEG_ERR_HDR_CRC  2
+#define FMSEG_ERR_OVERLAP  3
+#define FMSEG_ERR_BOUNDS   4
+#define FMSEG_ERR_RLE      5
+#define FMSEG_ERR_SEG_CRC  6  // fmseg_bad_seg holds the failing segment
+
+#endif
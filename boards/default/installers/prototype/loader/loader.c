@@ -0,0 +1,154 @@
+// Unpack a segmented image (FMSEG_IMAGE_ADDR) to its load addresses, verify
+// every segment and jump to its entry point. Runs on hart 0; the other harts
+// wait in start.S until it releases them through fmseg_boot_gen.
+
+#include <stddef.h>
+#include "fmseg.h"
+
+#ifndef FMSEG_IMAGE_ADDR
+#define FMSEG_IMAGE_ADDR 0xe0000000
+#endif
+
+extern char _loader_start[], _end[];
+
+// In .data, not .bss: the other harts read them while hart 0 clears .bss.
+// fmseg_boot_gen is bumped once per boot after fmseg_entry_addr is set.
+volatile uint64_t fmseg_entry_addr __attribute__((section(".data"))) = 0;
+volatile uint64_t fmseg_boot_gen __attribute__((section(".data"))) = 0;
+volatile uint32_t fmseg_status;
+volatile uint32_t fmseg_bad_seg;
+
+static uint32_t crc_table[256];
+
+static void crc32_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *p, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void copy(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    if ((((uintptr_t)dst | (uintptr_t)src) & 7) == 0) {
+        for (; len >= 8; len -= 8, dst += 8, src += 8)
+            *(uint64_t *)dst = *(const uint64_t *)src;
+    }
+    while (len--)
+        *dst++ = *src++;
+}
+
+static void fill(uint8_t *dst, uint8_t val, size_t len)
+{
+    uint64_t v = val * 0x0101010101010101ull;
+    for (; len && ((uintptr_t)dst & 7); len--)
+        *dst++ = val;
+    for (; len >= 8; len -= 8, dst += 8)
+        *(uint64_t *)dst = v;
+    while (len--)
+        *dst++ = val;
+}
+
+// Returns 0 if exactly out_len bytes were produced
+static int rle_decode(uint8_t *out, size_t out_len, const uint8_t *in, size_t in_len)
+{
+    const uint8_t *end = in + in_len;
+    while (in < end) {
+        uint8_t c = *in++;
+        size_t n;
+        if (c < 0x80) {
+            n = c + 1;
+            if (n > out_len || n > (size_t)(end - in))
+                return -1;
+            copy(out, in, n);
+            in += n;
+        } else {
+            n = c - 0x80 + 3;
+            if (n > out_len || in == end)
+                return -1;
+            fill(out, *in++, n);
+        }
+        out += n;
+        out_len -= n;
+    }
+    return out_len == 0 ? 0 : -1;
+}
+
+static int overlaps(uint64_t a, uint64_t alen, uint64_t b, uint64_t blen)
+{
+    return a < b + blen && b < a + alen;
+}
+
+static uint32_t load(const uint8_t *img)
+{
+    const struct fmseg_header *hdr = (const struct fmseg_header *)img;
+    const struct fmseg_entry *seg = (const struct fmseg_entry *)(hdr + 1);
+
+    if (hdr->magic != FMSEG_MAGIC || hdr->version != FMSEG_VERSION)
+        return FMSEG_ERR_MAGIC;
+
+    struct fmseg_header h = *hdr;
+    h.hdr_crc = 0;
+    uint32_t crc = crc32(0, (const uint8_t *)&h, sizeof(h));
+    crc = crc32(crc, (const uint8_t *)seg, hdr->nseg * sizeof(*seg));
+    if (crc != hdr->hdr_crc)
+        return FMSEG_ERR_HDR_CRC;
+
+    uint64_t ldr = (uintptr_t)_loader_start;
+    uint64_t ldr_len = (uintptr_t)_end - ldr;
+    for (unsigned i = 0; i < hdr->nseg; i++) {
+        if (overlaps(seg[i].load_addr, seg[i].mem_len, (uintptr_t)img, hdr->total_len) ||
+            overlaps(seg[i].load_addr, seg[i].mem_len, ldr, ldr_len))
+            return FMSEG_ERR_OVERLAP;
+        if (!(seg[i].flags & FMSEG_ZERO) &&
+            (uint64_t)seg[i].file_off + seg[i].file_len > hdr->total_len)
+            return FMSEG_ERR_BOUNDS;
+    }
+
+    for (unsigned i = 0; i < hdr->nseg; i++) {
+        uint8_t *dst = (uint8_t *)(uintptr_t)seg[i].load_addr;
+        const uint8_t *src = img + seg[i].file_off;
+
+        if (seg[i].flags & FMSEG_ZERO) {
+            fill(dst, 0, seg[i].mem_len);
+            continue;
+        }
+
+        if (seg[i].flags & FMSEG_RLE) {
+            if (rle_decode(dst, seg[i].mem_len, src, seg[i].file_len)) {
+                fmseg_bad_seg = i;
+                return FMSEG_ERR_RLE;
+            }
+        } else {
+            if (seg[i].file_len != seg[i].mem_len)
+                return FMSEG_ERR_BOUNDS;
+            copy(dst, src, seg[i].mem_len);
+        }
+
+        if (crc32(0, dst, seg[i].mem_len) != seg[i].crc) {
+            fmseg_bad_seg = i;
+            return FMSEG_ERR_SEG_CRC;
+        }
+    }
+
+    fmseg_entry_addr = hdr->entry;
+    return FMSEG_OK;
+}
+
+// Returns the entry point, or 0 if the image could not be loaded
+uint64_t loader_main(void)
+{
+    crc32_init();
+    fmseg_status = load((const uint8_t *)(uintptr_t)FMSEG_IMAGE_ADDR);
+    return fmseg_status == FMSEG_OK ? fmseg_entry_addr : 0;
+}
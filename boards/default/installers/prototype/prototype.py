@@ -1,5 +1,8 @@
 import logging
 import wlutil
+from .segimg import writeImage
+
+imageFormats = ['flat', 'segmented', 'both']
 
 
 def install(targetCfg, opts):
@@ -8,9 +11,26 @@ def install(targetCfg, opts):
     if targetCfg['nodisk'] is False:
         raise NotImplementedError("nodisk builds are the only workload type supported by the install command")
 
+    fmt = opts['prototype-image']
+    if fmt not in imageFormats:
+        raise wlutil.ConfigurationError(f"Unknown prototype-image format '{fmt}', expected one of {imageFormats}")
+
     nodiskPath = str(targetCfg['bin']) + '-nodisk'
-    outputPath = nodiskPath + '-flat'
 
-    wlutil.run(['riscv64-unknown-elf-objcopy', '-S', '-O', 'binary', '--change-addresses', '-0x80000000',
-                nodiskPath, outputPath])
-    log.info("Workload flattened and \"installed\" to " + outputPath)
+    if fmt in ['flat', 'both']:
+        outputPath = nodiskPath + '-flat'
+        wlutil.run(['riscv64-unknown-elf-objcopy', '-S', '-O', 'binary', '--change-addresses', '-0x80000000',
+                    nodiskPath, outputPath])
+        log.info("Workload flattened and \"installed\" to " + outputPath)
+
+    if fmt in ['segmented', 'both']:
+        outputPath = nodiskPath + '-seg'
+        compress = opts['prototype-image-compress']
+        if isinstance(compress, str):
+            # Set from the environment (MARSHAL_PROTOTYPE_IMAGE_COMPRESS)
+            compress = compress.lower() in ['1', 'true', 'yes']
+
+        summary = writeImage(nodiskPath, outputPath, compress=compress)
+        log.info(f"Segmented image: {summary['segments']} segments, {summary['imageBytes']} bytes "
+                 f"({summary['memBytes']} bytes in memory, {summary['span']} bytes address span)")
+        log.info("Workload segmented and \"installed\" to " + outputPath)
@@ -0,0 +1,253 @@
+"""Zero-elided segmented images for the FPGA prototype.
+
+A flat image (objcopy -O binary) covers everything from the lowest to the
+highest load address, including the gaps between firmware, kernel and
+initramfs and any long runs of zeroes inside them. A segmented image only
+carries real data:
+
+  header   magic 'FMSG', version, segment count, entry point, CRC32 of the
+           header and segment table, total image length
+  table    one entry per segment: load address, length in memory, payload
+           offset and length, flags, CRC32 of the unpacked data
+  payloads 8-byte aligned, in table order
+
+Segments come from the ELF PT_LOAD program headers (physical addresses).
+Zero runs of at least zeroRunMin bytes are split out into payload-less
+FMSEG_ZERO segments that the loader clears. Data segments may be
+run-length encoded (FMSEG_RLE). All fields are little-endian; loader/fmseg.h
+has the matching C definitions and loader/ a stub that unpacks the image.
+
+Run this file directly to inspect or verify an image:
+    python3 segimg.py info IMAGE
+    python3 segimg.py flatten IMAGE OUTPUT BASE
+"""
+import re
+import sys
+import zlib
+import struct
+
+MAGIC = 0x47534d46  # 'FMSG'
+VERSION = 1
+
+FMSEG_RLE = 1 << 0
+FMSEG_ZERO = 1 << 1
+
+# Shortest zero run worth its own table entry
+zeroRunMin = 4096
+
+_header = struct.Struct('<IHHQIIQ')
+_entry = struct.Struct('<QQIIII')
+
+_elfHeader = struct.Struct('<16sHHIQQQIHHHHHH')
+_progHeader = struct.Struct('<IIQQQQQQ')
+PT_LOAD = 1
+
+_zeroRe = re.compile(b'\0{%d,}' % zeroRunMin)
+_repeatRe = re.compile(rb'(.)\1{2,}', re.DOTALL)
+
+
+class SegImgError(Exception):
+    pass
+
+
+def elfSegments(elfPath):
+    """Returns (entry, [(paddr, bytes)]) for the PT_LOAD segments of a
+    little-endian ELF64 file. bss is included as explicit zeroes."""
+    with open(elfPath, 'rb') as f:
+        elf = f.read()
+
+    if elf[0:4] != b'\x7fELF' or elf[4] != 2 or elf[5] != 1:
+        raise SegImgError(f"{elfPath} is not a little-endian ELF64 file")
+
+    (ident, etype, machine, version, entry, phoff, shoff, flags,
+     ehsize, phentsize, phnum, shentsize, shnum, shstrndx) = _elfHeader.unpack_from(elf, 0)
+
+    segs = []
+    for i in range(phnum):
+        (ptype, pflags, offset, vaddr, paddr,
+         filesz, memsz, align) = _progHeader.unpack_from(elf, phoff + i * phentsize)
+        if ptype != PT_LOAD or memsz == 0:
+            continue
+        segs.append((paddr, elf[offset:offset + filesz] + bytes(memsz - filesz)))
+
+    return entry, sorted(segs, key=lambda s: s[0])
+
+
+def splitZeroes(addr, data):
+    """Split one segment into (addr, bytes-or-None) pieces, where None marks
+    a run of zeroes. Run boundaries are kept 8-byte aligned."""
+    pieces = []
+    pos = 0
+    for m in _zeroRe.finditer(data):
+        start = (m.start() + (-(addr + m.start()) % 8))
+        end = m.end() - ((addr + m.end()) % 8)
+        if end - start < zeroRunMin:
+            continue
+        if start > pos:
+            pieces.append((addr + pos, data[pos:start]))
+        pieces.append((addr + start, end - start))
+        pos = end
+
+    if pos < len(data):
+        pieces.append((addr + pos, data[pos:]))
+    return pieces
+
+
+def rleEncode(data):
+    """PackBits-style encoding: a control byte c < 0x80 is followed by c+1
+    literal bytes, c >= 0x80 by one byte repeated c-0x80+3 times."""
+    out = bytearray()
+    pos = 0
+
+    def literal(end):
+        nonlocal pos
+        while pos < end:
+            n = min(128, end - pos)
+            out.append(n - 1)
+            out.extend(data[pos:pos + n])
+            pos += n
+
+    for m in _repeatRe.finditer(data):
+        literal(m.start())
+        n = m.end() - m.start()
+        while n >= 3:
+            k = min(130, n)
+            out.append(k - 3 + 0x80)
+            out.append(data[m.start()])
+            n -= k
+        # A leftover of one or two bytes goes out as a literal
+        pos = m.end() - n
+    literal(len(data))
+
+    return bytes(out)
+
+
+def rleDecode(data):
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        c = data[pos]
+        if c < 0x80:
+            out.extend(data[pos + 1:pos + 2 + c])
+            pos += 2 + c
+        else:
+            out.extend(data[pos + 1:pos + 2] * (c - 0x80 + 3))
+            pos += 2
+    return bytes(out)
+
+
+def writeImage(elfPath, outPath, compress=False):
+    """Convert an ELF boot binary to a segmented image. Returns a summary
+    dict with the number of segments and bytes of payload and memory."""
+    entry, segs = elfSegments(elfPath)
+
+    pieces = []
+    for addr, data in segs:
+        pieces += splitZeroes(addr, data)
+
+    tableLen = _header.size + _entry.size * len(pieces)
+    off = (tableLen + 7) & ~7
+    table = []
+    payloads = []
+    memBytes = 0
+    for addr, data in pieces:
+        if isinstance(data, int):
+            table.append((addr, data, 0, 0, FMSEG_ZERO, 0))
+            memBytes += data
+            continue
+
+        payload = data
+        flags = 0
+        if compress:
+            packed = rleEncode(data)
+            if len(packed) < len(data):
+                payload = packed
+                flags |= FMSEG_RLE
+
+        table.append((addr, len(data), off, len(payload), flags, zlib.crc32(data)))
+        pad = -len(payload) % 8
+        payloads.append(payload + bytes(pad))
+        off += len(payload) + pad
+        memBytes += len(data)
+
+    if off >= 1 << 32:
+        raise SegImgError("Segmented image would exceed 4GiB")
+
+    rawTable = b''.join(_entry.pack(*e) for e in table)
+    hdrCrc = zlib.crc32(_header.pack(MAGIC, VERSION, len(table), entry, 0, off, 0) + rawTable)
+    with open(outPath, 'wb') as f:
+        f.write(_header.pack(MAGIC, VERSION, len(table), entry, hdrCrc, off, 0))
+        f.write(rawTable)
+        f.write(bytes(-tableLen % 8))
+        for p in payloads:
+            f.write(p)
+
+    return {'segments': len(table), 'imageBytes': off, 'memBytes': memBytes,
+            'span': segs[-1][0] + len(segs[-1][1]) - segs[0][0] if segs else 0}
+
+
+def readImage(imgPath):
+    """Parse and verify a segmented image. Returns (entry, [(addr, bytes)])
+    with zero segments expanded. Raises SegImgError on any corruption."""
+    with open(imgPath, 'rb') as f:
+        img = f.read()
+
+    if len(img) < _header.size:
+        raise SegImgError("Truncated header")
+    magic, version, nseg, entry, hdrCrc, total, rsvd = _header.unpack_from(img, 0)
+    if magic != MAGIC or version != VERSION:
+        raise SegImgError("Not a version %d segmented image" % VERSION)
+    tableEnd = _header.size + nseg * _entry.size
+    if len(img) < max(total, tableEnd):
+        raise SegImgError("Truncated image")
+
+    check = _header.pack(magic, version, nseg, entry, 0, total, rsvd) + img[_header.size:tableEnd]
+    if zlib.crc32(check) != hdrCrc:
+        raise SegImgError("Header checksum mismatch")
+
+    segs = []
+    for i in range(nseg):
+        addr, memLen, off, fileLen, flags, crc = _entry.unpack_from(img, _header.size + i * _entry.size)
+        if flags & FMSEG_ZERO:
+            segs.append((addr, bytes(memLen)))
+            continue
+
+        data = img[off:off + fileLen]
+        if flags & FMSEG_RLE:
+            data = rleDecode(data)
+        if len(data) != memLen or zlib.crc32(data) != crc:
+            raise SegImgError("Segment %d (0x%x) checksum mismatch" % (i, addr))
+        segs.append((addr, data))
+
+    return entry, segs
+
+
+def flatten(imgPath, base):
+    """Returns the equivalent of 'objcopy -O binary --change-addresses -base'"""
+    entry, segs = readImage(imgPath)
+    end = max(addr + len(data) for addr, data in segs)
+    flat = bytearray(end - base)
+    for addr, data in segs:
+        flat[addr - base:addr - base + len(data)] = data
+    # objcopy does not emit trailing zeroes
+    return bytes(flat).rstrip(b'\0')
+
+
+def main(argv):
+    if len(argv) == 2 and argv[0] == 'info':
+        entry, segs = readImage(argv[1])
+        print("entry 0x%x, %d segments, checksums OK" % (entry, len(segs)))
+        for addr, data in segs:
+            print("  0x%016x  %10d bytes" % (addr, len(data)))
+    elif len(argv) == 4 and argv[0] == 'flatten':
+        with open(argv[2], 'wb') as f:
+            f.write(flatten(argv[1], int(argv[3], 0)))
+    else:
+        sys.exit("usage: segimg.py info IMAGE | flatten IMAGE OUTPUT BASE")
+
+
+if __name__ == "__main__":
+    try:
+        main(sys.argv[1:])
+    except SegImgError as e:
+        sys.exit(str(e))
@@ -0,0 +1,3 @@
+#!/bin/sh
+
+make -C mecackpt && make -C omniblk-replay && exec make -C omnistat
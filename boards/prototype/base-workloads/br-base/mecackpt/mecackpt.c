@@ -0,0 +1,731 @@
+/*
+ * mecackpt - save and restore the contents of MECA remote memory
+ *
+ * Usage:
+ *   mecackpt save    [-j THREADS] [-c CHUNK_KB] [-z LEVEL] [-p AHEAD] [-n BYTES] DEV FILE
+ *   mecackpt restore [-j THREADS] [-Z] [-V] FILE DEV
+ *   mecackpt verify  FILE
+ *
+ * Saving keeps several chunks in flight: the reader thread issues
+ * OMNI_IOC_PREFETCH for the chunks ahead of the one it reads (when DEV is
+ * /dev/omnichar), worker threads skip all-zero chunks, checksum and
+ * optionally compress, and a writer thread appends the records in order.
+ * Restoring reads the records back, and the workers decompress, verify and
+ * write the chunks to the device in parallel.
+ *
+ * File format (little-endian):
+ *   header  magic "MCKP", version, flags, chunk size, device bytes
+ *   records one per chunk: offset, raw length, stored length, CRC32 of the
+ *           raw data, flags (ZERO: no payload, ZSTD: compressed payload),
+ *           then the payload
+ *   trailer a record with the END flag: number of chunks and a CRC32 over
+ *           all chunk CRCs, so that truncated files are detected
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define MCKP_MAGIC	0x504b434d	/* "MCKP" */
+#define MCKP_VERSION	1
+
+#define REC_ZERO	(1u << 0)
+#define REC_ZSTD	(1u << 1)
+#define REC_END		(1u << 31)
+
+#define DEFAULT_CHUNK	(1024 * 1024)
+
+/* Must match meca_chardev/omni_chardev_common.h */
+struct omni_prefetch_ioctl {
+	uint64_t offset;
+	uint64_t len;
+};
+#define OMNI_IOC_PREFETCH _IOW('O', 4, struct omni_prefetch_ioctl)
+
+struct ckpt_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t chunk_size;
+	uint32_t reserved;
+	uint64_t dev_bytes;
+};
+
+struct ckpt_record {
+	uint64_t offset;
+	uint32_t raw_len;
+	uint32_t stored_len;
+	uint32_t crc;
+	uint32_t flags;
+};
+
+enum slot_state { SLOT_FREE, SLOT_FILLED, SLOT_DONE };
+
+struct slot {
+	enum slot_state state;
+	uint64_t seq;		/* chunk number, once filled */
+	struct ckpt_record rec;
+	uint8_t *raw;		/* chunk contents */
+	uint8_t *stored;	/* compressed payload (save) or file payload (restore) */
+	size_t stored_cap;
+};
+
+/* A bounded, ordered pipeline: reader -> workers -> writer */
+struct pipeline {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct slot *slots;
+	unsigned int depth;
+	uint64_t next_work;
+	uint64_t nchunks;	/* set once the reader knows the end */
+	int error;
+
+	int dev_fd, file_fd;
+	uint32_t chunk_size;
+	uint64_t dev_bytes;
+	int zlevel;
+	unsigned int ahead;
+	int assume_zero;
+	int verify;
+
+	/* Results */
+	uint64_t zero_chunks, stored_bytes;
+	uint32_t crc_of_crcs;
+	uint32_t expected_crc;	/* from the trailer (restore) */
+};
+
+static uint32_t crc_table[256];
+
+static void crc32_init(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		crc_table[i] = c;
+	}
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *p, size_t len)
+{
+	crc = ~crc;
+	while (len--)
+		crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static int all_zero(const uint8_t *p, size_t len)
+{
+	const uint64_t *w = (const uint64_t *)p;
+	size_t i;
+
+	for (i = 0; i < len / 8; i++)
+		if (w[i])
+			return 0;
+	for (i = len & ~(size_t)7; i < len; i++)
+		if (p[i])
+			return 0;
+	return 1;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int read_full(int fd, void *buf, size_t len, off_t off)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = off < 0 ? read(fd, (char *)buf + done, len - done)
+				    : pread(fd, (char *)buf + done, len - done, off + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n < 0 ? -errno : -EIO;
+		done += n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len, off_t off)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = off < 0 ? write(fd, (const char *)buf + done, len - done)
+				    : pwrite(fd, (const char *)buf + done, len - done, off + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n < 0 ? -errno : -ENOSPC;
+		done += n;
+	}
+	return 0;
+}
+
+/*
+ * Pipeline plumbing. Chunk number n lives in slots[n % depth]; each stage
+ * waits for the slot of the next chunk it handles to reach its input state.
+ */
+
+static void pl_fail(struct pipeline *pl, int err, const char *what)
+{
+	pthread_mutex_lock(&pl->lock);
+	if (!pl->error) {
+		fprintf(stderr, "mecackpt: %s: %s\n", what, strerror(-err));
+		pl->error = err;
+	}
+	pthread_cond_broadcast(&pl->cond);
+	pthread_mutex_unlock(&pl->lock);
+}
+
+/*
+ * Wait until the slot of chunk n is in state st (and, unless it is free,
+ * holds chunk n). Returns NULL on error or at the end of the input.
+ */
+static struct slot *pl_wait(struct pipeline *pl, uint64_t n, enum slot_state st)
+{
+	struct slot *s = &pl->slots[n % pl->depth];
+
+	pthread_mutex_lock(&pl->lock);
+	while (!pl->error && n < pl->nchunks &&
+	       (s->state != st || (st != SLOT_FREE && s->seq != n)))
+		pthread_cond_wait(&pl->cond, &pl->lock);
+	if (pl->error || n >= pl->nchunks)
+		s = NULL;
+	pthread_mutex_unlock(&pl->lock);
+	return s;
+}
+
+static void pl_set(struct pipeline *pl, struct slot *s, enum slot_state st)
+{
+	pthread_mutex_lock(&pl->lock);
+	s->state = st;
+	pthread_cond_broadcast(&pl->cond);
+	pthread_mutex_unlock(&pl->lock);
+}
+
+static void pl_end(struct pipeline *pl, uint64_t nchunks)
+{
+	pthread_mutex_lock(&pl->lock);
+	pl->nchunks = nchunks;
+	pthread_cond_broadcast(&pl->cond);
+	pthread_mutex_unlock(&pl->lock);
+}
+
+static uint64_t pl_claim(struct pipeline *pl)
+{
+	uint64_t n;
+
+	pthread_mutex_lock(&pl->lock);
+	n = pl->next_work++;
+	pthread_mutex_unlock(&pl->lock);
+	return n;
+}
+
+/* save */
+
+static void *save_reader(void *arg)
+{
+	struct pipeline *pl = arg;
+	uint64_t total = (pl->dev_bytes + pl->chunk_size - 1) / pl->chunk_size;
+	int prefetch = pl->ahead > 0;
+	uint64_t n, fetched = 0;
+
+	pl_end(pl, total);
+	for (n = 0; n < total; n++) {
+		uint64_t off = n * pl->chunk_size;
+		uint32_t len = pl->dev_bytes - off < pl->chunk_size ? pl->dev_bytes - off : pl->chunk_size;
+		struct slot *s;
+		int err;
+
+		/* Keep the engine busy on the next chunks while this one is read */
+		while (prefetch && fetched < total && fetched <= n + pl->ahead) {
+			struct omni_prefetch_ioctl pf = { fetched * pl->chunk_size, pl->chunk_size };
+
+			if (fetched > n && ioctl(pl->dev_fd, OMNI_IOC_PREFETCH, &pf) < 0 && errno != EBUSY)
+				prefetch = 0;	/* not /dev/omnichar, or prefetch disabled */
+			fetched++;
+		}
+
+		s = pl_wait(pl, n, SLOT_FREE);
+		if (!s)
+			break;
+		err = read_full(pl->dev_fd, s->raw, len, off);
+		if (err) {
+			pl_fail(pl, err, "reading the device");
+			break;
+		}
+		s->seq = n;
+		s->rec.offset = off;
+		s->rec.raw_len = len;
+		pl_set(pl, s, SLOT_FILLED);
+	}
+	return NULL;
+}
+
+static void *save_worker(void *arg)
+{
+	struct pipeline *pl = arg;
+
+	for (;;) {
+		uint64_t n = pl_claim(pl);
+		struct slot *s = pl_wait(pl, n, SLOT_FILLED);
+
+		if (!s)
+			break;
+
+		s->rec.crc = crc32(0, s->raw, s->rec.raw_len);
+		s->rec.flags = 0;
+		s->rec.stored_len = s->rec.raw_len;
+		if (all_zero(s->raw, s->rec.raw_len)) {
+			s->rec.flags = REC_ZERO;
+			s->rec.stored_len = 0;
+			pl_set(pl, s, SLOT_DONE);
+			continue;
+		}
+#ifdef HAVE_ZSTD
+		if (pl->zlevel > 0) {
+			size_t z = ZSTD_compress(s->stored, s->stored_cap, s->raw, s->rec.raw_len, pl->zlevel);
+
+			if (!ZSTD_isError(z) && z < s->rec.raw_len) {
+				s->rec.flags |= REC_ZSTD;
+				s->rec.stored_len = z;
+			}
+		}
+#endif
+		pl_set(pl, s, SLOT_DONE);
+	}
+	return NULL;
+}
+
+static void *save_writer(void *arg)
+{
+	struct pipeline *pl = arg;
+	uint64_t n;
+
+	for (n = 0;; n++) {
+		struct slot *s = pl_wait(pl, n, SLOT_DONE);
+		const uint8_t *payload;
+		int err;
+
+		if (!s)
+			break;
+		payload = (s->rec.flags & REC_ZSTD) ? s->stored : s->raw;
+		err = write_full(pl->file_fd, &s->rec, sizeof(s->rec), -1);
+		if (!err && s->rec.stored_len)
+			err = write_full(pl->file_fd, payload, s->rec.stored_len, -1);
+		if (err) {
+			pl_fail(pl, err, "writing the checkpoint");
+			break;
+		}
+
+		pl->crc_of_crcs = crc32(pl->crc_of_crcs, (const uint8_t *)&s->rec.crc, sizeof(s->rec.crc));
+		pl->stored_bytes += sizeof(s->rec) + s->rec.stored_len;
+		if (s->rec.flags & REC_ZERO)
+			pl->zero_chunks++;
+		pl_set(pl, s, SLOT_FREE);
+	}
+	return NULL;
+}
+
+/* restore */
+
+static void *restore_reader(void *arg)
+{
+	struct pipeline *pl = arg;
+	uint64_t n;
+
+	for (n = 0;; n++) {
+		struct ckpt_record rec;
+		struct slot *s;
+		int err;
+
+		err = read_full(pl->file_fd, &rec, sizeof(rec), -1);
+		if (err) {
+			pl_fail(pl, err, "reading the checkpoint (truncated?)");
+			break;
+		}
+		if (rec.flags & REC_END) {
+			if (rec.offset != n) {
+				pl_fail(pl, -EIO, "checkpoint trailer does not match the chunk count");
+				break;
+			}
+			pl->expected_crc = rec.crc;
+			pl_end(pl, n);
+			break;
+		}
+		if (rec.raw_len > pl->chunk_size || rec.stored_len > pl->slots[0].stored_cap ||
+		    rec.offset + rec.raw_len > pl->dev_bytes) {
+			pl_fail(pl, -EIO, "corrupt checkpoint record");
+			break;
+		}
+
+		s = pl_wait(pl, n, SLOT_FREE);
+		if (!s)
+			break;
+		s->seq = n;
+		s->rec = rec;
+		if (rec.stored_len) {
+			err = read_full(pl->file_fd, s->stored, rec.stored_len, -1);
+			if (err) {
+				pl_fail(pl, err, "reading the checkpoint (truncated?)");
+				break;
+			}
+		}
+		pl_set(pl, s, SLOT_FILLED);
+	}
+	return NULL;
+}
+
+static int restore_chunk(struct pipeline *pl, struct slot *s)
+{
+	struct ckpt_record *rec = &s->rec;
+	const uint8_t *data = s->stored;
+	int err;
+
+	if (rec->flags & REC_ZERO) {
+		memset(s->raw, 0, rec->raw_len);
+		data = s->raw;
+	} else if (rec->flags & REC_ZSTD) {
+#ifdef HAVE_ZSTD
+		size_t z = ZSTD_decompress(s->raw, pl->chunk_size, s->stored, rec->stored_len);
+
+		if (ZSTD_isError(z) || z != rec->raw_len)
+			return -EIO;
+		data = s->raw;
+#else
+		return -ENOTSUP;
+#endif
+	} else if (rec->stored_len != rec->raw_len) {
+		return -EIO;
+	}
+
+	if (crc32(0, data, rec->raw_len) != rec->crc)
+		return -EBADMSG;
+	if (pl->dev_fd < 0)
+		return 0;
+
+	if (!((rec->flags & REC_ZERO) && pl->assume_zero)) {
+		err = write_full(pl->dev_fd, data, rec->raw_len, rec->offset);
+		if (err)
+			return err;
+	}
+
+	if (pl->verify) {
+		/* Read back through a separate buffer */
+		uint8_t *back = s->raw == data ? s->stored : s->raw;
+
+		err = read_full(pl->dev_fd, back, rec->raw_len, rec->offset);
+		if (err)
+			return err;
+		if (crc32(0, back, rec->raw_len) != rec->crc)
+			return -EBADMSG;
+	}
+	return 0;
+}
+
+static void *restore_worker(void *arg)
+{
+	struct pipeline *pl = arg;
+
+	for (;;) {
+		uint64_t n = pl_claim(pl);
+		struct slot *s = pl_wait(pl, n, SLOT_FILLED);
+		int err;
+
+		if (!s)
+			break;
+		err = restore_chunk(pl, s);
+		if (err) {
+			char what[64];
+
+			snprintf(what, sizeof(what), "chunk at 0x%llx", (unsigned long long)s->rec.offset);
+			pl_fail(pl, err, what);
+			break;
+		}
+		pl_set(pl, s, SLOT_DONE);
+	}
+	return NULL;
+}
+
+/* In order, so that the CRC of CRCs can be checked */
+static void *restore_writer(void *arg)
+{
+	struct pipeline *pl = arg;
+	uint64_t n;
+
+	for (n = 0;; n++) {
+		struct slot *s = pl_wait(pl, n, SLOT_DONE);
+
+		if (!s)
+			break;
+		pl->crc_of_crcs = crc32(pl->crc_of_crcs, (const uint8_t *)&s->rec.crc, sizeof(s->rec.crc));
+		pl->stored_bytes += s->rec.stored_len;
+		if (s->rec.flags & REC_ZERO)
+			pl->zero_chunks++;
+		pl_set(pl, s, SLOT_FREE);
+	}
+	return NULL;
+}
+
+static int run_pipeline(struct pipeline *pl, unsigned int threads,
+			void *(*reader)(void *), void *(*worker)(void *), void *(*writer)(void *))
+{
+	pthread_t rd, wr, *wk;
+	unsigned int i;
+	int err = 0;
+
+	pl->depth = threads * 2 + pl->ahead + 2;
+	pl->nchunks = UINT64_MAX;
+	pl->slots = calloc(pl->depth, sizeof(*pl->slots));
+	wk = calloc(threads, sizeof(*wk));
+	if (!pl->slots || !wk)
+		return -ENOMEM;
+
+	for (i = 0; i < pl->depth; i++) {
+		struct slot *s = &pl->slots[i];
+
+		s->stored_cap = pl->chunk_size + pl->chunk_size / 2;
+#ifdef HAVE_ZSTD
+		if (ZSTD_compressBound(pl->chunk_size) > s->stored_cap)
+			s->stored_cap = ZSTD_compressBound(pl->chunk_size);
+#endif
+		s->raw = malloc(pl->chunk_size);
+		s->stored = malloc(s->stored_cap);
+		if (!s->raw || !s->stored)
+			return -ENOMEM;
+	}
+	pthread_mutex_init(&pl->lock, NULL);
+	pthread_cond_init(&pl->cond, NULL);
+
+	pthread_create(&rd, NULL, reader, pl);
+	for (i = 0; i < threads; i++)
+		pthread_create(&wk[i], NULL, worker, pl);
+	pthread_create(&wr, NULL, writer, pl);
+
+	pthread_join(rd, NULL);
+	for (i = 0; i < threads; i++)
+		pthread_join(wk[i], NULL);
+	pthread_join(wr, NULL);
+
+	err = pl->error;
+	for (i = 0; i < pl->depth; i++) {
+		free(pl->slots[i].raw);
+		free(pl->slots[i].stored);
+	}
+	free(pl->slots);
+	free(wk);
+	return err;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mecackpt save    [-j THREADS] [-c CHUNK_KB] [-z LEVEL] [-p AHEAD] [-n BYTES] DEV FILE\n"
+		"       mecackpt restore [-j THREADS] [-Z] [-V] FILE DEV\n"
+		"       mecackpt verify  FILE\n"
+		"  -j  worker threads (default: number of CPUs)\n"
+		"  -c  chunk size in KB (default: 1024)\n"
+		"  -z  zstd level, 0 stores uncompressed (default: 0)\n"
+		"  -p  chunks to prefetch ahead on /dev/omnichar (default: 4)\n"
+		"  -n  bytes to save (default: the whole device)\n"
+		"  -Z  the device is already zeroed, don't write zero chunks\n"
+		"  -V  read every chunk back and verify it\n");
+	exit(1);
+}
+
+static void report(const char *what, struct pipeline *pl, double secs)
+{
+	double mb = pl->dev_bytes / 1e6;
+
+	printf("%s %.1f MB in %.2f s (%.1f MB/s), %llu zero chunks, %.1f MB stored\n",
+	       what, mb, secs, secs > 0 ? mb / secs : 0, (unsigned long long)pl->zero_chunks,
+	       pl->stored_bytes / 1e6);
+}
+
+static int do_save(struct pipeline *pl, unsigned int threads, const char *dev, const char *file, uint64_t limit)
+{
+	struct ckpt_header hdr = { MCKP_MAGIC, MCKP_VERSION, 0, pl->chunk_size, 0, 0 };
+	struct ckpt_record end = { 0 };
+	off_t size;
+	double t0;
+	int err;
+
+	pl->dev_fd = open(dev, O_RDONLY);
+	if (pl->dev_fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	size = lseek(pl->dev_fd, 0, SEEK_END);
+	if (size <= 0) {
+		fprintf(stderr, "mecackpt: cannot get the size of %s\n", dev);
+		return 1;
+	}
+	pl->dev_bytes = limit && limit < (uint64_t)size ? limit : (uint64_t)size;
+	hdr.dev_bytes = pl->dev_bytes;
+	if (pl->zlevel > 0)
+		hdr.flags |= REC_ZSTD;
+
+	pl->file_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (pl->file_fd < 0) {
+		perror(file);
+		return 1;
+	}
+	if (write_full(pl->file_fd, &hdr, sizeof(hdr), -1))
+		return 1;
+
+	t0 = now_sec();
+	err = run_pipeline(pl, threads, save_reader, save_worker, save_writer);
+	if (err)
+		return 1;
+
+	end.offset = pl->nchunks;
+	end.crc = pl->crc_of_crcs;
+	end.flags = REC_END;
+	if (write_full(pl->file_fd, &end, sizeof(end), -1) || fsync(pl->file_fd) || close(pl->file_fd)) {
+		perror(file);
+		return 1;
+	}
+	report("saved", pl, now_sec() - t0);
+	return 0;
+}
+
+static int open_checkpoint(struct pipeline *pl, const char *file)
+{
+	struct ckpt_header hdr;
+
+	pl->file_fd = open(file, O_RDONLY);
+	if (pl->file_fd < 0) {
+		perror(file);
+		return -1;
+	}
+	if (read_full(pl->file_fd, &hdr, sizeof(hdr), -1) || hdr.magic != MCKP_MAGIC ||
+	    hdr.version != MCKP_VERSION || hdr.chunk_size == 0) {
+		fprintf(stderr, "mecackpt: %s is not a version %d checkpoint\n", file, MCKP_VERSION);
+		return -1;
+	}
+#ifndef HAVE_ZSTD
+	if (hdr.flags & REC_ZSTD) {
+		fprintf(stderr, "mecackpt: %s is compressed, but this build has no zstd support\n", file);
+		return -1;
+	}
+#endif
+	pl->chunk_size = hdr.chunk_size;
+	pl->dev_bytes = hdr.dev_bytes;
+	return 0;
+}
+
+static int do_restore(struct pipeline *pl, unsigned int threads, const char *file, const char *dev)
+{
+	double t0;
+
+	if (open_checkpoint(pl, file))
+		return 1;
+	if (dev) {
+		off_t size;
+
+		pl->dev_fd = open(dev, pl->verify ? O_RDWR : O_WRONLY);
+		if (pl->dev_fd < 0) {
+			perror(dev);
+			return 1;
+		}
+		size = lseek(pl->dev_fd, 0, SEEK_END);
+		if (size >= 0 && (uint64_t)size < pl->dev_bytes) {
+			fprintf(stderr, "mecackpt: %s is smaller than the checkpoint (%llu bytes)\n",
+				dev, (unsigned long long)pl->dev_bytes);
+			return 1;
+		}
+	} else {
+		/* verify: check the file only */
+		pl->dev_fd = -1;
+	}
+
+	t0 = now_sec();
+	if (run_pipeline(pl, threads, restore_reader, restore_worker, restore_writer))
+		return 1;
+	if (pl->crc_of_crcs != pl->expected_crc) {
+		fprintf(stderr, "mecackpt: checkpoint checksum mismatch\n");
+		return 1;
+	}
+	report(dev ? "restored" : "verified", pl, now_sec() - t0);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct pipeline pl = { .chunk_size = DEFAULT_CHUNK, .ahead = 4 };
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int threads = ncpus > 0 ? ncpus : 1;
+	uint64_t limit = 0;
+	const char *cmd;
+	int opt;
+
+	if (argc < 2)
+		usage();
+	cmd = argv[1];
+	optind = 2;
+	while ((opt = getopt(argc, argv, "j:c:z:p:n:ZV")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			pl.chunk_size = strtoul(optarg, NULL, 0) * 1024;
+			break;
+		case 'z':
+			pl.zlevel = atoi(optarg);
+			break;
+		case 'p':
+			pl.ahead = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			limit = strtoull(optarg, NULL, 0);
+			break;
+		case 'Z':
+			pl.assume_zero = 1;
+			break;
+		case 'V':
+			pl.verify = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (threads == 0 || pl.chunk_size == 0 || pl.chunk_size > (1u << 30))
+		usage();
+#ifndef HAVE_ZSTD
+	if (pl.zlevel > 0) {
+		fprintf(stderr, "mecackpt: built without zstd, -z is not available\n");
+		return 1;
+	}
+#endif
+
+	crc32_init();
+	if (!strcmp(cmd, "save") && argc - optind == 2)
+		return do_save(&pl, threads, argv[optind], argv[optind + 1], limit);
+	if (!strcmp(cmd, "restore") && argc - optind == 2)
+		return do_restore(&pl, threads, argv[optind], argv[optind + 1]);
+	if (!strcmp(cmd, "verify") && argc - optind == 1)
+		return do_restore(&pl, threads, argv[optind], NULL);
+	usage();
+	return 1;
+}
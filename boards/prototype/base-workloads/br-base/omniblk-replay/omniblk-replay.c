@@ -0,0 +1,334 @@
+/*
+ * omniblk-replay - replay a captured block I/O trace against a block device
+ *
+ * Usage: omniblk-replay [-d DEV] [-f] [-s SPEED] [-q DEPTH] [-w] [-l] [-o CSV] TRACE
+ *   -d DEV    device to replay against (default /dev/omniblk)
+ *   -f        as fast as possible instead of with the original timing
+ *   -s SPEED  timing scale, 2 replays twice as fast (default 1)
+ *   -q DEPTH  requests in flight at most (default 16)
+ *   -w        also replay writes (destroys the device contents!); without
+ *             it writes are skipped
+ *   -l        loop the trace when the device is smaller than the traced one
+ *   -o CSV    per-request log: issue time, op, offset, bytes, latency
+ *
+ * TRACE is the text trace written by omniblk-capture, one queued request per
+ * line: "<seconds> <RWBS> <sector> <sectors>". I/O is O_DIRECT so every
+ * request reaches the driver. Latency is measured from the request's issue
+ * time, so in timed mode a request delayed by a full queue counts as slow.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define SECTOR 512
+#define ALIGN 4096
+
+struct op {
+	uint64_t t_ns;		/* issue time relative to the start */
+	uint64_t offset;
+	uint32_t len;
+	uint8_t write;
+	/* results */
+	uint64_t start_ns;
+	uint64_t lat_ns;
+	int err;
+};
+
+static struct op *ops;
+static size_t nops;
+static size_t next_op;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int dev_fd;
+static int timed = 1;
+static double speed = 1.0;
+static uint64_t t0;
+static uint32_t max_len;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = { ns / 1000000000ull, ns % 1000000000ull };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static int load_trace(const char *path, int with_writes, uint64_t dev_bytes, int loop)
+{
+	FILE *f = fopen(path, "r");
+	size_t cap = 4096, skipped_w = 0, skipped_range = 0;
+	char line[256];
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	ops = malloc(cap * sizeof(*ops));
+	while (ops && fgets(line, sizeof(line), f)) {
+		double secs;
+		char rwbs[16];
+		unsigned long long sector, nsect;
+		struct op *op;
+
+		if (sscanf(line, "%lf %15s %llu %llu", &secs, rwbs, &sector, &nsect) != 4 || nsect == 0)
+			continue;
+		/* Only data reads and writes; flushes, discards etc. are not replayed */
+		if (strchr(rwbs, 'D') || (!strchr(rwbs, 'R') && !strchr(rwbs, 'W')))
+			continue;
+		if (strchr(rwbs, 'W') && !with_writes) {
+			skipped_w++;
+			continue;
+		}
+		if ((sector + nsect) * SECTOR > dev_bytes) {
+			if (!loop || nsect * SECTOR > dev_bytes) {
+				skipped_range++;
+				continue;
+			}
+			sector %= (dev_bytes - nsect * SECTOR) / SECTOR + 1;
+		}
+
+		if (nops == cap) {
+			cap *= 2;
+			ops = realloc(ops, cap * sizeof(*ops));
+			if (!ops)
+				break;
+		}
+		op = &ops[nops++];
+		memset(op, 0, sizeof(*op));
+		op->t_ns = secs * 1e9;
+		op->offset = sector * SECTOR;
+		op->len = nsect * SECTOR;
+		op->write = strchr(rwbs, 'W') != NULL;
+		if (op->len > max_len)
+			max_len = op->len;
+	}
+	fclose(f);
+	if (!ops) {
+		fprintf(stderr, "omniblk-replay: out of memory\n");
+		return -1;
+	}
+	if (skipped_w)
+		fprintf(stderr, "omniblk-replay: skipped %zu writes (use -w to replay them)\n", skipped_w);
+	if (skipped_range)
+		fprintf(stderr, "omniblk-replay: skipped %zu requests beyond the end of the device (see -l)\n",
+			skipped_range);
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	void *buf;
+
+	(void)arg;
+	if (posix_memalign(&buf, ALIGN, max_len))
+		return NULL;
+	memset(buf, 0xa5, max_len);
+
+	for (;;) {
+		struct op *op;
+		ssize_t n;
+
+		pthread_mutex_lock(&lock);
+		op = next_op < nops ? &ops[next_op++] : NULL;
+		pthread_mutex_unlock(&lock);
+		if (!op)
+			break;
+
+		if (timed)
+			sleep_until(t0 + (uint64_t)(op->t_ns / speed));
+		op->start_ns = now_ns();
+		if (op->write)
+			n = pwrite(dev_fd, buf, op->len, op->offset);
+		else
+			n = pread(dev_fd, buf, op->len, op->offset);
+		op->err = n == (ssize_t)op->len ? 0 : (n < 0 ? errno : EIO);
+
+		/* In timed mode, count from when the request should have been issued */
+		op->lat_ns = now_ns() - (timed ? t0 + (uint64_t)(op->t_ns / speed) : op->start_ns);
+	}
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *what, int write, double secs)
+{
+	static const double pct[] = { 0.50, 0.90, 0.99, 0.999 };
+	uint64_t *lat = malloc(nops * sizeof(*lat));
+	uint64_t bytes = 0, sum = 0;
+	size_t i, n = 0, errors = 0;
+
+	if (!lat)
+		return;
+	for (i = 0; i < nops; i++) {
+		if (ops[i].write != write)
+			continue;
+		if (ops[i].err) {
+			errors++;
+			continue;
+		}
+		lat[n++] = ops[i].lat_ns;
+		bytes += ops[i].len;
+		sum += ops[i].lat_ns;
+	}
+	if (n == 0 && errors == 0) {
+		free(lat);
+		return;
+	}
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+
+	printf("%-6s %8zu ops %8.0f IOPS %8.2f MB/s", what, n, n / secs, bytes / secs / 1e6);
+	if (n) {
+		printf("  lat(us) avg %.1f", sum / 1e3 / n);
+		for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+			printf(" p%g %.1f", pct[i] * 100, lat[(size_t)(pct[i] * (n - 1))] / 1e3);
+		printf(" max %.1f", lat[n - 1] / 1e3);
+	}
+	if (errors)
+		printf("  %zu errors", errors);
+	printf("\n");
+
+	/* log2 latency distribution */
+	if (n) {
+		size_t b, buckets[40] = { 0 };
+
+		for (i = 0; i < n; i++) {
+			uint64_t us = lat[i] / 1000;
+
+			b = 0;
+			while (us > 1 && b < 39) {
+				us >>= 1;
+				b++;
+			}
+			buckets[b]++;
+		}
+		for (b = 0; b < 40; b++)
+			if (buckets[b])
+				printf("    %8llu us .. %-8llu us %8zu  %5.1f%%\n",
+				       b ? 1ull << b : 0ull, (1ull << (b + 1)) - 1, buckets[b],
+				       100.0 * buckets[b] / n);
+	}
+	free(lat);
+}
+
+static void write_csv(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	size_t i;
+
+	if (!f) {
+		perror(path);
+		return;
+	}
+	fprintf(f, "issue_us,op,offset,bytes,latency_us,error\n");
+	for (i = 0; i < nops; i++)
+		fprintf(f, "%.3f,%c,%llu,%u,%.3f,%d\n", (ops[i].start_ns - t0) / 1e3,
+			ops[i].write ? 'W' : 'R', (unsigned long long)ops[i].offset, ops[i].len,
+			ops[i].lat_ns / 1e3, ops[i].err);
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = "/dev/omniblk", *csv = NULL;
+	int depth = 16, with_writes = 0, loop = 0, opt, i;
+	uint64_t dev_bytes = 0;
+	pthread_t *threads;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "d:fs:q:wlo:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'f':
+			timed = 0;
+			break;
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 'w':
+			with_writes = 1;
+			break;
+		case 'l':
+			loop = 1;
+			break;
+		case 'o':
+			csv = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 1 || depth <= 0 || speed <= 0)
+		goto usage;
+
+	dev_fd = open(dev, (with_writes ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (dev_fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(dev_fd, BLKGETSIZE64, &dev_bytes) < 0) {
+		off_t end = lseek(dev_fd, 0, SEEK_END);
+
+		dev_bytes = end > 0 ? (uint64_t)end : 0;
+	}
+
+	if (load_trace(argv[optind], with_writes, dev_bytes, loop))
+		return 1;
+	if (nops == 0) {
+		fprintf(stderr, "omniblk-replay: nothing to replay\n");
+		return 1;
+	}
+
+	printf("replaying %zu requests on %s, %s, queue depth %d\n", nops, dev,
+	       timed ? "original timing" : "as fast as possible", depth);
+
+	threads = calloc(depth, sizeof(*threads));
+	if (!threads)
+		return 1;
+	t0 = now_ns();
+	for (i = 0; i < depth; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+	for (i = 0; i < depth; i++)
+		pthread_join(threads[i], NULL);
+	secs = (now_ns() - t0) / 1e9;
+
+	printf("elapsed %.3f s\n", secs);
+	report("read", 0, secs);
+	report("write", 1, secs);
+	if (csv)
+		write_csv(csv);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-d DEV] [-f] [-s SPEED] [-q DEPTH] [-w] [-l] [-o CSV] TRACE\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,455 @@
+/*
+ * omnistat - iostat-style monitor for the OmniXtend drivers
+ *
+ * Usage: omnistat [-d DEV]... [-c COUNT] [-t] [-p PROM] [INTERVAL]
+ *   -d DEV    device to watch: omnichar, omniblk or the path of a stats
+ *             file (default: every loaded driver)
+ *   -c COUNT  stop after COUNT reports (default: run until interrupted)
+ *   -t        print the time before each report
+ *   -p PROM   also write the counters to PROM in the Prometheus text format
+ *             after every sample, e.g. for node-exporter's textfile
+ *             collector (/var/lib/node_exporter/omni.prom)
+ *   INTERVAL  seconds between reports (default 1)
+ *
+ * Counters are read from the drivers' omni/stats sysfs files
+ * (/sys/class/omnixtend/omnichar/omni/stats, /sys/block/omniblk/omni/stats),
+ * which can be read while the device is in use. Chardev drivers without it
+ * (the polling one) are sampled with OMNI_IOC_GET_STATS instead, which only
+ * works while nobody else has the device open and has no byte or queue
+ * counters; those columns show '-'.
+ *
+ * Each report has one line per device with the rates over the interval:
+ *   r/s w/s        DMA transfers per second
+ *   rMB/s wMB/s    bytes moved per second (MB = 10^6 bytes)
+ *   avgKB          average transfer size
+ *   err/s tmo/s    failed and timed out transfers per second
+ *   irq/s          DMA completion interrupts per second
+ *   aqu-sz         average number of transfers waiting for or holding the
+ *                  DMA engine
+ *   queued         transfers waiting for or holding it at the sample
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+/* From meca_chardev/omni_chardev_common.h */
+struct omni_stats_ioctl {
+	uint64_t dma_reads;
+	uint64_t dma_writes;
+	uint64_t dma_errors;
+	uint64_t dma_timeouts;
+	uint64_t irq_count;
+};
+#define OMNI_IOC_MAGIC 'O'
+#define OMNI_IOC_GET_STATS _IOR(OMNI_IOC_MAGIC, 2, struct omni_stats_ioctl)
+
+#define MAX_DEVS 8
+#define MAX_COUNTERS 32
+#define HEADER_EVERY 20
+
+struct sample {
+	int ok;
+	int n;
+	char name[MAX_COUNTERS][32];
+	unsigned long long val[MAX_COUNTERS];
+};
+
+struct dev {
+	char name[64];		/* label in reports and metrics */
+	char stats[256];	/* sysfs stats file, or "" to use the ioctl */
+	char node[256];		/* /dev node for the ioctl */
+	struct sample prev, cur;
+};
+
+static struct dev devs[MAX_DEVS];
+static int ndevs;
+static volatile sig_atomic_t stop;
+
+static const char *const known[][2] = {
+	{ "omnichar", "/sys/class/omnixtend/omnichar/omni/stats" },
+	{ "omniblk", "/sys/block/omniblk/omni/stats" },
+};
+
+/* Prometheus help text; other counters are exported with a generic one */
+static const char *const help[][2] = {
+	{ "dma_reads", "DMA transfers from remote memory" },
+	{ "dma_writes", "DMA transfers to remote memory" },
+	{ "read_bytes", "Bytes read from remote memory" },
+	{ "write_bytes", "Bytes written to remote memory" },
+	{ "dma_errors", "Failed DMA transfers" },
+	{ "dma_timeouts", "DMA transfers that timed out" },
+	{ "irq_count", "DMA completion interrupts" },
+	{ "split_transfers", "Transfers split between DMA and CPU copies" },
+	{ "split_cpu_bytes", "Bytes of split transfers copied by the CPU" },
+	{ "split_dma_bytes", "Bytes of split transfers moved by DMA" },
+	{ "pf_issued", "Prefetch slots queued for DMA" },
+	{ "pf_dropped", "Prefetches dropped because every slot was busy" },
+	{ "pf_hits", "Read chunks served from the prefetch cache" },
+	{ "pf_late", "Prefetch hits that waited for the prefetch DMA" },
+	{ "pf_misses", "Read chunks that went to the DMA engine" },
+};
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_counter(struct sample *s, const char *name, unsigned long long val)
+{
+	if (s->n == MAX_COUNTERS)
+		return;
+	snprintf(s->name[s->n], sizeof(s->name[0]), "%s", name);
+	s->val[s->n++] = val;
+}
+
+static int get(const struct sample *s, const char *name, unsigned long long *val)
+{
+	int i;
+
+	for (i = 0; i < s->n; i++) {
+		if (!strcmp(s->name[i], name)) {
+			*val = s->val[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int read_sysfs(const char *path, struct sample *s)
+{
+	FILE *f = fopen(path, "r");
+	char name[32];
+	unsigned long long val;
+
+	if (!f)
+		return -1;
+	while (fscanf(f, "%31s %llu", name, &val) == 2)
+		add_counter(s, name, val);
+	fclose(f);
+	return s->n ? 0 : -1;
+}
+
+static int read_ioctl(const char *node, struct sample *s)
+{
+	struct omni_stats_ioctl st;
+	int fd, ret;
+
+	/* Open only for the sample, the chardev allows one opener at a time */
+	fd = open(node, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = ioctl(fd, OMNI_IOC_GET_STATS, &st);
+	close(fd);
+	if (ret < 0)
+		return -1;
+
+	add_counter(s, "dma_reads", st.dma_reads);
+	add_counter(s, "dma_writes", st.dma_writes);
+	add_counter(s, "dma_errors", st.dma_errors);
+	add_counter(s, "dma_timeouts", st.dma_timeouts);
+	add_counter(s, "irq_count", st.irq_count);
+	return 0;
+}
+
+static void sample(struct dev *d)
+{
+	d->prev = d->cur;
+	memset(&d->cur, 0, sizeof(d->cur));
+	if (d->stats[0])
+		d->cur.ok = read_sysfs(d->stats, &d->cur) == 0;
+	else
+		d->cur.ok = read_ioctl(d->node, &d->cur) == 0;
+}
+
+/*
+ * Change of a counter over the interval, or -1 if either sample lacks it.
+ * A counter that went down was reset (OMNI_IOC_RESET_STATS or a reload).
+ */
+static double delta(const struct dev *d, const char *name)
+{
+	unsigned long long a, b;
+
+	if (!get(&d->prev, name, &a) || !get(&d->cur, name, &b))
+		return -1;
+	return b >= a ? b - a : b;
+}
+
+static void print_rate(double v, double dt, double scale, const char *fmt)
+{
+	if (v < 0)
+		printf(" %8s", "-");
+	else
+		printf(fmt, v / dt / scale);
+}
+
+static void report(double dt, int header)
+{
+	int i;
+
+	if (header)
+		printf("%-10s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "device", "r/s", "w/s", "rMB/s",
+		       "wMB/s", "avgKB", "err/s", "tmo/s", "irq/s", "aqu-sz", "queued");
+
+	for (i = 0; i < ndevs; i++) {
+		struct dev *d = &devs[i];
+		double r, w, rb, wb, ops, bytes;
+		unsigned long long queued;
+
+		if (!d->cur.ok || !d->prev.ok) {
+			printf("%-10s %s\n", d->name, d->cur.ok ? "(waiting for a second sample)" : "(unavailable)");
+			continue;
+		}
+
+		r = delta(d, "dma_reads");
+		w = delta(d, "dma_writes");
+		rb = delta(d, "read_bytes");
+		wb = delta(d, "write_bytes");
+		ops = r + w;
+		bytes = rb < 0 || wb < 0 ? -1 : rb + wb;
+
+		printf("%-10s", d->name);
+		print_rate(r, dt, 1, " %8.1f");
+		print_rate(w, dt, 1, " %8.1f");
+		print_rate(rb, dt, 1e6, " %8.2f");
+		print_rate(wb, dt, 1e6, " %8.2f");
+		if (bytes < 0)
+			printf(" %8s", "-");
+		else
+			printf(" %8.1f", ops > 0 ? bytes / ops / 1024 : 0.0);
+		print_rate(delta(d, "dma_errors"), dt, 1, " %8.1f");
+		print_rate(delta(d, "dma_timeouts"), dt, 1, " %8.1f");
+		print_rate(delta(d, "irq_count"), dt, 1, " %8.1f");
+		print_rate(delta(d, "queue_ns"), dt, 1e9, " %8.2f");
+		if (get(&d->cur, "queued", &queued))
+			printf(" %8llu\n", queued);
+		else
+			printf(" %8s\n", "-");
+	}
+	fflush(stdout);
+}
+
+static const char *help_for(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(help) / sizeof(help[0]); i++)
+		if (!strcmp(help[i][0], name))
+			return help[i][1];
+	return "OmniXtend driver counter";
+}
+
+/*
+ * Counters become omni_<name>_total, queue_ns becomes seconds and queued a
+ * gauge. The file is replaced atomically so the collector never sees a
+ * partial one.
+ */
+static int write_prom(const char *path)
+{
+	char tmp[4096];
+	FILE *f;
+	int i, j, k;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+	f = fopen(tmp, "w");
+	if (!f) {
+		perror(tmp);
+		return -1;
+	}
+
+	fprintf(f, "# HELP omni_up Whether the device's counters could be read.\n# TYPE omni_up gauge\n");
+	for (i = 0; i < ndevs; i++)
+		fprintf(f, "omni_up{device=\"%s\"} %d\n", devs[i].name, devs[i].cur.ok);
+
+	/* Group the samples by metric, as the format requires */
+	for (i = 0; i < ndevs; i++) {
+		const struct sample *s = &devs[i].cur;
+
+		for (j = 0; j < s->n; j++) {
+			const char *name = s->name[j];
+			int first = 1;
+
+			/* Only the first device that has a counter writes its samples */
+			for (k = 0; k < i && first; k++) {
+				unsigned long long v;
+
+				if (get(&devs[k].cur, name, &v))
+					first = 0;
+			}
+			if (!first)
+				continue;
+
+			if (!strcmp(name, "queued"))
+				fprintf(f, "# HELP omni_queued Transfers waiting for or holding the DMA engine.\n"
+					   "# TYPE omni_queued gauge\n");
+			else if (!strcmp(name, "queue_ns"))
+				fprintf(f, "# HELP omni_queue_seconds_total Time transfers spent waiting for or holding "
+					   "the DMA engine.\n# TYPE omni_queue_seconds_total counter\n");
+			else
+				fprintf(f, "# HELP omni_%s_total %s.\n# TYPE omni_%s_total counter\n",
+					name, help_for(name), name);
+
+			for (k = i; k < ndevs; k++) {
+				unsigned long long v;
+
+				if (!get(&devs[k].cur, name, &v))
+					continue;
+				if (!strcmp(name, "queued"))
+					fprintf(f, "omni_queued{device=\"%s\"} %llu\n", devs[k].name, v);
+				else if (!strcmp(name, "queue_ns"))
+					fprintf(f, "omni_queue_seconds_total{device=\"%s\"} %.9f\n", devs[k].name, v / 1e9);
+				else
+					fprintf(f, "omni_%s_total{device=\"%s\"} %llu\n", name, devs[k].name, v);
+			}
+		}
+	}
+
+	if (fclose(f) != 0 || rename(tmp, path) != 0) {
+		perror(path);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+static int add_dev(const char *arg)
+{
+	struct dev *d;
+	size_t i;
+
+	if (ndevs == MAX_DEVS) {
+		fprintf(stderr, "omnistat: too many devices\n");
+		return -1;
+	}
+	d = &devs[ndevs];
+
+	for (i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+		if (!strcmp(arg, known[i][0])) {
+			snprintf(d->name, sizeof(d->name), "%s", known[i][0]);
+			snprintf(d->node, sizeof(d->node), "/dev/%s", known[i][0]);
+			if (access(known[i][1], R_OK) == 0)
+				snprintf(d->stats, sizeof(d->stats), "%s", known[i][1]);
+			else if (strcmp(arg, "omnichar")) {
+				fprintf(stderr, "omnistat: %s: %s\n", known[i][1], strerror(errno));
+				return -1;
+			}
+			ndevs++;
+			return 0;
+		}
+	}
+
+	/* Any other stats file, labelled with its path */
+	snprintf(d->name, sizeof(d->name), "%s", arg);
+	snprintf(d->stats, sizeof(d->stats), "%s", arg);
+	ndevs++;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *prom = NULL;
+	double interval = 1, last, t;
+	long count = 0, reports = 0;
+	int show_time = 0, opt, i;
+	size_t k;
+
+	while ((opt = getopt(argc, argv, "d:c:tp:")) != -1) {
+		switch (opt) {
+		case 'd':
+			if (add_dev(optarg))
+				return 1;
+			break;
+		case 'c':
+			count = atol(optarg);
+			break;
+		case 't':
+			show_time = 1;
+			break;
+		case 'p':
+			prom = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind > 1)
+		goto usage;
+	if (argc - optind == 1)
+		interval = atof(argv[optind]);
+	if (interval <= 0 || count < 0)
+		goto usage;
+
+	if (ndevs == 0) {
+		for (k = 0; k < sizeof(known) / sizeof(known[0]); k++) {
+			char node[64];
+
+			snprintf(node, sizeof(node), "/dev/%s", known[k][0]);
+			if (access(known[k][1], R_OK) == 0 || (k == 0 && access(node, F_OK) == 0))
+				add_dev(known[k][0]);
+		}
+		if (ndevs == 0) {
+			fprintf(stderr, "omnistat: no OmniXtend driver loaded (omni_chardev_irq or omni_blkdev_irq)\n");
+			return 1;
+		}
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	for (i = 0; i < ndevs; i++)
+		sample(&devs[i]);
+	if (prom)
+		write_prom(prom);
+	last = now();
+
+	while (!stop && (count == 0 || reports < count)) {
+		struct timespec ts;
+		double left = last + interval - now();
+
+		if (left > 0) {
+			ts.tv_sec = left;
+			ts.tv_nsec = (left - ts.tv_sec) * 1e9;
+			if (nanosleep(&ts, NULL) && errno == EINTR)
+				continue;
+		}
+
+		t = now();
+		for (i = 0; i < ndevs; i++)
+			sample(&devs[i]);
+		if (prom)
+			write_prom(prom);
+
+		if (show_time) {
+			time_t wall = time(NULL);
+			char buf[64];
+
+			strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&wall));
+			printf("%s\n", buf);
+		}
+		report(t - last, reports % HEADER_EVERY == 0 || show_time || ndevs > 1);
+		last = t;
+		reports++;
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-d DEV]... [-c COUNT] [-t] [-p PROM] [INTERVAL]\n", argv[0]);
+	return 1;
+}
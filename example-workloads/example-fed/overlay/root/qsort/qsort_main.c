@@ -163,6 +163,9 @@ void sort(size_t n, type arr[])
 //--------------------------------------------------------------------------
 // Main
 
+// qsort-ooc links this file for sort() and brings its own main()
+#ifndef QSORT_NO_MAIN
+
 bool check_sort(type *arr, size_t n)
 { 
   for(int i = 0; i < (n - 1); i++) {
@@ -203,3 +206,5 @@ int main( int argc, char* argv[] )
 
   return EXIT_SUCCESS;
 }
+
+#endif // QSORT_NO_MAIN
@@ -0,0 +1,207 @@
+// See LICENSE for license details.
+
+//**************************************************************************
+// Out-of-core quicksort
+//--------------------------------------------------------------------------
+//
+// Sorts more data than the given memory budget allows. The input is
+// generated like the qsort benchmark (srand(0), rand()) one budget-sized
+// chunk at a time; each chunk is sorted with the same quicksort and
+// spilled as a sorted run to MECA remote memory (libmecaspill). The runs
+// are then merged, in several passes if there are more of them than the
+// budget has read buffers for. The final merge checks the order and a
+// checksum instead of writing the result back out.
+//
+// Usage: qsort-ooc [-d DEV] [-t DIR] [-r BYTES] SIZE MEM
+//   SIZE      bytes to sort
+//   MEM       in-memory budget in bytes
+//   -d DEV    spill device (default /dev/omnichar)
+//   -t DIR    directory for the disk fallback (default /tmp)
+//   -r BYTES  use at most this much remote memory, to try the fallback
+
+#include "spill.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <queue>
+#include <unistd.h>
+#include <vector>
+
+typedef int32_t type;
+
+// The quicksort from qsort_main.c
+extern "C" void sort(size_t n, type arr[]);
+
+namespace {
+
+double seconds(std::chrono::steady_clock::time_point since)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Buffered reader of one run's values
+struct Cursor {
+	std::unique_ptr<meca::RunReader> reader;
+	std::vector<type> buf;
+	size_t pos = 0, len = 0;
+
+	bool next(type &v)
+	{
+		if (pos == len) {
+			len = reader->read(buf.data(), buf.size() * sizeof(type)) / sizeof(type);
+			pos = 0;
+			if (!len)
+				return false;
+		}
+		v = buf[pos++];
+		return true;
+	}
+};
+
+// k-way merge of runs; out is called with every value in order
+template <typename Out>
+void merge(meca::SpillTier &tier, std::vector<meca::Run> &runs, size_t buf_values, Out out)
+{
+	std::vector<Cursor> cur(runs.size());
+	typedef std::pair<type, size_t> Head;
+	std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+
+	for (size_t i = 0; i < runs.size(); i++) {
+		type v;
+		cur[i].reader = tier.reader(runs[i]);
+		cur[i].buf.resize(buf_values);
+		if (cur[i].next(v))
+			heap.push({v, i});
+	}
+	while (!heap.empty()) {
+		Head h = heap.top();
+		heap.pop();
+		out(h.first);
+		type v;
+		if (cur[h.second].next(v))
+			heap.push({v, h.second});
+	}
+	for (auto &r : runs)
+		tier.release(r);
+}
+
+int usage()
+{
+	std::fprintf(stderr, "usage: qsort-ooc [-d DEV] [-t DIR] [-r BYTES] SIZE MEM\n"
+			     "\tSIZE - bytes to sort\n\tMEM  - in-memory budget in bytes\n");
+	return EXIT_FAILURE;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	meca::SpillConfig cfg;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:t:r:")) != -1) {
+		switch (opt) {
+		case 'd':
+			cfg.device = optarg;
+			break;
+		case 't':
+			cfg.disk_dir = optarg;
+			break;
+		case 'r':
+			cfg.remote_limit = std::strtoull(optarg, NULL, 0);
+			break;
+		default:
+			return usage();
+		}
+	}
+	if (argc - optind != 2)
+		return usage();
+
+	size_t n = std::strtoull(argv[optind], NULL, 0) / sizeof(type);
+	size_t mem = std::strtoull(argv[optind + 1], NULL, 0);
+	size_t chunk = mem / sizeof(type);
+
+	try {
+		meca::SpillTier tier(cfg);
+		// Each reader and writer holds two blocks; 1/4 of the budget per merge input buffer
+		size_t fanin = std::max<size_t>(2, mem / (2 * tier.blockSize() + tier.blockSize() / 4));
+		size_t buf_values = tier.blockSize() / 4 / sizeof(type);
+
+		if (!chunk || n <= chunk)
+			std::printf("everything fits in memory, use ./qsort\n");
+		if (!chunk)
+			return EXIT_FAILURE;
+		std::printf("Gonna sort %zu values in %zu-value runs, merge fan-in %zu, spilling to %s (pid=%d)\n",
+			    n, chunk, fanin, tier.hasRemote() ? cfg.device.c_str() : cfg.disk_dir.c_str(), getpid());
+
+		// Phase 1: sorted runs
+		auto t0 = std::chrono::steady_clock::now();
+		std::vector<type> arr(std::min(n, chunk));
+		std::vector<meca::Run> runs;
+		int64_t sum = 0;
+
+		srand(0);
+		for (size_t done = 0; done < n;) {
+			size_t m = std::min(chunk, n - done);
+			for (size_t i = 0; i < m; i++) {
+				arr[i] = rand();
+				sum += arr[i];
+			}
+			sort(m, arr.data());
+			auto w = tier.writer();
+			w->write(arr.data(), m * sizeof(type));
+			runs.push_back(w->finish());
+			done += m;
+		}
+		std::vector<type>().swap(arr);
+		double t_runs = seconds(t0);
+
+		// Phase 2: intermediate merges until one pass can finish
+		auto t1 = std::chrono::steady_clock::now();
+		int passes = 0;
+		while (runs.size() > fanin) {
+			std::vector<meca::Run> next;
+			for (size_t i = 0; i < runs.size(); i += fanin) {
+				std::vector<meca::Run> group(std::make_move_iterator(runs.begin() + i),
+							     std::make_move_iterator(runs.begin() +
+										     std::min(runs.size(), i + fanin)));
+				auto w = tier.writer();
+				merge(tier, group, buf_values, [&](type v) { w->write(&v, sizeof(v)); });
+				next.push_back(w->finish());
+			}
+			runs.swap(next);
+			passes++;
+		}
+
+		// Phase 3: final merge, checked
+		bool sorted = true;
+		size_t count = 0;
+		int64_t check = 0;
+		type prev = 0;
+		merge(tier, runs, buf_values, [&](type v) {
+			if (count++ && v < prev)
+				sorted = false;
+			prev = v;
+			check += v;
+		});
+		double t_merge = seconds(t1);
+
+		meca::SpillStats s = tier.stats();
+		std::printf("runs %.3f s, merge %.3f s (%d intermediate passes)\n", t_runs, t_merge, passes);
+		std::printf("spilled: remote %.1f MB written %.1f MB read, disk %.1f MB written %.1f MB read\n",
+			    s.remote_written / 1e6, s.remote_read / 1e6, s.disk_written / 1e6, s.disk_read / 1e6);
+
+		if (sorted && count == n && check == sum) {
+			std::printf("Prolly sorted 'em by now (pid=%d)\n", getpid());
+			return EXIT_SUCCESS;
+		}
+		std::printf("I sorted wrong!!!! %zu of %zu values (pid=%d)\n", count, n, getpid());
+	} catch (const std::exception &e) {
+		std::fprintf(stderr, "qsort-ooc: %s\n", e.what());
+	}
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,10 @@
+#!/bin/bash
+set -x
+
+# Out-of-core variant of runQsort.sh: sorts 64MB within an 8MB budget,
+# spilling sorted runs to MECA remote memory (/dev/omnichar) and to /tmp
+# when there is no remote memory (or it is full).
+
+cd root/qsort
+/usr/bin/time -f "%S,%M,%F" ./qsort-ooc 67108864 8388608 2> ../run_result.csv
+poweroff
@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# Cross-compile the memory hog used by the tiering test.
+echo "Building memhog"
+cd overlay/root/meca-tier
+
+make
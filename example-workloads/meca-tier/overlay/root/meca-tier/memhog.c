@@ -0,0 +1,44 @@
+// memhog: allocate and keep touching a block of anonymous memory so the
+// tiering test has something to place, limit and demote.
+//
+// Usage: memhog <MiB> <seconds>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <MiB> <seconds>\n", argv[0]);
+        return 1;
+    }
+
+    size_t size = strtoul(argv[1], NULL, 0) << 20;
+    long seconds = strtol(argv[2], NULL, 0);
+    long page = sysconf(_SC_PAGESIZE);
+
+    char *buf = malloc(size);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    memset(buf, 1, size);
+    printf("memhog %d: touching %zu MiB for %ld s\n", getpid(), size >> 20, seconds);
+    fflush(stdout);
+
+    // Sweep one byte per page so every page stays referenced.
+    time_t end = time(NULL) + seconds;
+    unsigned long sweeps = 0;
+    while (time(NULL) < end) {
+        for (size_t off = 0; off < size; off += page)
+            buf[off]++;
+        sweeps++;
+    }
+
+    printf("memhog %d: %lu sweeps\n", getpid(), sweeps);
+    free(buf);
+    return 0;
+}
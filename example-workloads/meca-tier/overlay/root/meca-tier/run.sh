@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Two tenants share the node: "latency" may only use local DRAM, "batch" is
+# limited to 64 MiB of DRAM and demoted to the MECA tier beyond that.
+
+cd /root/meca-tier
+
+# Bring the first 256 MiB of the MECA window online.
+MEM=/sys/devices/system/memory
+bs=$((0x$(cat $MEM/block_size_bytes)))
+addr=$((0x200000000))
+while [ $addr -lt $((0x200000000 + 256 * 1024 * 1024)) ]; do
+    blk=$((addr / bs))
+    [ -d $MEM/memory$blk ] || echo $(printf "0x%x" $addr) > $MEM/probe
+    [ "$(cat $MEM/memory$blk/state)" = online ] ||
+        echo online_movable > $MEM/memory$blk/state
+    addr=$((addr + bs))
+done
+
+meca-tierctl create latency mems=dram
+meca-tierctl create batch dram_max=$((64 * 1024 * 1024)) reclaim=meca
+
+meca-tierctl enforce -i 1 &
+enforcer=$!
+
+meca-tierctl run latency ./memhog 32 20 &
+latency=$!
+meca-tierctl run batch ./memhog 192 20 &
+batch=$!
+
+sleep 5
+meca-tierctl stat -i 5 latency batch &
+stat=$!
+wait $latency $batch
+
+kill $stat $enforcer
+meca-tierctl stat
+meca-tierctl remove latency
+meca-tierctl remove batch
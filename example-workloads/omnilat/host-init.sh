@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# CONFIG_DEBUG_INFO_BTF (linux-config) runs pahole while linking the kernel
+if ! command -v pahole > /dev/null; then
+    echo "omnilat: pahole not found, install dwarves (pahole >= 1.16) to build a kernel with BTF" >&2
+    exit 1
+fi
@@ -0,0 +1,246 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * omnilat.bpf.c - latency, throughput and per-process attribution for the
+ * OmniXtend chardev and blkdev drivers, using kprobes on their existing
+ * functions. Everything is aggregated in kernel; user space only reads the
+ * maps once per interval.
+ */
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+#include "omnilat.h"
+
+char LICENSE[] SEC("license") = "GPL";
+
+/* Only attribute to this tgid (0: everyone), set by the loader */
+const volatile __u32 target_tgid = 0;
+
+struct start_key {
+	__u32 tid;
+	__u32 phase;
+};
+
+struct start_val {
+	__u64 ts;
+	__u64 bytes;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 4096);
+	__type(key, struct start_key);
+	__type(value, struct start_val);
+} starts SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, NR_PHASES * NR_BUCKETS);
+	__type(key, __u32);
+	__type(value, __u64);
+} hists SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, NR_PHASES);
+	__type(key, __u32);
+	__type(value, struct phase_stat);
+} stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 1024);
+	__type(key, __u32);
+	__type(value, struct proc_stat);
+} procs SEC(".maps");
+
+/* When the engine was last kicked (or last completed), for PH_DMA_IRQ */
+__u64 last_dma_start = 0;
+
+static __always_inline __u32 log2_u64(__u64 v)
+{
+	__u32 r, s;
+
+	r = (v > 0xFFFFFFFF) << 5; v >>= r;
+	s = (v > 0xFFFF) << 4; v >>= s; r |= s;
+	s = (v > 0xFF) << 3; v >>= s; r |= s;
+	s = (v > 0xF) << 2; v >>= s; r |= s;
+	s = (v > 0x3) << 1; v >>= s; r |= s;
+	return r | (v >> 1);
+}
+
+static __always_inline void record(__u32 phase, __u64 ns, __u64 bytes, bool attribute)
+{
+	struct phase_stat *st;
+	__u32 idx = log2_u64(ns);
+	__u64 *slot;
+
+	if (idx >= NR_BUCKETS)
+		idx = NR_BUCKETS - 1;
+	idx += phase * NR_BUCKETS;
+	slot = bpf_map_lookup_elem(&hists, &idx);
+	if (slot)
+		(*slot)++;
+
+	st = bpf_map_lookup_elem(&stats, &phase);
+	if (st) {
+		st->count++;
+		st->bytes += bytes;
+		st->total_ns += ns;
+		if (ns > st->max_ns)
+			st->max_ns = ns;
+	}
+
+	if (!attribute || phase >= NR_PHASES)
+		return;
+
+	__u32 tgid = bpf_get_current_pid_tgid() >> 32;
+	struct proc_stat *ps = bpf_map_lookup_elem(&procs, &tgid);
+	if (!ps) {
+		struct proc_stat zero = {};
+
+		bpf_get_current_comm(zero.comm, sizeof(zero.comm));
+		bpf_map_update_elem(&procs, &tgid, &zero, BPF_NOEXIST);
+		ps = bpf_map_lookup_elem(&procs, &tgid);
+		if (!ps)
+			return;
+	}
+	__sync_fetch_and_add(&ps->count[phase], 1);
+	__sync_fetch_and_add(&ps->bytes[phase], bytes);
+	__sync_fetch_and_add(&ps->total_ns[phase], ns);
+}
+
+static __always_inline bool wanted(void)
+{
+	return target_tgid == 0 || (bpf_get_current_pid_tgid() >> 32) == target_tgid;
+}
+
+static __always_inline void enter(__u32 phase, __u64 bytes)
+{
+	struct start_key key = { .tid = (__u32)bpf_get_current_pid_tgid(), .phase = phase };
+	struct start_val val = { .ts = bpf_ktime_get_ns(), .bytes = bytes };
+
+	if (!wanted())
+		return;
+	bpf_map_update_elem(&starts, &key, &val, BPF_ANY);
+}
+
+/* ret_bytes < 0 means "use the byte count recorded on entry" */
+static __always_inline void leave(__u32 phase, long ret_bytes)
+{
+	struct start_key key = { .tid = (__u32)bpf_get_current_pid_tgid(), .phase = phase };
+	struct start_val *val;
+	__u64 bytes;
+
+	val = bpf_map_lookup_elem(&starts, &key);
+	if (!val)
+		return;
+
+	bytes = ret_bytes < 0 ? val->bytes : (__u64)ret_bytes;
+	record(phase, bpf_ktime_get_ns() - val->ts, bytes, true);
+	bpf_map_delete_elem(&starts, &key);
+}
+
+static __always_inline void dma_kick(void)
+{
+	last_dma_start = bpf_ktime_get_ns();
+}
+
+/* blkdev */
+
+SEC("kprobe/omni_handle_request")
+int BPF_KPROBE(blk_request_enter, void *dev, struct request *rq)
+{
+	enter(PH_BLK_REQUEST, BPF_CORE_READ(rq, __data_len));
+	return 0;
+}
+
+SEC("kretprobe/omni_handle_request")
+int BPF_KRETPROBE(blk_request_exit)
+{
+	leave(PH_BLK_REQUEST, -1);
+	return 0;
+}
+
+SEC("kprobe/omni_do_dma_transfer")
+int BPF_KPROBE(blk_dma_enter, void *dev, __u64 omni_offset, size_t len)
+{
+	dma_kick();
+	enter(PH_BLK_DMA, len);
+	return 0;
+}
+
+SEC("kretprobe/omni_do_dma_transfer")
+int BPF_KRETPROBE(blk_dma_exit)
+{
+	leave(PH_BLK_DMA, -1);
+	return 0;
+}
+
+/* chardev */
+
+SEC("kprobe/omni_chardev_read")
+int BPF_KPROBE(chr_read_enter)
+{
+	dma_kick();
+	enter(PH_CHR_READ, 0);
+	return 0;
+}
+
+SEC("kretprobe/omni_chardev_read")
+int BPF_KRETPROBE(chr_read_exit, long ret)
+{
+	leave(PH_CHR_READ, ret > 0 ? ret : 0);
+	return 0;
+}
+
+SEC("kprobe/omni_chardev_write")
+int BPF_KPROBE(chr_write_enter)
+{
+	dma_kick();
+	enter(PH_CHR_WRITE, 0);
+	return 0;
+}
+
+SEC("kretprobe/omni_chardev_write")
+int BPF_KRETPROBE(chr_write_exit, long ret)
+{
+	leave(PH_CHR_WRITE, ret > 0 ? ret : 0);
+	return 0;
+}
+
+/*
+ * Completion interrupt (both drivers use the same handler name). The chardev
+ * starts its next chunk right after the previous one completes, so the time
+ * since the last kick or completion approximates one DMA chunk.
+ */
+SEC("kprobe/omni_dma_irq_handler")
+int BPF_KPROBE(irq_enter)
+{
+	struct start_key key = { .tid = bpf_get_smp_processor_id(), .phase = PH_IRQ };
+	struct start_val val = { .ts = bpf_ktime_get_ns() };
+	__u64 kicked = last_dma_start;
+
+	if (kicked && val.ts > kicked)
+		record(PH_DMA_IRQ, val.ts - kicked, 0, false);
+	last_dma_start = val.ts;
+
+	/* Keyed by CPU: the handler cannot migrate */
+	key.tid |= 0x80000000;
+	bpf_map_update_elem(&starts, &key, &val, BPF_ANY);
+	return 0;
+}
+
+SEC("kretprobe/omni_dma_irq_handler")
+int BPF_KRETPROBE(irq_exit)
+{
+	struct start_key key = { .tid = bpf_get_smp_processor_id() | 0x80000000, .phase = PH_IRQ };
+	struct start_val *val = bpf_map_lookup_elem(&starts, &key);
+
+	if (!val)
+		return 0;
+	record(PH_IRQ, bpf_ktime_get_ns() - val->ts, 0, false);
+	bpf_map_delete_elem(&starts, &key);
+	return 0;
+}
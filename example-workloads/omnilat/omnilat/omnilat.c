@@ -0,0 +1,355 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * omnilat - latency histograms, throughput and per-process attribution for
+ * the OmniXtend chardev/blkdev drivers, without rebuilding them.
+ *
+ * Usage: omnilat [-i SECS] [-d SECS] [-p PID] [-H] [-P] [-q]
+ *   -i SECS  print one summary line per phase every SECS seconds (default 1)
+ *   -d SECS  stop after SECS seconds (default: until Ctrl-C)
+ *   -p PID   only trace this process (IRQ phases are always global)
+ *   -H       print latency histograms on exit
+ *   -P       print per-process attribution on exit
+ *   -q       no periodic output, only the final summary
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "omnilat.h"
+#include "omnilat.skel.h"
+
+static const char *phase_names[NR_PHASES] = {
+	[PH_BLK_REQUEST] = "blk-request",
+	[PH_BLK_DMA]     = "blk-dma",
+	[PH_CHR_READ]    = "chr-read",
+	[PH_CHR_WRITE]   = "chr-write",
+	[PH_DMA_IRQ]     = "dma-to-irq",
+	[PH_IRQ]         = "irq-handler",
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int libbpf_print(enum libbpf_print_level level, const char *fmt, va_list args)
+{
+	if (level == LIBBPF_DEBUG)
+		return 0;
+	return vfprintf(stderr, fmt, args);
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Sum a per-CPU phase_stat array into stat[NR_PHASES] */
+static int read_stats(int fd, int ncpus, struct phase_stat *stat)
+{
+	struct phase_stat *vals = calloc(ncpus, sizeof(*vals));
+	__u32 ph;
+	int cpu;
+
+	if (!vals)
+		return -ENOMEM;
+	for (ph = 0; ph < NR_PHASES; ph++) {
+		memset(&stat[ph], 0, sizeof(stat[ph]));
+		if (bpf_map_lookup_elem(fd, &ph, vals))
+			continue;
+		for (cpu = 0; cpu < ncpus; cpu++) {
+			stat[ph].count += vals[cpu].count;
+			stat[ph].bytes += vals[cpu].bytes;
+			stat[ph].total_ns += vals[cpu].total_ns;
+			if (vals[cpu].max_ns > stat[ph].max_ns)
+				stat[ph].max_ns = vals[cpu].max_ns;
+		}
+	}
+	free(vals);
+	return 0;
+}
+
+/* Sum the per-CPU histograms into hist[NR_PHASES][NR_BUCKETS] */
+static int read_hists(int fd, int ncpus, __u64 hist[NR_PHASES][NR_BUCKETS])
+{
+	__u64 *vals = calloc(ncpus, sizeof(*vals));
+	__u32 idx;
+	int cpu;
+
+	if (!vals)
+		return -ENOMEM;
+	for (idx = 0; idx < NR_PHASES * NR_BUCKETS; idx++) {
+		__u64 sum = 0;
+
+		if (!bpf_map_lookup_elem(fd, &idx, vals))
+			for (cpu = 0; cpu < ncpus; cpu++)
+				sum += vals[cpu];
+		hist[idx / NR_BUCKETS][idx % NR_BUCKETS] = sum;
+	}
+	free(vals);
+	return 0;
+}
+
+/* Upper bound (ns) of the bucket holding the given quantile */
+static __u64 quantile(const __u64 *hist, __u64 total, double q)
+{
+	__u64 want = (__u64)(total * q), seen = 0;
+	int b;
+
+	if (total == 0)
+		return 0;
+	for (b = 0; b < NR_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen > want)
+			return 1ULL << (b + 1);
+	}
+	return 1ULL << NR_BUCKETS;
+}
+
+static void print_usec(double ns)
+{
+	printf(" %10.1f", ns / 1000.0);
+}
+
+static void print_interval(const struct phase_stat *cur, const struct phase_stat *prev,
+			   __u64 hist[NR_PHASES][NR_BUCKETS], __u64 prev_hist[NR_PHASES][NR_BUCKETS],
+			   double secs)
+{
+	__u64 delta[NR_BUCKETS];
+	time_t t = time(NULL);
+	char stamp[16];
+	int ph, b;
+
+	strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime(&t));
+	for (ph = 0; ph < NR_PHASES; ph++) {
+		__u64 n = cur[ph].count - prev[ph].count;
+		__u64 bytes = cur[ph].bytes - prev[ph].bytes;
+		__u64 ns = cur[ph].total_ns - prev[ph].total_ns;
+
+		if (n == 0)
+			continue;
+		for (b = 0; b < NR_BUCKETS; b++)
+			delta[b] = hist[ph][b] - prev_hist[ph][b];
+
+		printf("%s %-12s %9.0f", stamp, phase_names[ph], n / secs);
+		printf(" %9.2f", bytes / secs / 1e6);
+		print_usec((double)ns / n);
+		print_usec(quantile(delta, n, 0.50));
+		print_usec(quantile(delta, n, 0.99));
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+static void print_hists(__u64 hist[NR_PHASES][NR_BUCKETS])
+{
+	int ph, b, lo, hi;
+
+	for (ph = 0; ph < NR_PHASES; ph++) {
+		__u64 max = 0;
+
+		lo = NR_BUCKETS;
+		hi = -1;
+		for (b = 0; b < NR_BUCKETS; b++) {
+			if (!hist[ph][b])
+				continue;
+			if (b < lo)
+				lo = b;
+			hi = b;
+			if (hist[ph][b] > max)
+				max = hist[ph][b];
+		}
+		if (hi < 0)
+			continue;
+
+		printf("\n%s latency (ns):\n", phase_names[ph]);
+		for (b = lo; b <= hi; b++) {
+			int bar = (int)(hist[ph][b] * 40 / max);
+
+			printf("  %12llu -> %-12llu : %-10llu |%.*s%*s|\n",
+			       b ? 1ULL << b : 0ULL, (1ULL << (b + 1)) - 1,
+			       (unsigned long long)hist[ph][b],
+			       bar, "****************************************", 40 - bar, "");
+		}
+	}
+}
+
+static void print_procs(int fd)
+{
+	struct proc_stat ps;
+	__u32 key, next, *cur = NULL;
+	int ph;
+
+	printf("\n%-8s %-16s %-12s %10s %12s %10s\n", "PID", "COMM", "PHASE", "OPS", "BYTES", "AVG(us)");
+	while (!bpf_map_get_next_key(fd, cur, &next)) {
+		key = next;
+		cur = &key;
+		if (bpf_map_lookup_elem(fd, &key, &ps))
+			continue;
+		for (ph = 0; ph < NR_PHASES; ph++) {
+			if (!ps.count[ph])
+				continue;
+			printf("%-8u %-16.16s %-12s %10llu %12llu %10.1f\n", key, ps.comm, phase_names[ph],
+			       (unsigned long long)ps.count[ph], (unsigned long long)ps.bytes[ph],
+			       ps.total_ns[ph] / 1000.0 / ps.count[ph]);
+		}
+	}
+}
+
+static void print_totals(const struct phase_stat *stat, double secs)
+{
+	int ph;
+
+	printf("\n%-12s %10s %12s %10s %10s %10s\n", "PHASE", "OPS", "BYTES", "MB/s", "AVG(us)", "MAX(us)");
+	for (ph = 0; ph < NR_PHASES; ph++) {
+		if (!stat[ph].count)
+			continue;
+		printf("%-12s %10llu %12llu %10.2f %10.1f %10.1f\n", phase_names[ph],
+		       (unsigned long long)stat[ph].count, (unsigned long long)stat[ph].bytes,
+		       stat[ph].bytes / secs / 1e6, stat[ph].total_ns / 1000.0 / stat[ph].count,
+		       stat[ph].max_ns / 1000.0);
+	}
+}
+
+/*
+ * Attach each program on its own so that one missing symbol (module not
+ * loaded, or the function was inlined) doesn't prevent tracing the rest.
+ */
+static int attach_all(struct omnilat_bpf *skel)
+{
+	struct bpf_program *prog;
+	int attached = 0;
+
+	bpf_object__for_each_program(prog, skel->obj) {
+		struct bpf_link *link = bpf_program__attach(prog);
+
+		if (!link) {
+			fprintf(stderr, "omnilat: not tracing %s (%s), is the driver loaded?\n",
+				bpf_program__section_name(prog), strerror(errno));
+			continue;
+		}
+		attached++;
+	}
+	return attached;
+}
+
+int main(int argc, char **argv)
+{
+	static __u64 hist[NR_PHASES][NR_BUCKETS], prev_hist[NR_PHASES][NR_BUCKETS];
+	struct phase_stat stat[NR_PHASES], prev[NR_PHASES];
+	double interval = 1.0, duration = 0, start, last;
+	int show_hist = 0, show_procs = 0, quiet = 0;
+	struct omnilat_bpf *skel;
+	int ncpus, opt, err = 0;
+	long pid = 0;
+
+	while ((opt = getopt(argc, argv, "i:d:p:HPqh")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'p':
+			pid = strtol(optarg, NULL, 0);
+			break;
+		case 'H':
+			show_hist = 1;
+			break;
+		case 'P':
+			show_procs = 1;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i SECS] [-d SECS] [-p PID] [-H] [-P] [-q]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (interval <= 0) {
+		fprintf(stderr, "omnilat: interval must be positive\n");
+		return 1;
+	}
+
+	libbpf_set_print(libbpf_print);
+	ncpus = libbpf_num_possible_cpus();
+	if (ncpus < 0) {
+		fprintf(stderr, "omnilat: cannot get the number of CPUs\n");
+		return 1;
+	}
+
+	skel = omnilat_bpf__open();
+	if (!skel) {
+		fprintf(stderr, "omnilat: failed to open the BPF object\n");
+		return 1;
+	}
+	skel->rodata->target_tgid = (__u32)pid;
+
+	err = omnilat_bpf__load(skel);
+	if (err) {
+		fprintf(stderr, "omnilat: failed to load the BPF object (needs CONFIG_DEBUG_INFO_BTF and root)\n");
+		goto out;
+	}
+	if (attach_all(skel) == 0) {
+		fprintf(stderr, "omnilat: nothing to trace, load omni_chardev or omni_blkdev first\n");
+		err = 1;
+		goto out;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	memset(prev, 0, sizeof(prev));
+	if (!quiet)
+		printf("%-8s %-12s %9s %9s %10s %10s %10s\n", "TIME", "PHASE", "OPS/s", "MB/s",
+		       "AVG(us)", "P50(us)", "P99(us)");
+
+	start = last = now_sec();
+	while (!stop) {
+		double now, sleep_for = interval;
+
+		if (duration > 0 && last + interval > start + duration)
+			sleep_for = start + duration - last;
+		if (sleep_for > 0)
+			usleep((useconds_t)(sleep_for * 1e6));
+
+		now = now_sec();
+		if (!quiet) {
+			read_stats(bpf_map__fd(skel->maps.stats), ncpus, stat);
+			read_hists(bpf_map__fd(skel->maps.hists), ncpus, hist);
+			print_interval(stat, prev, hist, prev_hist, now - last);
+			memcpy(prev, stat, sizeof(prev));
+			memcpy(prev_hist, hist, sizeof(prev_hist));
+		}
+		last = now;
+		if (duration > 0 && now - start >= duration)
+			break;
+	}
+
+	read_stats(bpf_map__fd(skel->maps.stats), ncpus, stat);
+	print_totals(stat, now_sec() - start);
+	if (show_hist) {
+		read_hists(bpf_map__fd(skel->maps.hists), ncpus, hist);
+		print_hists(hist);
+	}
+	if (show_procs)
+		print_procs(bpf_map__fd(skel->maps.procs));
+
+out:
+	omnilat_bpf__destroy(skel);
+	return err != 0;
+}
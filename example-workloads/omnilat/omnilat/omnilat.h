@@ -0,0 +1,39 @@
+/*
+ * omnilat.h - definitions shared by the omnilat BPF program and its loader
+ */
+
+#ifndef _OMNILAT_H
+#define _OMNILAT_H
+
+/* Latency phases */
+enum omnilat_phase {
+	PH_BLK_REQUEST,		/* omni_handle_request(): one blk-mq request */
+	PH_BLK_DMA,		/* omni_do_dma_transfer(): one DMA chunk incl. wait */
+	PH_CHR_READ,		/* omni_chardev_read() */
+	PH_CHR_WRITE,		/* omni_chardev_write() */
+	PH_DMA_IRQ,		/* DMA start (or previous completion) to completion IRQ */
+	PH_IRQ,			/* omni_dma_irq_handler() itself */
+	NR_PHASES,
+};
+
+/* log2(nanoseconds) histogram buckets, the last one is open ended */
+#define NR_BUCKETS	36
+
+#define OMNILAT_COMM_LEN	16
+
+struct phase_stat {
+	__u64 count;
+	__u64 bytes;
+	__u64 total_ns;
+	__u64 max_ns;
+};
+
+/* Per-process attribution (keyed by tgid) */
+struct proc_stat {
+	char comm[OMNILAT_COMM_LEN];
+	__u64 count[NR_PHASES];
+	__u64 bytes[NR_PHASES];
+	__u64 total_ns[NR_PHASES];
+};
+
+#endif /* _OMNILAT_H */
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+# Build omnilat against the BTF of the kernel that was just built
+echo "Building omnilat"
+exec make -C omnilat VMLINUX="$FIREMARSHAL_LINUX_SRC/vmlinux"
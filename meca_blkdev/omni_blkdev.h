@@ -63,6 +63,10 @@ struct omni_blkdev {
 	atomic64_t dma_errors;
 	atomic64_t dma_timeouts;
 	atomic64_t irq_count;
+	atomic64_t read_bytes;		/* bytes moved by dma_reads */
+	atomic64_t write_bytes;		/* bytes moved by dma_writes */
+	atomic64_t queue_ns;		/* time requests spent waiting for or holding the engine */
+	atomic_t dma_queued;		/* requests waiting for or holding the engine */
 };
 
 #endif /* _OMNI_BLKDEV_H */
@@ -18,6 +18,7 @@
 #include <linux/io.h>
 #include <linux/interrupt.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 #include <linux/bio.h>
 #include <linux/highmem.h>
 #include <linux/platform_device.h>
@@ -146,9 +147,11 @@ static int omni_do_dma_transfer(struct omni_blkdev *dev, u64 omni_offset,
 	if (is_write) {
 		omni_flush_dcache_range(omni_addr, len);
 		atomic64_inc(&dev->dma_writes);
+		atomic64_add(len, &dev->write_bytes);
 	} else {
 		omni_flush_dcache_range(dev->dma_buffer_phys, len);
 		atomic64_inc(&dev->dma_reads);
+		atomic64_add(len, &dev->read_bytes);
 	}
 
 	return 0;
@@ -173,8 +176,14 @@ static blk_status_t omni_handle_request(struct omni_blkdev *dev,
 	void *buf;
 	size_t offset;
 	size_t chunk_size;
+	u64 queued = ktime_get_ns();
 	int ret;
 
+	/*
+	 * queue_ns adds up the time requests wait for or hold the engine, so
+	 * its rate is the average number of requests queued (iostat's aqu-sz)
+	 */
+	atomic_inc(&dev->dma_queued);
 	mutex_lock(&dev->dma_mutex);
 
 	rq_for_each_segment(bvec, rq, iter) {
@@ -220,6 +229,8 @@ static blk_status_t omni_handle_request(struct omni_blkdev *dev,
 
 out:
 	mutex_unlock(&dev->dma_mutex);
+	atomic_dec(&dev->dma_queued);
+	atomic64_add(ktime_get_ns() - queued, &dev->queue_ns);
 	return status;
 }
 
@@ -280,6 +291,52 @@ static const struct block_device_operations omni_fops = {
 	.release = omni_release,
 };
 
+/*
+ * /sys/block/omniblk/omni/stats: the driver's counters, one "name value" per
+ * line (sampled by omnistat)
+ */
+static ssize_t stats_show(struct device *d, struct device_attribute *attr,
+			  char *buf)
+{
+	struct omni_blkdev *dev = dev_to_disk(d)->private_data;
+
+	return scnprintf(buf, PAGE_SIZE,
+			 "dma_reads %lld\n"
+			 "dma_writes %lld\n"
+			 "read_bytes %lld\n"
+			 "write_bytes %lld\n"
+			 "dma_errors %lld\n"
+			 "dma_timeouts %lld\n"
+			 "irq_count %lld\n"
+			 "queue_ns %lld\n"
+			 "queued %d\n",
+			 atomic64_read(&dev->dma_reads),
+			 atomic64_read(&dev->dma_writes),
+			 atomic64_read(&dev->read_bytes),
+			 atomic64_read(&dev->write_bytes),
+			 atomic64_read(&dev->dma_errors),
+			 atomic64_read(&dev->dma_timeouts),
+			 atomic64_read(&dev->irq_count),
+			 atomic64_read(&dev->queue_ns),
+			 atomic_read(&dev->dma_queued));
+}
+static DEVICE_ATTR_RO(stats);
+
+static struct attribute *omni_attrs[] = {
+	&dev_attr_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group omni_attr_group = {
+	.name = "omni",
+	.attrs = omni_attrs,
+};
+
+static const struct attribute_group *omni_attr_groups[] = {
+	&omni_attr_group,
+	NULL,
+};
+
 /*****************************************************************************
  * Platform Driver Probe/Remove
  *****************************************************************************/
@@ -328,6 +385,10 @@ static int omni_blkdev_probe(struct platform_device *pdev)
 	atomic64_set(&dev->dma_errors, 0);
 	atomic64_set(&dev->dma_timeouts, 0);
 	atomic64_set(&dev->irq_count, 0);
+	atomic64_set(&dev->read_bytes, 0);
+	atomic64_set(&dev->write_bytes, 0);
+	atomic64_set(&dev->queue_ns, 0);
+	atomic_set(&dev->dma_queued, 0);
 
 	/* Get DMA controller registers from device tree */
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
@@ -422,8 +483,8 @@ static int omni_blkdev_probe(struct platform_device *pdev)
 	/* Store device pointer in queue */
 	dev->disk->queue->queuedata = dev;
 
-	/* Add disk to system */
-	ret = add_disk(dev->disk);
+	/* Add disk to system (with the omni/stats attribute) */
+	ret = device_add_disk(&pdev->dev, dev->disk, omni_attr_groups);
 	if (ret) {
 		dev_err(&pdev->dev, "Failed to add disk: %d\n", ret);
 		goto err_put_disk;
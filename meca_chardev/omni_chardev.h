@@ -10,9 +10,40 @@
 #include <linux/cdev.h>
 #include <linux/mutex.h>
 #include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 
 #include "omni_chardev_common.h"
 
+struct omni_chardev;
+
+enum omni_pf_state {
+	PF_FREE,
+	PF_QUEUED,
+	PF_INFLIGHT,
+	PF_READY,
+};
+
+/* One staging slot of the prefetch cache */
+struct omni_pf_slot {
+	struct omni_chardev *dev;
+	struct work_struct work;
+	struct completion done;
+
+	void *buf;
+	dma_addr_t buf_phys;
+
+	/* Protected by pf_lock */
+	enum omni_pf_state state;
+	loff_t offset;
+	size_t len;
+	int users;		/* readers copying out of buf */
+	bool stale;		/* overwritten while in flight */
+	bool failed;
+	u64 last_use;
+};
+
 /* Device structure for interrupt-based driver */
 struct omni_chardev {
 	/* Character device */
@@ -34,10 +65,26 @@ struct omni_chardev {
 	dma_addr_t dma_buffer_phys;
 	size_t dma_buffer_size;
 
+	/* CPU path for split transfers: remote window and bounce buffer */
+	void __iomem *omni_window;
+	void *cpu_buffer;
+
+	/* Measured rates (bytes/us, EWMA) used to size the CPU slice */
+	u32 dma_rate;
+	u32 cpu_rate;
+
+	/* Prefetch staging cache */
+	struct omni_pf_slot *pf_slots;
+	unsigned int pf_nslots;
+	spinlock_t pf_lock;
+	u64 pf_clock;
+	struct workqueue_struct *pf_wq;
+
 	/* Synchronization - uses mutexes (can sleep) */
 	struct mutex dev_mutex;
 	struct mutex dma_mutex;
 	struct completion dma_complete;
+	ktime_t dma_done;	/* set by the IRQ handler */
 
 	/* Device parameters */
 	size_t omni_size_bytes;
@@ -48,6 +95,18 @@ struct omni_chardev {
 	atomic64_t dma_errors;
 	atomic64_t dma_timeouts;
 	atomic64_t irq_count;
+	atomic64_t split_transfers;
+	atomic64_t split_cpu_bytes;
+	atomic64_t split_dma_bytes;
+	atomic64_t pf_issued;
+	atomic64_t pf_dropped;
+	atomic64_t pf_hits;
+	atomic64_t pf_late;
+	atomic64_t pf_misses;
+	atomic64_t read_bytes;		/* bytes moved by dma_reads */
+	atomic64_t write_bytes;		/* bytes moved by dma_writes */
+	atomic64_t queue_ns;		/* time spent waiting for or holding the engine */
+	atomic_t dma_queued;		/* transfers waiting for or holding the engine */
 
 	/* State */
 	bool device_open;
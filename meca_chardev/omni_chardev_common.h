@@ -43,6 +43,17 @@
 #endif
 #define DMA_BUFFER_SIZE         (1024 * 1024)  /* 1 MB */
 
+/* Split CPU+DMA transfers */
+#define SPLIT_MIN_BYTES         (256 * 1024)
+#define SPLIT_BOUNCE_SIZE       (64 * 1024)    /* CPU copy granule */
+#define SPLIT_CPU_PERMILLE_MIN  50             /* keep both paths measured */
+#define SPLIT_CPU_PERMILLE_MAX  750
+#define SPLIT_CPU_PERMILLE_INIT 250            /* until rates are known */
+#define SPLIT_EWMA_SHIFT        3              /* new sample weight 1/8 */
+
+/* Prefetch staging cache */
+#define DEFAULT_PREFETCH_SLOTS  8              /* one DMA_BUFFER_SIZE each */
+
 /* Timeouts */
 #define DMA_TIMEOUT_MS          5000
 #define DMA_POLL_INTERVAL_US    10
@@ -52,6 +63,8 @@
 #define OMNI_IOC_GET_SIZE       _IOR(OMNI_IOC_MAGIC, 1, unsigned long)
 #define OMNI_IOC_GET_STATS      _IOR(OMNI_IOC_MAGIC, 2, struct omni_stats_ioctl)
 #define OMNI_IOC_RESET_STATS    _IO(OMNI_IOC_MAGIC, 3)
+#define OMNI_IOC_PREFETCH       _IOW(OMNI_IOC_MAGIC, 4, struct omni_prefetch_ioctl)
+#define OMNI_IOC_GET_PF_STATS   _IOR(OMNI_IOC_MAGIC, 5, struct omni_pf_stats_ioctl)
 
 /* ioctl data structure */
 struct omni_stats_ioctl {
@@ -62,6 +75,20 @@ struct omni_stats_ioctl {
 	__u64 irq_count;
 };
 
+/* Remote range to stage ahead of a read */
+struct omni_prefetch_ioctl {
+	__u64 offset;
+	__u64 len;
+};
+
+struct omni_pf_stats_ioctl {
+	__u64 issued;		/* slots queued for DMA */
+	__u64 dropped;		/* ranges not staged, all slots busy */
+	__u64 hits;		/* read chunks served from a staged slot */
+	__u64 late;		/* ...that had to wait for the prefetch DMA */
+	__u64 misses;		/* read chunks that went to the engine */
+};
+
 /*
  * Common inline helper functions
  */
@@ -18,6 +18,8 @@
 #include <linux/io.h>
 #include <linux/delay.h>
 #include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #include "omni_chardev.h"
 
@@ -32,6 +34,49 @@ static unsigned int omni_size_mb = DEFAULT_OMNI_SIZE_MB;
 module_param(omni_size_mb, uint, 0644);
 MODULE_PARM_DESC(omni_size_mb, "OmniXtend memory size in MB (default: 16)");
 
+static bool split_enable;
+module_param(split_enable, bool, 0644);
+MODULE_PARM_DESC(split_enable, "Split large reads/writes between DMA and CPU copies (default: off)");
+
+/*
+ * Below this the DMA share of a split step can round down to no cache line
+ * at all, even at the largest CPU share
+ */
+#define SPLIT_MIN_KB_FLOOR \
+	DIV_ROUND_UP(CACHE_LINE_SIZE * 1000, (1000 - SPLIT_CPU_PERMILLE_MAX) * 1024)
+
+static unsigned int split_min_kb = SPLIT_MIN_BYTES / 1024;
+
+static int split_min_kb_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int kb;
+	int ret;
+
+	ret = kstrtouint(val, 0, &kb);
+	if (ret)
+		return ret;
+	if (kb < SPLIT_MIN_KB_FLOOR)
+		return -EINVAL;
+
+	*(unsigned int *)kp->arg = kb;
+	return 0;
+}
+
+static const struct kernel_param_ops split_min_kb_ops = {
+	.set = split_min_kb_set,
+	.get = param_get_uint,
+};
+module_param_cb(split_min_kb, &split_min_kb_ops, &split_min_kb, 0644);
+MODULE_PARM_DESC(split_min_kb, "Smallest transfer in KB that is split (default: 256, at least 1)");
+
+static unsigned int split_cpu_permille = SPLIT_CPU_PERMILLE_INIT;
+module_param(split_cpu_permille, uint, 0444);
+MODULE_PARM_DESC(split_cpu_permille, "Current CPU share of split transfers in 1/1000 (read-only)");
+
+static unsigned int prefetch_slots = DEFAULT_PREFETCH_SLOTS;
+module_param(prefetch_slots, uint, 0444);
+MODULE_PARM_DESC(prefetch_slots, "Prefetch staging slots of 1 MB each, 0 disables OMNI_IOC_PREFETCH (default: 8)");
+
 /*****************************************************************************
  * DMA Helper Functions
  *****************************************************************************/
@@ -68,6 +113,8 @@ static irqreturn_t omni_dma_irq_handler(int irq, void *dev_id)
 {
 	struct omni_chardev *dev = (struct omni_chardev *)dev_id;
 
+	dev->dma_done = ktime_get();
+
 	printk("%s %d interrupt %d arrived.\n", __FUNCTION__, __LINE__, irq);
 
 	/* Signal completion to waiting thread */
@@ -96,6 +143,27 @@ static int omni_wait_for_dma(struct omni_chardev *dev)
 	return 0;
 }
 
+/*
+ * Every transfer takes dma_mutex through these. queue_ns adds up the time
+ * transfers wait for or hold the engine, so its rate is the average number
+ * of transfers queued (iostat's aqu-sz).
+ */
+static u64 omni_dma_lock(struct omni_chardev *dev)
+{
+	u64 start = ktime_get_ns();
+
+	atomic_inc(&dev->dma_queued);
+	mutex_lock(&dev->dma_mutex);
+	return start;
+}
+
+static void omni_dma_unlock(struct omni_chardev *dev, u64 start)
+{
+	mutex_unlock(&dev->dma_mutex);
+	atomic_dec(&dev->dma_queued);
+	atomic64_add(ktime_get_ns() - start, &dev->queue_ns);
+}
+
 /*****************************************************************************
  * Memory Management
  *****************************************************************************/
@@ -147,6 +215,43 @@ static int omni_alloc_memory(struct omni_chardev *dev)
 }
 #endif
 
+/*
+ * Map the remote memory for the CPU half of split transfers. Not fatal:
+ * without a window every transfer simply goes through the DMA engine.
+ */
+static void omni_map_window(struct omni_chardev *dev)
+{
+	dev->cpu_buffer = kmalloc(SPLIT_BOUNCE_SIZE, GFP_KERNEL);
+	if (!dev->cpu_buffer) {
+		pr_warn("No bounce buffer, split transfers disabled\n");
+		return;
+	}
+
+#ifdef USE_LOCAL
+	dev->omni_window = (void __iomem *)dev->omni_mem;
+#else
+	dev->omni_window = ioremap(dev->omni_mem_phys, dev->omni_size_bytes);
+	if (!dev->omni_window) {
+		pr_warn("Failed to map OmniXtend memory, split transfers disabled\n");
+		kfree(dev->cpu_buffer);
+		dev->cpu_buffer = NULL;
+		return;
+	}
+#endif
+	pr_info("Mapped OmniXtend memory for CPU copies\n");
+}
+
+static void omni_unmap_window(struct omni_chardev *dev)
+{
+#ifndef USE_LOCAL
+	if (dev->omni_window)
+		iounmap(dev->omni_window);
+#endif
+	dev->omni_window = NULL;
+	kfree(dev->cpu_buffer);
+	dev->cpu_buffer = NULL;
+}
+
 static void omni_free_memory(struct omni_chardev *dev)
 {
 	if (dev->omni_mem) {
@@ -183,6 +288,508 @@ static void omni_free_dma_buffer(struct omni_chardev *dev)
 	}
 }
 
+/*****************************************************************************
+ * Split CPU+DMA Transfers
+ *
+ * A large request is cut into steps. In each step the engine moves up to one
+ * DMA buffer while the submitting hart copies the following slice itself
+ * through the mapped remote window. The CPU slice is sized from the measured
+ * rates of both paths so that they finish at about the same time.
+ *****************************************************************************/
+
+static void omni_split_update_rate(u32 *rate, size_t bytes, s64 ns)
+{
+	u32 sample;
+
+	if (ns <= 0 || bytes == 0)
+		return;
+
+	/* bytes per microsecond */
+	sample = (u32)min_t(u64, div64_u64((u64)bytes * 1000, ns), U32_MAX);
+	sample = max_t(u32, sample, 1);
+
+	if (*rate == 0)
+		*rate = sample;
+	else
+		*rate = *rate - (*rate >> SPLIT_EWMA_SHIFT) +
+			(sample >> SPLIT_EWMA_SHIFT);
+}
+
+static unsigned int omni_split_cpu_permille(struct omni_chardev *dev)
+{
+	u64 permille;
+
+	if (!dev->cpu_rate || !dev->dma_rate)
+		return SPLIT_CPU_PERMILLE_INIT;
+
+	permille = div64_u64((u64)dev->cpu_rate * 1000,
+			     (u64)dev->cpu_rate + dev->dma_rate);
+	return clamp_t(unsigned int, permille,
+		       SPLIT_CPU_PERMILLE_MIN, SPLIT_CPU_PERMILLE_MAX);
+}
+
+/* Sizes of the DMA and CPU slices for the next step */
+static void omni_split_sizes(struct omni_chardev *dev, size_t remaining,
+			     size_t *dma_len, size_t *cpu_len)
+{
+	unsigned int permille = omni_split_cpu_permille(dev);
+	size_t d, c;
+
+	split_cpu_permille = permille;
+
+	d = div_u64((u64)remaining * (1000 - permille), 1000);
+	d = min(d, dev->dma_buffer_size) & ~((size_t)CACHE_LINE_SIZE - 1);
+	c = div_u64((u64)d * permille, 1000 - permille);
+	c = min(c, remaining - d);
+
+	*dma_len = d;
+	*cpu_len = c;
+}
+
+/*
+ * Whether the next step of a transfer with remaining bytes is split, and its
+ * slice sizes if so. A step whose DMA slice rounds down to nothing takes the
+ * plain DMA path instead.
+ */
+static bool omni_split_active(struct omni_chardev *dev, size_t remaining,
+			      size_t *dma_len, size_t *cpu_len)
+{
+	if (!split_enable || !dev->omni_window ||
+	    remaining < (size_t)split_min_kb * 1024)
+		return false;
+
+	omni_split_sizes(dev, remaining, dma_len, cpu_len);
+	return *dma_len != 0;
+}
+
+static void omni_split_account(struct omni_chardev *dev, size_t dma_len,
+			       size_t cpu_len, ktime_t start, ktime_t dma_end,
+			       ktime_t cpu_end)
+{
+	omni_split_update_rate(&dev->dma_rate, dma_len,
+			       ktime_to_ns(ktime_sub(dma_end, start)));
+	omni_split_update_rate(&dev->cpu_rate, cpu_len,
+			       ktime_to_ns(ktime_sub(cpu_end, start)));
+
+	atomic64_inc(&dev->split_transfers);
+	atomic64_add(dma_len, &dev->split_dma_bytes);
+	atomic64_add(cpu_len, &dev->split_cpu_bytes);
+}
+
+/*
+ * One split step of a read at offset pos, with the slice sizes from
+ * omni_split_active(). Returns the bytes read or -errno.
+ */
+static ssize_t omni_split_read(struct omni_chardev *dev, char __user *buf,
+			       loff_t pos, size_t dma_len, size_t cpu_len)
+{
+	u64 omni_addr = dev->omni_mem_phys + pos;
+	size_t off, n;
+	ktime_t start, dma_end, cpu_end;
+	bool fault = false;
+	int ret;
+	u64 queued;
+
+	queued = omni_dma_lock(dev);
+
+	omni_flush_dcache_range(omni_addr, dma_len);
+	dma_setup_transfer(dev, omni_addr, dev->dma_buffer_phys, dma_len);
+	reinit_completion(&dev->dma_complete);
+
+	start = ktime_get();
+	dma_start(dev);
+
+	/* CPU slice, while the engine is busy with the first part */
+	for (off = 0; off < cpu_len; off += n) {
+		n = min_t(size_t, cpu_len - off, SPLIT_BOUNCE_SIZE);
+		memcpy_fromio(dev->cpu_buffer,
+			      dev->omni_window + pos + dma_len + off, n);
+		if (copy_to_user(buf + dma_len + off, dev->cpu_buffer, n)) {
+			fault = true;
+			break;
+		}
+	}
+	cpu_end = ktime_get();
+
+	/* The engine owns the DMA buffer until it completes, even on a fault */
+	ret = omni_wait_for_dma(dev);
+	/* The next transfer's IRQ overwrites dma_done once the lock is dropped */
+	dma_end = dev->dma_done;
+
+	omni_dma_unlock(dev, queued);
+
+	if (ret) {
+		pr_err("DMA read timeout\n");
+		atomic64_inc(&dev->dma_errors);
+		return -EIO;
+	}
+
+	omni_flush_dcache_range(dev->dma_buffer_phys, dma_len);
+
+	if (fault || copy_to_user(buf, dev->dma_buffer, dma_len)) {
+		pr_err("Failed to copy data to user\n");
+		return -EFAULT;
+	}
+
+	omni_split_account(dev, dma_len, cpu_len, start, dma_end, cpu_end);
+	atomic64_inc(&dev->dma_reads);
+	atomic64_add(dma_len + cpu_len, &dev->read_bytes);
+	return dma_len + cpu_len;
+}
+
+/*
+ * One split step of a write at offset pos, with the slice sizes from
+ * omni_split_active(). Returns the bytes written or -errno.
+ */
+static ssize_t omni_split_write(struct omni_chardev *dev, const char __user *buf,
+				loff_t pos, size_t dma_len, size_t cpu_len)
+{
+	u64 omni_addr = dev->omni_mem_phys + pos;
+	size_t off, n;
+	ktime_t start, dma_end, cpu_end;
+	bool fault = false;
+	int ret;
+	u64 queued;
+
+	if (copy_from_user(dev->dma_buffer, buf, dma_len)) {
+		pr_err("Failed to copy data from user\n");
+		return -EFAULT;
+	}
+
+	queued = omni_dma_lock(dev);
+
+	omni_flush_dcache_range(dev->dma_buffer_phys, dma_len);
+	dma_setup_transfer(dev, dev->dma_buffer_phys, omni_addr, dma_len);
+	reinit_completion(&dev->dma_complete);
+
+	start = ktime_get();
+	dma_start(dev);
+
+	for (off = 0; off < cpu_len; off += n) {
+		n = min_t(size_t, cpu_len - off, SPLIT_BOUNCE_SIZE);
+		if (copy_from_user(dev->cpu_buffer, buf + dma_len + off, n)) {
+			fault = true;
+			break;
+		}
+		memcpy_toio(dev->omni_window + pos + dma_len + off,
+			    dev->cpu_buffer, n);
+	}
+	/* Stores to the window are complete before the request is */
+	wmb();
+	cpu_end = ktime_get();
+
+	ret = omni_wait_for_dma(dev);
+	dma_end = dev->dma_done;
+
+	omni_dma_unlock(dev, queued);
+
+	if (ret) {
+		pr_err("DMA write timeout\n");
+		atomic64_inc(&dev->dma_errors);
+		return -EIO;
+	}
+
+	omni_flush_dcache_range(omni_addr, dma_len);
+
+	if (fault) {
+		pr_err("Failed to copy data from user\n");
+		return -EFAULT;
+	}
+
+	omni_split_account(dev, dma_len, cpu_len, start, dma_end, cpu_end);
+	atomic64_inc(&dev->dma_writes);
+	atomic64_add(dma_len + cpu_len, &dev->write_bytes);
+	return dma_len + cpu_len;
+}
+
+/*****************************************************************************
+ * Prefetch Staging Cache
+ *
+ * OMNI_IOC_PREFETCH queues DMA of a remote range into staging slots in local
+ * memory. The DMA runs from an ordered workqueue, so prefetches share the
+ * engine with reads and writes through dma_mutex. A read that starts inside
+ * a staged range is served with a memcpy, or waits for the slot's DMA if it
+ * is still in flight. Writes invalidate overlapping slots.
+ *****************************************************************************/
+
+static void omni_pf_work(struct work_struct *work)
+{
+	struct omni_pf_slot *slot = container_of(work, struct omni_pf_slot, work);
+	struct omni_chardev *dev = slot->dev;
+	u64 omni_addr, queued;
+	size_t len;
+	int ret;
+
+	spin_lock(&dev->pf_lock);
+	slot->state = PF_INFLIGHT;
+	omni_addr = dev->omni_mem_phys + slot->offset;
+	len = slot->len;
+	spin_unlock(&dev->pf_lock);
+
+	queued = omni_dma_lock(dev);
+
+	omni_flush_dcache_range(omni_addr, len);
+	dma_setup_transfer(dev, omni_addr, slot->buf_phys, len);
+	reinit_completion(&dev->dma_complete);
+	dma_start(dev);
+	ret = omni_wait_for_dma(dev);
+
+	omni_dma_unlock(dev, queued);
+
+	if (ret) {
+		pr_err("Prefetch DMA timeout\n");
+		atomic64_inc(&dev->dma_errors);
+	} else {
+		omni_flush_dcache_range(slot->buf_phys, len);
+		atomic64_inc(&dev->dma_reads);
+		atomic64_add(len, &dev->read_bytes);
+	}
+
+	/*
+	 * Complete under pf_lock: once the slot is free another prefetch can
+	 * claim it and reinit_completion(), and a late complete_all() would
+	 * wake that prefetch's readers early
+	 */
+	spin_lock(&dev->pf_lock);
+	slot->failed = ret != 0;
+	slot->state = (ret || slot->stale) ? PF_FREE : PF_READY;
+	complete_all(&slot->done);
+	spin_unlock(&dev->pf_lock);
+}
+
+/* Free slot, or the least recently used staged one nobody is reading. */
+static struct omni_pf_slot *omni_pf_get_slot(struct omni_chardev *dev)
+{
+	struct omni_pf_slot *victim = NULL;
+	unsigned int i;
+
+	lockdep_assert_held(&dev->pf_lock);
+
+	for (i = 0; i < dev->pf_nslots; i++) {
+		struct omni_pf_slot *slot = &dev->pf_slots[i];
+
+		if (slot->users)
+			continue;
+		if (slot->state == PF_FREE ||
+		    (slot->state == PF_READY && slot->stale))
+			return slot;
+		if (slot->state == PF_READY &&
+		    (!victim || slot->last_use < victim->last_use))
+			victim = slot;
+	}
+	return victim;
+}
+
+/* Staged or in-flight slot whose range contains pos, or NULL. */
+static struct omni_pf_slot *omni_pf_lookup(struct omni_chardev *dev, loff_t pos)
+{
+	unsigned int i;
+
+	lockdep_assert_held(&dev->pf_lock);
+
+	for (i = 0; i < dev->pf_nslots; i++) {
+		struct omni_pf_slot *slot = &dev->pf_slots[i];
+
+		if (slot->state != PF_FREE && !slot->stale &&
+		    pos >= slot->offset && pos < slot->offset + slot->len)
+			return slot;
+	}
+	return NULL;
+}
+
+static int omni_pf_prefetch(struct omni_chardev *dev, u64 offset, u64 len)
+{
+	struct omni_pf_slot *slot;
+	size_t n;
+
+	if (!dev->pf_nslots)
+		return -EOPNOTSUPP;
+	if (offset >= dev->omni_size_bytes || len == 0)
+		return -EINVAL;
+	len = min_t(u64, len, dev->omni_size_bytes - offset);
+
+	while (len) {
+		n = min_t(u64, len, dev->dma_buffer_size);
+
+		spin_lock(&dev->pf_lock);
+		slot = omni_pf_lookup(dev, offset);
+		if (slot && slot->offset + slot->len >= offset + n) {
+			/* Already staged or on its way */
+			slot->last_use = ++dev->pf_clock;
+			spin_unlock(&dev->pf_lock);
+			offset += n;
+			len -= n;
+			continue;
+		}
+
+		slot = omni_pf_get_slot(dev);
+		if (!slot) {
+			spin_unlock(&dev->pf_lock);
+			atomic64_inc(&dev->pf_dropped);
+			return -EBUSY;
+		}
+		slot->state = PF_QUEUED;
+		slot->offset = offset;
+		slot->len = n;
+		slot->stale = false;
+		slot->failed = false;
+		slot->last_use = ++dev->pf_clock;
+		reinit_completion(&slot->done);
+		spin_unlock(&dev->pf_lock);
+
+		queue_work(dev->pf_wq, &slot->work);
+		atomic64_inc(&dev->pf_issued);
+
+		offset += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Serve the start of a read from the cache. Returns the bytes copied, 0 if
+ * pos is not staged (the caller falls back to DMA) or -errno.
+ */
+static ssize_t omni_pf_read(struct omni_chardev *dev, char __user *buf,
+			    loff_t pos, size_t remaining)
+{
+	struct omni_pf_slot *slot;
+	bool late, ready;
+	size_t n = 0;
+	int ret = 0;
+
+	if (!dev->pf_nslots)
+		return 0;
+
+	spin_lock(&dev->pf_lock);
+	slot = omni_pf_lookup(dev, pos);
+	if (!slot) {
+		spin_unlock(&dev->pf_lock);
+		atomic64_inc(&dev->pf_misses);
+		return 0;
+	}
+	slot->users++;
+	slot->last_use = ++dev->pf_clock;
+	late = slot->state != PF_READY;
+	spin_unlock(&dev->pf_lock);
+
+	if (late)
+		wait_for_completion(&slot->done);
+
+	/* users > 0 keeps the slot from being reused, but a write may have
+	 * invalidated it or its DMA may have failed */
+	spin_lock(&dev->pf_lock);
+	ready = slot->state == PF_READY && !slot->stale;
+	spin_unlock(&dev->pf_lock);
+
+	if (ready) {
+		n = min_t(size_t, remaining, slot->offset + slot->len - pos);
+		if (copy_to_user(buf, slot->buf + (pos - slot->offset), n))
+			ret = -EFAULT;
+	}
+
+	spin_lock(&dev->pf_lock);
+	slot->users--;
+	spin_unlock(&dev->pf_lock);
+
+	if (ret)
+		return ret;
+	if (!ready) {
+		atomic64_inc(&dev->pf_misses);
+		return 0;
+	}
+
+	atomic64_inc(&dev->pf_hits);
+	if (late)
+		atomic64_inc(&dev->pf_late);
+	return n;
+}
+
+/* Drop staged data overlapping [pos, pos + len) */
+static void omni_pf_invalidate(struct omni_chardev *dev, loff_t pos, size_t len)
+{
+	unsigned int i;
+
+	if (!dev->pf_nslots)
+		return;
+
+	spin_lock(&dev->pf_lock);
+	for (i = 0; i < dev->pf_nslots; i++) {
+		struct omni_pf_slot *slot = &dev->pf_slots[i];
+
+		if (slot->state == PF_FREE ||
+		    slot->offset >= pos + len || slot->offset + slot->len <= pos)
+			continue;
+		if (slot->state == PF_READY && !slot->users)
+			slot->state = PF_FREE;
+		else
+			slot->stale = true;
+	}
+	spin_unlock(&dev->pf_lock);
+}
+
+/* Not fatal: with no slots the prefetch ioctl returns -EOPNOTSUPP */
+static void omni_pf_init(struct omni_chardev *dev)
+{
+	unsigned int i;
+
+	spin_lock_init(&dev->pf_lock);
+	if (!prefetch_slots)
+		return;
+
+	dev->pf_slots = kcalloc(prefetch_slots, sizeof(*dev->pf_slots), GFP_KERNEL);
+	if (!dev->pf_slots)
+		goto err;
+
+	dev->pf_wq = alloc_ordered_workqueue("omnichar_pf", 0);
+	if (!dev->pf_wq)
+		goto err;
+
+	for (i = 0; i < prefetch_slots; i++) {
+		struct omni_pf_slot *slot = &dev->pf_slots[i];
+
+		slot->buf = kmalloc(dev->dma_buffer_size, GFP_KERNEL | GFP_DMA);
+		if (!slot->buf)
+			break;
+		slot->buf_phys = virt_to_phys(slot->buf);
+		slot->dev = dev;
+		slot->state = PF_FREE;
+		INIT_WORK(&slot->work, omni_pf_work);
+		init_completion(&slot->done);
+	}
+	dev->pf_nslots = i;
+	if (!dev->pf_nslots)
+		goto err;
+
+	pr_info("Prefetch cache: %u slots of %zu KB\n", dev->pf_nslots,
+		dev->dma_buffer_size / 1024);
+	return;
+
+err:
+	pr_warn("No memory for the prefetch cache, prefetch disabled\n");
+	if (dev->pf_wq)
+		destroy_workqueue(dev->pf_wq);
+	dev->pf_wq = NULL;
+	kfree(dev->pf_slots);
+	dev->pf_slots = NULL;
+}
+
+static void omni_pf_exit(struct omni_chardev *dev)
+{
+	unsigned int i;
+
+	if (dev->pf_wq)
+		destroy_workqueue(dev->pf_wq);
+	dev->pf_wq = NULL;
+
+	for (i = 0; i < dev->pf_nslots; i++)
+		kfree(dev->pf_slots[i].buf);
+	kfree(dev->pf_slots);
+	dev->pf_slots = NULL;
+	dev->pf_nslots = 0;
+}
+
 /*****************************************************************************
  * Character Device File Operations
  *****************************************************************************/
@@ -229,8 +836,8 @@ static ssize_t omni_chardev_read(struct file *filp, char __user *buf,
 {
 	struct omni_chardev *dev = filp->private_data;
 	size_t bytes_read = 0;
-	size_t chunk_size;
-	u64 omni_addr;
+	size_t chunk_size, dma_len, cpu_len;
+	u64 omni_addr, queued;
 	int ret;
 
 	if (*f_pos >= dev->omni_size_bytes)
@@ -242,10 +849,30 @@ static ssize_t omni_chardev_read(struct file *filp, char __user *buf,
 	printk("Reading %zu bytes at offset %lld\n", count, *f_pos);
 
 	while (bytes_read < count) {
+		ssize_t cached = omni_pf_read(dev, buf + bytes_read,
+					      *f_pos + bytes_read,
+					      count - bytes_read);
+		if (cached < 0)
+			return cached;
+		if (cached > 0) {
+			bytes_read += cached;
+			continue;
+		}
+
+		if (omni_split_active(dev, count - bytes_read, &dma_len, &cpu_len)) {
+			ssize_t done = omni_split_read(dev, buf + bytes_read,
+						       *f_pos + bytes_read,
+						       dma_len, cpu_len);
+			if (done < 0)
+				return done;
+			bytes_read += done;
+			continue;
+		}
+
 		chunk_size = min(count - bytes_read, dev->dma_buffer_size);
 		omni_addr = dev->omni_mem_phys + *f_pos + bytes_read;
 
-		mutex_lock(&dev->dma_mutex);
+		queued = omni_dma_lock(dev);
 
 		omni_flush_dcache_range(omni_addr, chunk_size);
 
@@ -258,7 +885,7 @@ static ssize_t omni_chardev_read(struct file *filp, char __user *buf,
 
 		ret = omni_wait_for_dma(dev);
 
-		mutex_unlock(&dev->dma_mutex);
+		omni_dma_unlock(dev, queued);
 
 		if (ret) {
 			pr_err("DMA read timeout\n");
@@ -275,6 +902,7 @@ static ssize_t omni_chardev_read(struct file *filp, char __user *buf,
 
 		bytes_read += chunk_size;
 		atomic64_inc(&dev->dma_reads);
+		atomic64_add(chunk_size, &dev->read_bytes);
 	}
 
 	*f_pos += bytes_read;
@@ -286,8 +914,8 @@ static ssize_t omni_chardev_write(struct file *filp, const char __user *buf,
 {
 	struct omni_chardev *dev = filp->private_data;
 	size_t bytes_written = 0;
-	size_t chunk_size;
-	u64 omni_addr;
+	size_t chunk_size, dma_len, cpu_len;
+	u64 omni_addr, queued;
 	int ret;
 
 	printk("%s - %d *f_pos=%lld dev->omni_size_bytes=%ld\n", __FUNCTION__, __LINE__, *f_pos, dev->omni_size_bytes);
@@ -300,7 +928,19 @@ static ssize_t omni_chardev_write(struct file *filp, const char __user *buf,
 
 	printk("Writing %zu bytes at offset %lld\n", count, *f_pos);
 
+	omni_pf_invalidate(dev, *f_pos, count);
+
 	while (bytes_written < count) {
+		if (omni_split_active(dev, count - bytes_written, &dma_len, &cpu_len)) {
+			ssize_t done = omni_split_write(dev, buf + bytes_written,
+							*f_pos + bytes_written,
+							dma_len, cpu_len);
+			if (done < 0)
+				return done;
+			bytes_written += done;
+			continue;
+		}
+
 		chunk_size = min(count - bytes_written, dev->dma_buffer_size);
 		omni_addr = dev->omni_mem_phys + *f_pos + bytes_written;
 
@@ -309,7 +949,7 @@ static ssize_t omni_chardev_write(struct file *filp, const char __user *buf,
 			return -EFAULT;
 		}
 
-		mutex_lock(&dev->dma_mutex);
+		queued = omni_dma_lock(dev);
 
 		omni_flush_dcache_range(dev->dma_buffer_phys, chunk_size);
 
@@ -322,7 +962,7 @@ static ssize_t omni_chardev_write(struct file *filp, const char __user *buf,
 
 		ret = omni_wait_for_dma(dev);
 
-		mutex_unlock(&dev->dma_mutex);
+		omni_dma_unlock(dev, queued);
 
 		if (ret) {
 			pr_err("DMA write timeout\n");
@@ -334,8 +974,12 @@ static ssize_t omni_chardev_write(struct file *filp, const char __user *buf,
 
 		bytes_written += chunk_size;
 		atomic64_inc(&dev->dma_writes);
+		atomic64_add(chunk_size, &dev->write_bytes);
 	}
 
+	/* Again, for prefetches issued while the write was in progress */
+	omni_pf_invalidate(dev, *f_pos, bytes_written);
+
 	*f_pos += bytes_written;
 	return bytes_written;
 }
@@ -371,6 +1015,8 @@ static long omni_chardev_ioctl(struct file *filp, unsigned int cmd,
 {
 	struct omni_chardev *dev = filp->private_data;
 	struct omni_stats_ioctl stats;
+	struct omni_prefetch_ioctl pf;
+	struct omni_pf_stats_ioctl pf_stats;
 	unsigned long size;
 
 	switch (cmd) {
@@ -397,6 +1043,33 @@ static long omni_chardev_ioctl(struct file *filp, unsigned int cmd,
 		atomic64_set(&dev->dma_errors, 0);
 		atomic64_set(&dev->dma_timeouts, 0);
 		atomic64_set(&dev->irq_count, 0);
+		atomic64_set(&dev->split_transfers, 0);
+		atomic64_set(&dev->split_cpu_bytes, 0);
+		atomic64_set(&dev->split_dma_bytes, 0);
+		atomic64_set(&dev->pf_issued, 0);
+		atomic64_set(&dev->pf_dropped, 0);
+		atomic64_set(&dev->pf_hits, 0);
+		atomic64_set(&dev->pf_late, 0);
+		atomic64_set(&dev->pf_misses, 0);
+		atomic64_set(&dev->read_bytes, 0);
+		atomic64_set(&dev->write_bytes, 0);
+		atomic64_set(&dev->queue_ns, 0);
+		return 0;
+
+	case OMNI_IOC_PREFETCH:
+		if (copy_from_user(&pf, (void __user *)arg, sizeof(pf)))
+			return -EFAULT;
+		return omni_pf_prefetch(dev, pf.offset, pf.len);
+
+	case OMNI_IOC_GET_PF_STATS:
+		pf_stats.issued = atomic64_read(&dev->pf_issued);
+		pf_stats.dropped = atomic64_read(&dev->pf_dropped);
+		pf_stats.hits = atomic64_read(&dev->pf_hits);
+		pf_stats.late = atomic64_read(&dev->pf_late);
+		pf_stats.misses = atomic64_read(&dev->pf_misses);
+
+		if (copy_to_user((void __user *)arg, &pf_stats, sizeof(pf_stats)))
+			return -EFAULT;
 		return 0;
 
 	default:
@@ -414,6 +1087,69 @@ static const struct file_operations omni_chardev_fops = {
 	.unlocked_ioctl = omni_chardev_ioctl,
 };
 
+/*
+ * /sys/class/omnixtend/omnichar/omni/stats: every counter, one "name value"
+ * per line. Unlike OMNI_IOC_GET_STATS this works while the device is open,
+ * which is what omnistat samples.
+ */
+static ssize_t stats_show(struct device *d, struct device_attribute *attr,
+			  char *buf)
+{
+	struct omni_chardev *dev = dev_get_drvdata(d);
+
+	return scnprintf(buf, PAGE_SIZE,
+			 "dma_reads %lld\n"
+			 "dma_writes %lld\n"
+			 "read_bytes %lld\n"
+			 "write_bytes %lld\n"
+			 "dma_errors %lld\n"
+			 "dma_timeouts %lld\n"
+			 "irq_count %lld\n"
+			 "queue_ns %lld\n"
+			 "queued %d\n"
+			 "split_transfers %lld\n"
+			 "split_cpu_bytes %lld\n"
+			 "split_dma_bytes %lld\n"
+			 "pf_issued %lld\n"
+			 "pf_dropped %lld\n"
+			 "pf_hits %lld\n"
+			 "pf_late %lld\n"
+			 "pf_misses %lld\n",
+			 atomic64_read(&dev->dma_reads),
+			 atomic64_read(&dev->dma_writes),
+			 atomic64_read(&dev->read_bytes),
+			 atomic64_read(&dev->write_bytes),
+			 atomic64_read(&dev->dma_errors),
+			 atomic64_read(&dev->dma_timeouts),
+			 atomic64_read(&dev->irq_count),
+			 atomic64_read(&dev->queue_ns),
+			 atomic_read(&dev->dma_queued),
+			 atomic64_read(&dev->split_transfers),
+			 atomic64_read(&dev->split_cpu_bytes),
+			 atomic64_read(&dev->split_dma_bytes),
+			 atomic64_read(&dev->pf_issued),
+			 atomic64_read(&dev->pf_dropped),
+			 atomic64_read(&dev->pf_hits),
+			 atomic64_read(&dev->pf_late),
+			 atomic64_read(&dev->pf_misses));
+}
+static DEVICE_ATTR_RO(stats);
+
+static struct attribute *omni_attrs[] = {
+	&dev_attr_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group omni_attr_group = {
+	.name = "omni",
+	.attrs = omni_attrs,
+};
+
+static const struct attribute_group *omni_attr_groups[] = {
+	&omni_attr_group,
+	NULL,
+};
+
 /*****************************************************************************
  * Module Initialization and Cleanup
  *****************************************************************************/
@@ -443,6 +1179,18 @@ static int __init omni_chardev_init(void)
 	atomic64_set(&dev->dma_errors, 0);
 	atomic64_set(&dev->dma_timeouts, 0);
 	atomic64_set(&dev->irq_count, 0);
+	atomic64_set(&dev->split_transfers, 0);
+	atomic64_set(&dev->split_cpu_bytes, 0);
+	atomic64_set(&dev->split_dma_bytes, 0);
+	atomic64_set(&dev->pf_issued, 0);
+	atomic64_set(&dev->pf_dropped, 0);
+	atomic64_set(&dev->pf_hits, 0);
+	atomic64_set(&dev->pf_late, 0);
+	atomic64_set(&dev->pf_misses, 0);
+	atomic64_set(&dev->read_bytes, 0);
+	atomic64_set(&dev->write_bytes, 0);
+	atomic64_set(&dev->queue_ns, 0);
+	atomic_set(&dev->dma_queued, 0);
 
 	ret = omni_map_resources(dev);
 	if (ret)
@@ -456,6 +1204,9 @@ static int __init omni_chardev_init(void)
 	if (ret)
 		goto err_free_mem;
 
+	omni_map_window(dev);
+	omni_pf_init(dev);
+
 	/* Request IRQ */
 	dev->dma_irq = DMA_IRQ_NUM;
 	ret = request_irq(dev->dma_irq, omni_dma_irq_handler,
@@ -488,8 +1239,8 @@ static int __init omni_chardev_init(void)
 		goto err_cdev_del;
 	}
 
-	dev->device = device_create(dev->class, NULL, dev->dev_num,
-				    NULL, OMNI_CHARDEV_NAME);
+	dev->device = device_create_with_groups(dev->class, NULL, dev->dev_num,
+						dev, omni_attr_groups, OMNI_CHARDEV_NAME);
 	if (IS_ERR(dev->device)) {
 		ret = PTR_ERR(dev->device);
 		pr_err("Failed to create device: %d\n", ret);
@@ -511,6 +1262,8 @@ err_unregister_chrdev:
 err_free_irq:
 	free_irq(dev->dma_irq, dev);
 err_free_dma:
+	omni_pf_exit(dev);
+	omni_unmap_window(dev);
 	omni_free_dma_buffer(dev);
 err_free_mem:
 	omni_free_memory(dev);
@@ -533,7 +1286,9 @@ static void __exit omni_chardev_exit(void)
 	class_destroy(dev->class);
 	cdev_del(&dev->cdev);
 	unregister_chrdev_region(dev->dev_num, 1);
+	omni_pf_exit(dev);
 	free_irq(dev->dma_irq, dev);
+	omni_unmap_window(dev);
 	omni_free_dma_buffer(dev);
 	omni_free_memory(dev);
 	omni_unmap_resources(dev);
@@ -0,0 +1,200 @@
+/*
+ * memtest.c - MECA remote memory tester, pattern generation and compare
+ */
+
+#include "memtest.h"
+
+#ifdef __riscv_vector
+#include <riscv_vector.h>
+#endif
+
+static const char *const names[MT_NPATTERNS] = {
+	[MT_WALK1] = "walk1",
+	[MT_WALK0] = "walk0",
+	[MT_ADDR]  = "addr",
+	[MT_NADDR] = "naddr",
+	[MT_PRNG]  = "prng",
+};
+
+#define PRNG_GOLDEN	0x9e3779b97f4a7c15ull
+#define PRNG_MUL1	0xbf58476d1ce4e5b9ull
+#define PRNG_MUL2	0x94d049bb133111ebull
+
+const char *mt_pattern_name(int pattern)
+{
+	return pattern >= 0 && pattern < MT_NPATTERNS ? names[pattern] : "?";
+}
+
+int mt_pattern_parse(const char *name)
+{
+	for (int i = 0; i < MT_NPATTERNS; i++) {
+		const char *a = names[i], *b = name;
+
+		while (*a && *a == *b)
+			a++, b++;
+		if (!*a && !*b)
+			return i;
+	}
+	return -1;
+}
+
+/* splitmix64 finalizer: every bit of the address affects every bit */
+static inline uint64_t prng(unsigned pass, uint64_t addr)
+{
+	uint64_t z = addr ^ ((uint64_t)pass * PRNG_GOLDEN) ^ PRNG_GOLDEN;
+
+	z = (z ^ (z >> 30)) * PRNG_MUL1;
+	z = (z ^ (z >> 27)) * PRNG_MUL2;
+	return z ^ (z >> 31);
+}
+
+uint64_t mt_expected(int pattern, unsigned pass, uint64_t addr)
+{
+	uint64_t bit = 1ull << (((addr >> 3) + pass) & 63);
+
+	switch (pattern) {
+	case MT_WALK1:
+		return bit;
+	case MT_WALK0:
+		return ~bit;
+	case MT_ADDR:
+		return addr;
+	case MT_NADDR:
+		return ~addr;
+	default:
+		return prng(pass, addr);
+	}
+}
+
+#ifdef __riscv_vector
+
+const char *mt_impl(void)
+{
+	return "rvv";
+}
+
+/* Expected values for vl words starting at addr */
+static inline vuint64m8_t vexpected(int pattern, unsigned pass, uint64_t addr, size_t vl)
+{
+	vuint64m8_t a = __riscv_vadd_vx_u64m8(__riscv_vsll_vx_u64m8(__riscv_vid_v_u64m8(vl), 3, vl),
+					      addr, vl);
+	vuint64m8_t v;
+
+	switch (pattern) {
+	case MT_WALK1:
+	case MT_WALK0:
+		v = __riscv_vand_vx_u64m8(__riscv_vadd_vx_u64m8(__riscv_vsrl_vx_u64m8(a, 3, vl), pass, vl),
+					  63, vl);
+		v = __riscv_vsll_vv_u64m8(__riscv_vmv_v_x_u64m8(1, vl), v, vl);
+		return pattern == MT_WALK1 ? v : __riscv_vnot_v_u64m8(v, vl);
+	case MT_ADDR:
+		return a;
+	case MT_NADDR:
+		return __riscv_vnot_v_u64m8(a, vl);
+	default:
+		v = __riscv_vxor_vx_u64m8(a, ((uint64_t)pass * PRNG_GOLDEN) ^ PRNG_GOLDEN, vl);
+		v = __riscv_vmul_vx_u64m8(__riscv_vxor_vv_u64m8(v, __riscv_vsrl_vx_u64m8(v, 30, vl), vl),
+					  PRNG_MUL1, vl);
+		v = __riscv_vmul_vx_u64m8(__riscv_vxor_vv_u64m8(v, __riscv_vsrl_vx_u64m8(v, 27, vl), vl),
+					  PRNG_MUL2, vl);
+		return __riscv_vxor_vv_u64m8(v, __riscv_vsrl_vx_u64m8(v, 31, vl), vl);
+	}
+}
+
+void mt_generate(uint64_t *buf, size_t words, int pattern, unsigned pass, uint64_t addr)
+{
+	while (words) {
+		size_t vl = __riscv_vsetvl_e64m8(words);
+
+		__riscv_vse64_v_u64m8(buf, vexpected(pattern, pass, addr, vl), vl);
+		buf += vl;
+		addr += vl * 8;
+		words -= vl;
+	}
+}
+
+size_t mt_verify(const volatile uint64_t *buf, size_t words, int pattern, unsigned pass,
+		 uint64_t addr, mt_report_fn report, void *ctx)
+{
+	size_t bad = 0;
+
+	while (words) {
+		size_t vl = __riscv_vsetvl_e64m8(words);
+		vuint64m8_t got = __riscv_vle64_v_u64m8((const uint64_t *)buf, vl);
+		vbool8_t ne = __riscv_vmsne_vv_u64m8_b8(got, vexpected(pattern, pass, addr, vl), vl);
+
+		/* Rare: find the bad words one by one */
+		if (__riscv_vcpop_m_b8(ne, vl)) {
+			for (size_t i = 0; i < vl; i++) {
+				uint64_t exp = mt_expected(pattern, pass, addr + i * 8);
+				uint64_t val = buf[i];
+
+				if (val != exp) {
+					bad++;
+					if (report)
+						report(ctx, addr + i * 8, exp, val);
+				}
+			}
+		}
+		buf += vl;
+		addr += vl * 8;
+		words -= vl;
+	}
+	return bad;
+}
+
+#else /* !__riscv_vector */
+
+const char *mt_impl(void)
+{
+	return "scalar";
+}
+
+void mt_generate(uint64_t *buf, size_t words, int pattern, unsigned pass, uint64_t addr)
+{
+	size_t i;
+
+	/* One loop per pattern keeps the switch out of the inner loop */
+	switch (pattern) {
+	case MT_WALK1:
+	case MT_WALK0: {
+		uint64_t inv = pattern == MT_WALK0 ? ~0ull : 0;
+
+		for (i = 0; i < words; i++)
+			buf[i] = (1ull << ((((addr >> 3) + i) + pass) & 63)) ^ inv;
+		break;
+	}
+	case MT_ADDR:
+		for (i = 0; i < words; i++)
+			buf[i] = addr + i * 8;
+		break;
+	case MT_NADDR:
+		for (i = 0; i < words; i++)
+			buf[i] = ~(addr + i * 8);
+		break;
+	default:
+		for (i = 0; i < words; i++)
+			buf[i] = prng(pass, addr + i * 8);
+		break;
+	}
+}
+
+size_t mt_verify(const volatile uint64_t *buf, size_t words, int pattern, unsigned pass,
+		 uint64_t addr, mt_report_fn report, void *ctx)
+{
+	size_t bad = 0;
+
+	for (size_t i = 0; i < words; i++) {
+		uint64_t exp = mt_expected(pattern, pass, addr + i * 8);
+		uint64_t val = buf[i];
+
+		if (val != exp) {
+			bad++;
+			if (report)
+				report(ctx, addr + i * 8, exp, val);
+		}
+	}
+	return bad;
+}
+
+#endif /* __riscv_vector */
@@ -0,0 +1,53 @@
+/*
+ * memtest.h - MECA remote memory tester, shared pattern core
+ *
+ * Every pattern is a pure function of the 64-bit word's physical address
+ * (and the pass number), so any chunk can be generated or checked by any
+ * hart in any order, and generation and compare vectorize.
+ *
+ * Built for bare metal (memtest_bare.c) and Linux user space
+ * (memtest_linux.c); with RVV (-march=..v) the inner loops use the
+ * vector unit, otherwise plain 64-bit loops.
+ */
+
+#ifndef MECA_MEMTEST_H
+#define MECA_MEMTEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum mt_pattern {
+	MT_WALK1,	/* one bit set, walking with the address */
+	MT_WALK0,	/* one bit clear */
+	MT_ADDR,	/* address-in-address */
+	MT_NADDR,	/* inverted address */
+	MT_PRNG,	/* hash of address and pass */
+	MT_NPATTERNS
+};
+
+#define MT_ALL_PATTERNS	((1u << MT_NPATTERNS) - 1)
+
+const char *mt_pattern_name(int pattern);
+
+/* Pattern number by name, -1 if unknown */
+int mt_pattern_parse(const char *name);
+
+/* Expected value of the word at physical address addr */
+uint64_t mt_expected(int pattern, unsigned pass, uint64_t addr);
+
+/* Fill buf, which holds the words from physical address addr on */
+void mt_generate(uint64_t *buf, size_t words, int pattern, unsigned pass, uint64_t addr);
+
+/*
+ * Compare buf against the pattern; report() is called for every bad word
+ * (it may be NULL). Returns the number of bad words.
+ */
+typedef void (*mt_report_fn)(void *ctx, uint64_t addr, uint64_t expected, uint64_t actual);
+
+size_t mt_verify(const volatile uint64_t *buf, size_t words, int pattern, unsigned pass,
+		 uint64_t addr, mt_report_fn report, void *ctx);
+
+/* "rvv" or "scalar" */
+const char *mt_impl(void);
+
+#endif /* MECA_MEMTEST_H */
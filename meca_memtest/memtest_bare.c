@@ -0,0 +1,254 @@
+/*
+ * memtest_bare.c - MECA remote memory tester, bare-metal build
+ *
+ * Runs on every hart (NCORES, see crt.S) without an OS. For each pattern
+ * every hart generates its chunks into a private local buffer and the DMA
+ * engine copies them to remote memory; then the chunks are copied back by
+ * DMA and compared, each hart checking its own. The engine is shared, so
+ * DMA is serialized with a spinlock while generation and compare run in
+ * parallel. With CPU_VERIFY=1 the compare reads the remote window directly
+ * instead, cross-checking the CPU path against the DMA path.
+ *
+ * Build-time settings (make bare VAR=...): MT_BASE, MT_SIZE, NCORES,
+ * PATTERNS (bit mask of enum mt_pattern), ITERATIONS, CPU_MHZ,
+ * CACHE_FLUSH, CPU_VERIFY.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "util.h"
+#include "memtest.h"
+
+#ifndef MT_BASE
+#define MT_BASE		0x200000000UL	/* my-ETRI@200000000 */
+#endif
+#ifndef MT_SIZE
+#define MT_SIZE		0x200000000UL	/* 8 GB */
+#endif
+#ifndef NCORES
+#define NCORES		1
+#endif
+#ifndef PATTERNS
+#define PATTERNS	MT_ALL_PATTERNS
+#endif
+#ifndef ITERATIONS
+#define ITERATIONS	1
+#endif
+#ifndef CPU_MHZ
+#define CPU_MHZ		0
+#endif
+#ifndef CACHE_FLUSH
+#define CACHE_FLUSH	1
+#endif
+#ifndef CPU_VERIFY
+#define CPU_VERIFY	0
+#endif
+
+#define CHUNK		(1024 * 1024)	/* per DMA, as DMA_BUFFER_SIZE */
+#define MAX_REPORT	32
+#define CACHE_LINE	64
+#define DMA_TIMEOUT	1000000000UL	/* cycles */
+
+#define DMA_BASE_ADDR	0x9000000UL
+#define DMA_SRC_ADDR_LO	(DMA_BASE_ADDR + 0x00)
+#define DMA_SRC_ADDR_HI	(DMA_BASE_ADDR + 0x04)
+#define DMA_DST_ADDR_LO	(DMA_BASE_ADDR + 0x08)
+#define DMA_DST_ADDR_HI	(DMA_BASE_ADDR + 0x0C)
+#define DMA_LENGTH_LO	(DMA_BASE_ADDR + 0x10)
+#define DMA_LENGTH_HI	(DMA_BASE_ADDR + 0x14)
+#define DMA_CONTROL	(DMA_BASE_ADDR + 0x18)
+#define DMA_STATUS	(DMA_BASE_ADDR + 0x1C)
+#define DMA_STATUS_DONE	0x1
+
+static const uint64_t base = MT_BASE, size = MT_SIZE;
+
+static uint64_t bufs[NCORES][CHUNK / 8] __attribute__((aligned(CACHE_LINE)));
+
+static volatile int dma_lock, print_lock;
+static volatile int failed;
+static volatile unsigned long reported;
+static unsigned long errors[NCORES];
+
+static inline void write_reg_u32(uintptr_t addr, uint32_t value)
+{
+	*(volatile uint32_t *)addr = value;
+}
+
+static inline uint32_t read_reg_u32(uintptr_t addr)
+{
+	return *(volatile uint32_t *)addr;
+}
+
+static void lock(volatile int *l)
+{
+	while (__sync_lock_test_and_set(l, 1))
+		while (*l)
+			;
+}
+
+static void unlock(volatile int *l)
+{
+	__sync_lock_release(l);
+}
+
+/* CFLUSH_D_L1: write back and invalidate the line holding addr */
+static void flush_dcache_range(uint64_t start, uint64_t len)
+{
+#if CACHE_FLUSH
+	asm volatile ("fence rw, rw" ::: "memory");
+	for (uint64_t a = start & ~(uint64_t)(CACHE_LINE - 1); a < start + len; a += CACHE_LINE) {
+		register uint64_t a0 asm("a0") = a;
+		asm volatile (".word 0xfc050073" : : "r"(a0) : "memory");
+	}
+	asm volatile ("fence rw, rw" ::: "memory");
+#endif
+}
+
+static int dma_copy(uint64_t src, uint64_t dst, uint32_t len)
+{
+	int ret = 0;
+
+	lock(&dma_lock);
+	write_reg_u32(DMA_SRC_ADDR_LO, (uint32_t)src);
+	write_reg_u32(DMA_SRC_ADDR_HI, (uint32_t)(src >> 32));
+	write_reg_u32(DMA_DST_ADDR_LO, (uint32_t)dst);
+	write_reg_u32(DMA_DST_ADDR_HI, (uint32_t)(dst >> 32));
+	write_reg_u32(DMA_LENGTH_LO, len);
+	write_reg_u32(DMA_LENGTH_HI, 0);
+	write_reg_u32(DMA_CONTROL, 1);
+
+	uint64_t deadline = rdcycle() + DMA_TIMEOUT;
+	while (!(read_reg_u32(DMA_STATUS) & DMA_STATUS_DONE))
+		if (rdcycle() > deadline) {
+			ret = -1;
+			break;
+		}
+	unlock(&dma_lock);
+	return ret;
+}
+
+static void report(void *ctx, uint64_t addr, uint64_t expected, uint64_t actual)
+{
+	(void)ctx;
+	if (reported >= MAX_REPORT)
+		return;
+	lock(&print_lock);
+	if (reported++ < MAX_REPORT)
+		printf("  BAD 0x%lx: expected 0x%016lx got 0x%016lx (xor 0x%016lx)\n",
+		       addr, expected, actual, expected ^ actual);
+	unlock(&print_lock);
+}
+
+static void print_rate(const char *what, uint64_t bytes, uint64_t cycles)
+{
+	if (!cycles)
+		cycles = 1;
+#if CPU_MHZ
+	printf(" %s %lu MB/s", what, bytes * CPU_MHZ / cycles);
+#else
+	printf(" %s %lu B/kcycle", what, bytes * 1000 / cycles);
+#endif
+}
+
+static int fill(int cid, int nc, int pattern, unsigned pass)
+{
+	uint64_t *buf = bufs[cid];
+
+	for (uint64_t off = (uint64_t)cid * CHUNK; off < size && !failed; off += (uint64_t)nc * CHUNK) {
+		uint64_t len = size - off < CHUNK ? size - off : CHUNK;
+
+		mt_generate(buf, len / 8, pattern, pass, base + off);
+		flush_dcache_range((uintptr_t)buf, len);
+		if (dma_copy((uintptr_t)buf, base + off, len)) {
+			printf("memtest: DMA to 0x%lx timed out (status=0x%x)\n",
+			       base + off, read_reg_u32(DMA_STATUS));
+			failed = 1;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int verify(int cid, int nc, int pattern, unsigned pass)
+{
+#if !CPU_VERIFY
+	uint64_t *buf = bufs[cid];
+#endif
+
+	for (uint64_t off = (uint64_t)cid * CHUNK; off < size && !failed; off += (uint64_t)nc * CHUNK) {
+		uint64_t len = size - off < CHUNK ? size - off : CHUNK;
+
+#if CPU_VERIFY
+		/* Drop lines of the window cached by the previous pass */
+		flush_dcache_range(base + off, len);
+		errors[cid] += mt_verify((volatile uint64_t *)(base + off), len / 8, pattern, pass,
+					 base + off, report, NULL);
+#else
+		if (dma_copy(base + off, (uintptr_t)buf, len)) {
+			printf("memtest: DMA from 0x%lx timed out (status=0x%x)\n",
+			       base + off, read_reg_u32(DMA_STATUS));
+			failed = 1;
+			return -1;
+		}
+		flush_dcache_range((uintptr_t)buf, len);
+		errors[cid] += mt_verify(buf, len / 8, pattern, pass, base + off, report, NULL);
+#endif
+	}
+	return 0;
+}
+
+void thread_entry(int cid, int nc)
+{
+	unsigned long total_errors = 0;
+	uint64_t t_start = rdcycle();
+
+	if (cid == 0)
+		printf("memtest: 0x%lx-0x%lx (%lu MB), %d harts, %s, verify by %s\n",
+		       base, base + size - 1, size >> 20, nc, mt_impl(),
+		       CPU_VERIFY ? "CPU" : "DMA");
+
+	for (unsigned pass = 0; pass < ITERATIONS; pass++) {
+		for (int p = 0; p < MT_NPATTERNS; p++) {
+			if (!(PATTERNS & (1u << p)))
+				continue;
+
+			barrier(nc);
+			uint64_t t0 = rdcycle();
+			fill(cid, nc, p, pass);
+			barrier(nc);
+			uint64_t t1 = rdcycle();
+			verify(cid, nc, p, pass);
+			barrier(nc);
+			uint64_t t2 = rdcycle();
+
+			if (cid == 0) {
+				unsigned long errs = 0;
+
+				for (int i = 0; i < nc; i++) {
+					errs += errors[i];
+					errors[i] = 0;
+				}
+				total_errors += errs;
+				printf("pass %u %-6s", pass, mt_pattern_name(p));
+				print_rate("fill", size, t1 - t0);
+				print_rate(" verify", size, t2 - t1);
+				printf("  errors %lu\n", errs);
+			}
+			if (failed)
+				break;
+		}
+		if (failed)
+			break;
+	}
+
+	barrier(nc);
+	if (cid == 0) {
+		printf("memtest: %s, %lu bad words, %lu cycles\n",
+		       failed ? "ABORTED" : total_errors ? "FAILED" : "PASSED",
+		       total_errors, rdcycle() - t_start);
+		exit(failed || total_errors ? 1 : 0);
+	}
+	while (1)
+		asm volatile ("wfi");
+}
@@ -0,0 +1,331 @@
+/*
+ * memtest_linux.c - MECA remote memory tester, Linux user-space build
+ *
+ * Usage: meca-memtest [-d DEV] [-m] [-M] [-a ADDR] [-s SIZE] [-j THREADS]
+ *                     [-p PATTERNS] [-i ITERATIONS] [-e MAXREPORT] [-f]
+ *   -d DEV       OmniXtend character device (default /dev/omnichar)
+ *   -m           verify with CPU loads through /dev/mem instead of DMA reads
+ *   -M           also fill through /dev/mem (no DMA at all)
+ *   -a ADDR      physical base for /dev/mem (default 0x200000000)
+ *   -s SIZE      bytes to test, K/M/G suffixes (default: the device size)
+ *   -j THREADS   worker threads (default: online CPUs)
+ *   -p PATTERNS  comma-separated: walk1,walk0,addr,naddr,prng (default all)
+ *   -i N         iterations; each uses a different walk offset and PRNG seed
+ *   -e N         bad words to print at most (default 32)
+ *   -f           run even if the range is online as System RAM
+ *
+ * Bulk movement goes through the chardev, so every chunk is one DMA of the
+ * driver's bounce buffer size: the threads generate and compare patterns
+ * in parallel while the driver serializes the DMAs. The device must be
+ * loaded with omni_size_mb covering the range to test (8192 for 8 GB).
+ * Testing overwrites the whole range.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "memtest.h"
+
+#define CHUNK (1024 * 1024)	/* DMA_BUFFER_SIZE */
+
+/* From meca_chardev/omni_chardev_common.h */
+#define OMNI_IOC_MAGIC 'O'
+#define OMNI_IOC_GET_SIZE _IOR(OMNI_IOC_MAGIC, 1, unsigned long)
+
+static int dev_fd = -1;
+static volatile uint64_t *window;	/* /dev/mem mapping, -m/-M */
+static uint64_t base = 0x200000000ull;
+static uint64_t size;
+static int cpu_fill, cpu_verify;
+static unsigned long max_report = 32;
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long reported;
+static volatile int failed;
+
+enum phase { FILL, VERIFY };
+
+struct job {
+	pthread_t thread;
+	int id, nthreads;
+	enum phase phase;
+	int pattern;
+	unsigned pass;
+	unsigned long errors;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'G': case 'g': v <<= 10; /* fall through */
+	case 'M': case 'm': v <<= 10; /* fall through */
+	case 'K': case 'k': v <<= 10; break;
+	}
+	return v;
+}
+
+static void report(void *ctx, uint64_t addr, uint64_t expected, uint64_t actual)
+{
+	(void)ctx;
+	pthread_mutex_lock(&report_lock);
+	if (reported++ < max_report)
+		printf("  BAD 0x%" PRIx64 ": expected 0x%016" PRIx64 " got 0x%016" PRIx64
+		       " (xor 0x%016" PRIx64 ")\n", addr, expected, actual, expected ^ actual);
+	pthread_mutex_unlock(&report_lock);
+}
+
+static int io_chunk(int write, void *buf, uint64_t len, uint64_t off)
+{
+	ssize_t n = write ? pwrite(dev_fd, buf, len, off) : pread(dev_fd, buf, len, off);
+
+	if (n == (ssize_t)len)
+		return 0;
+	fprintf(stderr, "meca-memtest: %s at offset 0x%" PRIx64 ": %s\n", write ? "write" : "read",
+		off, n < 0 ? strerror(errno) : "short transfer");
+	failed = 1;
+	return -1;
+}
+
+static void *worker(void *arg)
+{
+	struct job *j = arg;
+	uint64_t *buf = NULL;
+
+	if (!(j->phase == FILL ? cpu_fill : cpu_verify) && posix_memalign((void **)&buf, 4096, CHUNK)) {
+		failed = 1;
+		return NULL;
+	}
+
+	/* Chunks are interleaved so the threads stream the device together */
+	for (uint64_t off = (uint64_t)j->id * CHUNK; off < size && !failed;
+	     off += (uint64_t)j->nthreads * CHUNK) {
+		uint64_t len = size - off < CHUNK ? size - off : CHUNK;
+
+		if (j->phase == FILL) {
+			if (cpu_fill) {
+				mt_generate((uint64_t *)(window + off / 8), len / 8, j->pattern, j->pass,
+					    base + off);
+			} else {
+				mt_generate(buf, len / 8, j->pattern, j->pass, base + off);
+				io_chunk(1, buf, len, off);
+			}
+		} else if (cpu_verify) {
+			j->errors += mt_verify(window + off / 8, len / 8, j->pattern, j->pass, base + off,
+					       report, NULL);
+		} else if (!io_chunk(0, buf, len, off)) {
+			j->errors += mt_verify(buf, len / 8, j->pattern, j->pass, base + off, report, NULL);
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+/* Runs one phase on all threads; returns bad words found */
+static unsigned long run_phase(struct job *jobs, int n, enum phase phase, int pattern, unsigned pass)
+{
+	unsigned long errors = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		jobs[i].phase = phase;
+		jobs[i].pattern = pattern;
+		jobs[i].pass = pass;
+		jobs[i].errors = 0;
+		pthread_create(&jobs[i].thread, NULL, worker, &jobs[i]);
+	}
+	for (i = 0; i < n; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		errors += jobs[i].errors;
+	}
+	return errors;
+}
+
+/* 1 if [base, base + size) overlaps a System RAM range in /proc/iomem */
+static int range_is_ram(void)
+{
+	FILE *f = fopen("/proc/iomem", "r");
+	char line[256];
+	int ram = 0;
+
+	if (!f)
+		return 0;
+	while (!ram && fgets(line, sizeof(line), f)) {
+		unsigned long long start, end;
+
+		/* Top-level entries only */
+		if (line[0] != ' ' && strstr(line, "System RAM") &&
+		    sscanf(line, "%llx-%llx", &start, &end) == 2 && start != end)
+			ram = start < base + size && end >= base;
+	}
+	fclose(f);
+	return ram;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = "/dev/omnichar";
+	unsigned patterns = MT_ALL_PATTERNS, iterations = 1;
+	unsigned long total_errors = 0;
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int force = 0, opt, i;
+	struct job *jobs;
+	uint64_t t_start;
+
+	while ((opt = getopt(argc, argv, "d:mMa:s:j:p:i:e:f")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'M':
+			cpu_fill = 1;
+			/* fall through */
+		case 'm':
+			cpu_verify = 1;
+			break;
+		case 'a':
+			base = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			size = parse_size(optarg);
+			break;
+		case 'j':
+			nthreads = atol(optarg);
+			break;
+		case 'p': {
+			char *s = strdup(optarg), *tok, *save;
+
+			patterns = 0;
+			for (tok = strtok_r(s, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+				int p = mt_pattern_parse(tok);
+
+				if (p < 0) {
+					fprintf(stderr, "meca-memtest: unknown pattern '%s'\n", tok);
+					return 1;
+				}
+				patterns |= 1u << p;
+			}
+			free(s);
+			break;
+		}
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 'e':
+			max_report = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			force = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc || nthreads <= 0 || !patterns)
+		goto usage;
+
+	if (!cpu_fill) {
+		unsigned long dev_size;
+
+		dev_fd = open(dev, O_RDWR);
+		if (dev_fd < 0) {
+			perror(dev);
+			return 1;
+		}
+		if (ioctl(dev_fd, OMNI_IOC_GET_SIZE, &dev_size) < 0) {
+			off_t end = lseek(dev_fd, 0, SEEK_END);
+
+			dev_size = end > 0 ? end : 0;
+		}
+		if (!size || size > dev_size)
+			size = dev_size;
+	}
+	size &= ~(uint64_t)7;
+	if (!size) {
+		fprintf(stderr, "meca-memtest: nothing to test, give -s with -M\n");
+		return 1;
+	}
+
+	if (range_is_ram() && !force) {
+		fprintf(stderr, "meca-memtest: 0x%" PRIx64 "-0x%" PRIx64 " is online System RAM, "
+			"offline it first or use -f\n", base, base + size - 1);
+		return 1;
+	}
+
+	if (cpu_verify) {
+		int fd = open("/dev/mem", O_RDWR | O_SYNC);
+
+		if (fd < 0) {
+			perror("/dev/mem");
+			return 1;
+		}
+		window = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, base);
+		close(fd);
+		if (window == MAP_FAILED) {
+			perror("mmap /dev/mem");
+			return 1;
+		}
+	}
+
+	printf("meca-memtest: 0x%" PRIx64 "-0x%" PRIx64 " (%" PRIu64 " MB), %ld threads, %s, "
+	       "fill by %s, verify by %s\n", base, base + size - 1, size >> 20, nthreads, mt_impl(),
+	       cpu_fill ? "CPU" : "DMA", cpu_verify ? "CPU" : "DMA");
+
+	jobs = calloc(nthreads, sizeof(*jobs));
+	if (!jobs)
+		return 1;
+	for (i = 0; i < nthreads; i++) {
+		jobs[i].id = i;
+		jobs[i].nthreads = nthreads;
+	}
+
+	t_start = now_ns();
+	for (unsigned pass = 0; pass < iterations && !failed; pass++) {
+		for (int p = 0; p < MT_NPATTERNS && !failed; p++) {
+			uint64_t t0, t1, t2;
+			unsigned long errors;
+
+			if (!(patterns & (1u << p)))
+				continue;
+			t0 = now_ns();
+			run_phase(jobs, nthreads, FILL, p, pass);
+			t1 = now_ns();
+			errors = run_phase(jobs, nthreads, VERIFY, p, pass);
+			t2 = now_ns();
+			total_errors += errors;
+
+			printf("pass %u %-6s fill %8.1f MB/s  verify %8.1f MB/s  errors %lu\n", pass,
+			       mt_pattern_name(p), size * 1e3 / (t1 - t0), size * 1e3 / (t2 - t1), errors);
+			fflush(stdout);
+		}
+	}
+
+	printf("meca-memtest: %s, %lu bad words, %.1f s\n",
+	       failed ? "ABORTED" : total_errors ? "FAILED" : "PASSED", total_errors,
+	       (now_ns() - t_start) / 1e9);
+	return failed || total_errors ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-d DEV] [-m] [-M] [-a ADDR] [-s SIZE] [-j THREADS] "
+		"[-p PATTERNS] [-i ITERATIONS] [-e MAXREPORT] [-f]\n", argv[0]);
+	return 1;
+}
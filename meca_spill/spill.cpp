@@ -0,0 +1,322 @@
+/*
+ * spill.cpp - MECA spill tier: block allocation and double-buffered I/O
+ */
+
+#include "spill.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <system_error>
+#include <unistd.h>
+
+/* From meca_chardev/omni_chardev_common.h */
+#define OMNI_IOC_MAGIC 'O'
+#define OMNI_IOC_GET_SIZE _IOR(OMNI_IOC_MAGIC, 1, unsigned long)
+
+namespace meca {
+
+namespace {
+
+std::system_error sysError(const std::string &what)
+{
+	return std::system_error(errno, std::generic_category(), what);
+}
+
+/* Full pread/pwrite; the chardev may return short counts */
+void transfer(bool write, int fd, char *data, size_t len, uint64_t off, const char *what)
+{
+	while (len) {
+		ssize_t n = write ? pwrite(fd, data, len, off) : pread(fd, data, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (n == 0)
+				errno = EIO;
+			throw sysError(std::string(write ? "write to " : "read from ") + what);
+		}
+		data += n;
+		off += n;
+		len -= n;
+	}
+}
+
+} /* namespace */
+
+/*
+ * SpillTier
+ */
+
+SpillTier::SpillTier(const SpillConfig &cfg) : cfg_(cfg)
+{
+	if (cfg_.block_size == 0)
+		throw std::invalid_argument("spill block size must not be 0");
+
+	/* No device: everything goes to disk, which is still correct */
+	remote_fd_ = open(cfg_.device.c_str(), O_RDWR | O_CLOEXEC);
+	if (remote_fd_ >= 0) {
+		unsigned long size = 0;
+		if (ioctl(remote_fd_, OMNI_IOC_GET_SIZE, &size) < 0) {
+			off_t end = lseek(remote_fd_, 0, SEEK_END);
+			size = end > 0 ? end : 0;
+		}
+		if (cfg_.remote_limit && cfg_.remote_limit < size)
+			size = cfg_.remote_limit;
+		remote_blocks_ = size / cfg_.block_size;
+	}
+}
+
+SpillTier::~SpillTier()
+{
+	if (remote_fd_ >= 0)
+		close(remote_fd_);
+	if (disk_fd_ >= 0)
+		close(disk_fd_);
+}
+
+/* Remote first; the disk file is only created once it is needed */
+Extent SpillTier::allocate()
+{
+	std::lock_guard<std::mutex> g(lock_);
+
+	if (!remote_free_.empty() || remote_next_ < remote_blocks_) {
+		uint64_t block;
+		if (!remote_free_.empty()) {
+			block = remote_free_.back();
+			remote_free_.pop_back();
+		} else {
+			block = remote_next_++;
+		}
+		remote_used_++;
+		return {Medium::Remote, block * cfg_.block_size, 0};
+	}
+
+	if (disk_fd_ < 0) {
+		std::string path = cfg_.disk_dir + "/meca-spill.XXXXXX";
+		disk_fd_ = mkostemp(&path[0], O_CLOEXEC);
+		if (disk_fd_ < 0)
+			throw sysError("cannot create spill file in " + cfg_.disk_dir);
+		unlink(path.c_str());
+	}
+	uint64_t block;
+	if (!disk_free_.empty()) {
+		block = disk_free_.back();
+		disk_free_.pop_back();
+	} else {
+		block = disk_next_++;
+	}
+	disk_used_++;
+	return {Medium::Disk, block * cfg_.block_size, 0};
+}
+
+void SpillTier::deallocate(const Extent &e)
+{
+	std::lock_guard<std::mutex> g(lock_);
+
+	if (e.medium == Medium::Remote) {
+		remote_free_.push_back(e.offset / cfg_.block_size);
+		remote_used_--;
+	} else {
+		disk_free_.push_back(e.offset / cfg_.block_size);
+		disk_used_--;
+	}
+}
+
+void SpillTier::writeExtent(const Extent &e, const char *data)
+{
+	if (e.medium == Medium::Remote) {
+		transfer(true, remote_fd_, const_cast<char *>(data), e.len, e.offset, cfg_.device.c_str());
+		remote_written_ += e.len;
+	} else {
+		transfer(true, disk_fd_, const_cast<char *>(data), e.len, e.offset, "spill file");
+		disk_written_ += e.len;
+	}
+}
+
+void SpillTier::readExtent(const Extent &e, char *data)
+{
+	if (e.medium == Medium::Remote) {
+		transfer(false, remote_fd_, data, e.len, e.offset, cfg_.device.c_str());
+		remote_read_ += e.len;
+	} else {
+		transfer(false, disk_fd_, data, e.len, e.offset, "spill file");
+		disk_read_ += e.len;
+	}
+}
+
+std::unique_ptr<RunWriter> SpillTier::writer()
+{
+	return std::unique_ptr<RunWriter>(new RunWriter(*this));
+}
+
+std::unique_ptr<RunReader> SpillTier::reader(const Run &run)
+{
+	return std::unique_ptr<RunReader>(new RunReader(*this, run));
+}
+
+void SpillTier::release(Run &run)
+{
+	for (const auto &e : run.extents)
+		deallocate(e);
+	run.extents.clear();
+	run.bytes = 0;
+}
+
+SpillStats SpillTier::stats() const
+{
+	SpillStats s;
+
+	s.remote_written = remote_written_;
+	s.remote_read = remote_read_;
+	s.disk_written = disk_written_;
+	s.disk_read = disk_read_;
+	std::lock_guard<std::mutex> g(lock_);
+	s.remote_blocks_used = remote_used_;
+	s.remote_blocks = remote_blocks_;
+	s.disk_blocks_used = disk_used_;
+	return s;
+}
+
+/*
+ * RunWriter: fill one buffer while the other one is written out
+ */
+
+RunWriter::RunWriter(SpillTier &tier) : tier_(tier)
+{
+	for (auto &b : buf_)
+		b.reset(new char[tier_.blockSize()]);
+}
+
+RunWriter::~RunWriter()
+{
+	/* Abandoned writer: let the DMA finish, then return the blocks */
+	if (pending_.valid())
+		pending_.wait();
+	if (!finished_)
+		tier_.release(run_);
+}
+
+void RunWriter::wait()
+{
+	if (pending_.valid())
+		pending_.get();
+}
+
+void RunWriter::flush()
+{
+	if (!fill_)
+		return;
+
+	Extent e = tier_.allocate();
+	e.len = fill_;
+	run_.extents.push_back(e);
+	run_.bytes += fill_;
+
+	wait();
+	const char *data = buf_[cur_].get();
+	pending_ = std::async(std::launch::async, [this, e, data] { tier_.writeExtent(e, data); });
+	cur_ ^= 1;
+	fill_ = 0;
+}
+
+void RunWriter::write(const void *data, size_t len)
+{
+	const char *p = static_cast<const char *>(data);
+
+	while (len) {
+		size_t n = std::min(len, tier_.blockSize() - fill_);
+		std::memcpy(buf_[cur_].get() + fill_, p, n);
+		fill_ += n;
+		p += n;
+		len -= n;
+		if (fill_ == tier_.blockSize())
+			flush();
+	}
+}
+
+Run RunWriter::finish()
+{
+	flush();
+	wait();
+	finished_ = true;
+	return std::move(run_);
+}
+
+/*
+ * RunReader: drain one buffer while the next extent is read into the other
+ */
+
+RunReader::RunReader(SpillTier &tier, const Run &run) : tier_(tier), run_(run)
+{
+	for (auto &b : buf_)
+		b.reset(new char[tier_.blockSize()]);
+	prefetch();
+}
+
+RunReader::~RunReader()
+{
+	if (pending_.valid())
+		pending_.wait();
+}
+
+void RunReader::prefetch()
+{
+	if (next_ == run_.extents.size())
+		return;
+	Extent e = run_.extents[next_++];
+	char *data = buf_[cur_ ^ 1].get();
+	pending_ = std::async(std::launch::async, [this, e, data] { tier_.readExtent(e, data); });
+}
+
+size_t RunReader::read(void *data, size_t len)
+{
+	char *p = static_cast<char *>(data);
+	size_t done = 0;
+
+	while (done < len) {
+		if (pos_ == avail_) {
+			if (!pending_.valid())
+				break;
+			pending_.get();
+			cur_ ^= 1;
+			avail_ = run_.extents[next_ - 1].len;
+			pos_ = 0;
+			prefetch();
+		}
+		size_t n = std::min(len - done, avail_ - pos_);
+		std::memcpy(p + done, buf_[cur_].get() + pos_, n);
+		pos_ += n;
+		done += n;
+	}
+	return done;
+}
+
+/*
+ * Partitions
+ */
+
+Partitions::Partitions(SpillTier &tier, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++)
+		writers_.push_back(tier.writer());
+}
+
+void Partitions::add(unsigned partition, const void *record, size_t len)
+{
+	writers_.at(partition)->write(record, len);
+}
+
+std::vector<Run> Partitions::finish()
+{
+	std::vector<Run> runs;
+
+	for (auto &w : writers_)
+		runs.push_back(w->finish());
+	return runs;
+}
+
+} /* namespace meca */
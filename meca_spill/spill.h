@@ -0,0 +1,172 @@
+/*
+ * spill.h - MECA remote memory as the spill tier for out-of-core operators
+ *
+ * Sorted runs and hash partitions that do not fit in DRAM are written to
+ * MECA remote memory through /dev/omnichar, and to a scratch file on local
+ * disk only once the remote capacity is used up. Space is handed out in
+ * fixed-size blocks (one bounce buffer, one DMA each), so freed runs are
+ * reused right away by the next ones.
+ *
+ * Writers and readers are double buffered: while the caller fills or
+ * drains one buffer, the DMA for the other one is in flight.
+ *
+ *   meca::SpillTier tier(cfg);
+ *   auto w = tier.writer();
+ *   w->write(data, bytes);
+ *   meca::Run run = w->finish();
+ *   auto r = tier.reader(run);
+ *   while ((n = r->read(buf, sizeof(buf))) > 0) ...
+ *   tier.release(run);
+ *
+ * Errors are reported by throwing std::system_error.
+ */
+
+#ifndef MECA_SPILL_H
+#define MECA_SPILL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace meca {
+
+struct SpillConfig {
+	std::string device = "/dev/omnichar";
+	std::string disk_dir = "/tmp";
+	size_t block_size = 1 << 20;	/* DMA_BUFFER_SIZE */
+	uint64_t remote_limit = 0;	/* bytes of the device to use, 0: all */
+};
+
+enum class Medium { Remote, Disk };
+
+struct Extent {
+	Medium medium;
+	uint64_t offset;
+	size_t len;	/* bytes used, at most one block */
+};
+
+/* A spilled byte stream: a sorted run or one hash partition */
+struct Run {
+	std::vector<Extent> extents;
+	uint64_t bytes = 0;
+};
+
+struct SpillStats {
+	uint64_t remote_written = 0, remote_read = 0;
+	uint64_t disk_written = 0, disk_read = 0;
+	uint64_t remote_blocks_used = 0, remote_blocks = 0;
+	uint64_t disk_blocks_used = 0;
+};
+
+class SpillTier;
+
+class RunWriter {
+public:
+	~RunWriter();
+
+	void write(const void *data, size_t len);
+
+	/* Flushes what is left; the writer cannot be used afterwards */
+	Run finish();
+
+private:
+	friend class SpillTier;
+	explicit RunWriter(SpillTier &tier);
+
+	void flush();
+	void wait();
+
+	SpillTier &tier_;
+	std::unique_ptr<char[]> buf_[2];
+	size_t fill_ = 0;
+	int cur_ = 0;
+	std::future<void> pending_;
+	Run run_;
+	bool finished_ = false;
+};
+
+class RunReader {
+public:
+	~RunReader();
+
+	/* Returns bytes copied, 0 at the end of the run */
+	size_t read(void *data, size_t len);
+
+private:
+	friend class SpillTier;
+	RunReader(SpillTier &tier, const Run &run);
+
+	void prefetch();
+
+	SpillTier &tier_;
+	Run run_;
+	std::unique_ptr<char[]> buf_[2];
+	std::future<void> pending_;
+	size_t next_ = 0;	/* next extent to prefetch */
+	size_t avail_ = 0, pos_ = 0;
+	int cur_ = 0;
+};
+
+/* Routes records to n partitions by hash, each one a run of its own */
+class Partitions {
+public:
+	Partitions(SpillTier &tier, unsigned n);
+
+	void add(unsigned partition, const void *record, size_t len);
+	unsigned size() const { return writers_.size(); }
+
+	/* Flushes every partition; one run per partition */
+	std::vector<Run> finish();
+
+private:
+	std::vector<std::unique_ptr<RunWriter>> writers_;
+};
+
+class SpillTier {
+public:
+	explicit SpillTier(const SpillConfig &cfg = SpillConfig());
+	~SpillTier();
+
+	SpillTier(const SpillTier &) = delete;
+	SpillTier &operator=(const SpillTier &) = delete;
+
+	std::unique_ptr<RunWriter> writer();
+	std::unique_ptr<RunReader> reader(const Run &run);
+
+	/* Returns the run's blocks for reuse */
+	void release(Run &run);
+
+	SpillStats stats() const;
+	size_t blockSize() const { return cfg_.block_size; }
+	bool hasRemote() const { return remote_fd_ >= 0; }
+
+private:
+	friend class RunWriter;
+	friend class RunReader;
+
+	Extent allocate();
+	void deallocate(const Extent &e);
+	void writeExtent(const Extent &e, const char *data);
+	void readExtent(const Extent &e, char *data);
+
+	SpillConfig cfg_;
+	int remote_fd_ = -1, disk_fd_ = -1;
+	uint64_t remote_blocks_ = 0;
+
+	mutable std::mutex lock_;
+	uint64_t remote_next_ = 0, disk_next_ = 0;
+	std::vector<uint64_t> remote_free_, disk_free_;
+	uint64_t remote_used_ = 0, disk_used_ = 0;
+
+	std::atomic<uint64_t> remote_written_{0}, remote_read_{0};
+	std::atomic<uint64_t> disk_written_{0}, disk_read_{0};
+};
+
+} /* namespace meca */
+
+#endif /* MECA_SPILL_H */
@@ -0,0 +1,183 @@
+/*
+ * omni_model - what-if sweeps of the OmniXtend driver DMA pipelines
+ *
+ * Usage: omni_model [options]
+ *   -c FILE          load measured parameters (key = value lines)
+ *   -s KEY=VALUE     override one parameter
+ *   -x KEY=V1,V2...  sweep a parameter (repeatable, all combinations run)
+ *   -p blk|chr       driver path (default blk)
+ *   -o read|write    direction (default read)
+ *   -b SIZES         request sizes, e.g. 4K,64K,1M (default 4K)
+ *   -q CLIENTS       concurrent submitters, e.g. 1,4,16 (default 1)
+ *   -t MS            simulated milliseconds per point (default 100)
+ *   -l               list the parameters and their defaults
+ *
+ * One CSV row per point goes to stdout: the swept values, then throughput,
+ * IOPS, latency (mean, p50, p99) and CPU, engine and lock utilization.
+ */
+
+#include "model.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace omni;
+
+namespace {
+
+std::vector<std::string> split(const std::string &s, char sep)
+{
+	std::vector<std::string> out;
+	std::stringstream ss(s);
+	std::string item;
+	while (std::getline(ss, item, sep))
+		if (!item.empty())
+			out.push_back(item);
+	return out;
+}
+
+double parseSize(const std::string &s)
+{
+	size_t used = 0;
+	double v = std::stod(s, &used);
+	std::string unit = s.substr(used);
+	if (unit == "K" || unit == "k")
+		v *= 1024;
+	else if (unit == "M" || unit == "m")
+		v *= 1024 * 1024;
+	else if (unit == "G" || unit == "g")
+		v *= 1024.0 * 1024 * 1024;
+	else if (!unit.empty())
+		throw std::invalid_argument("bad size: " + s);
+	return v;
+}
+
+struct Sweep {
+	std::string key;
+	std::vector<std::string> values;
+};
+
+void usage()
+{
+	std::cerr << "usage: omni_model [-c FILE] [-s KEY=VALUE]... [-x KEY=V1,V2,...]... "
+		     "[-p blk|chr] [-o read|write] [-b SIZES] [-q CLIENTS] [-t MS] [-l]\n";
+	std::exit(1);
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+	Params params;
+	Workload base;
+	std::vector<double> sizes = {4096};
+	std::vector<unsigned> clients = {1};
+	std::vector<Sweep> sweeps;
+	int opt;
+
+	try {
+		while ((opt = getopt(argc, argv, "c:s:x:p:o:b:q:t:l")) != -1) {
+			std::string arg = optarg ? optarg : "";
+			auto eq = arg.find('=');
+
+			switch (opt) {
+			case 'c':
+				params.load(arg);
+				break;
+			case 's':
+				if (eq == std::string::npos)
+					usage();
+				params.set(arg.substr(0, eq), arg.substr(eq + 1));
+				break;
+			case 'x':
+				if (eq == std::string::npos)
+					usage();
+				params[arg.substr(0, eq)];	/* validates the key */
+				sweeps.push_back({arg.substr(0, eq), split(arg.substr(eq + 1), ',')});
+				break;
+			case 'p':
+				if (arg != "blk" && arg != "chr")
+					usage();
+				base.path = arg == "blk" ? Path::Blk : Path::Chr;
+				break;
+			case 'o':
+				if (arg != "read" && arg != "write")
+					usage();
+				base.write = arg == "write";
+				break;
+			case 'b':
+				sizes.clear();
+				for (auto &s : split(arg, ','))
+					sizes.push_back(parseSize(s));
+				break;
+			case 'q':
+				clients.clear();
+				for (auto &s : split(arg, ','))
+					clients.push_back(std::stoul(s));
+				break;
+			case 't':
+				base.duration_ms = std::stod(arg);
+				break;
+			case 'l':
+				for (const auto &d : paramDefaults())
+					std::printf("%-18s %12g  %s\n", d.name, params[d.name], d.desc);
+				return 0;
+			default:
+				usage();
+			}
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "omni_model: " << e.what() << "\n";
+		return 1;
+	}
+	if (optind != argc || sizes.empty() || clients.empty())
+		usage();
+
+	std::printf("path,op");
+	for (auto &s : sweeps)
+		std::printf(",%s", s.key.c_str());
+	std::printf(",size,clients,mbps,iops,lat_mean_us,lat_p50_us,lat_p99_us,util_cpu,util_engine,util_lock\n");
+
+	/* Odometer over all sweep combinations */
+	std::vector<size_t> idx(sweeps.size(), 0);
+	for (;;) {
+		Params p = params;
+		try {
+			for (size_t i = 0; i < sweeps.size(); i++)
+				p.set(sweeps[i].key, sweeps[i].values[idx[i]]);
+		} catch (const std::exception &e) {
+			std::cerr << "omni_model: " << e.what() << "\n";
+			return 1;
+		}
+
+		for (double size : sizes) {
+			for (unsigned c : clients) {
+				Workload w = base;
+				w.size = size;
+				w.clients = c;
+				Result r = simulate(p, w);
+
+				std::printf("%s,%s", w.path == Path::Blk ? "blk" : "chr", w.write ? "write" : "read");
+				for (size_t i = 0; i < sweeps.size(); i++)
+					std::printf(",%s", sweeps[i].values[idx[i]].c_str());
+				std::printf(",%.0f,%u,%.2f,%.0f,%.2f,%.2f,%.2f,%.3f,%.3f,%.3f\n", size, c, r.mbps, r.iops,
+					    r.lat_mean_us, r.lat_p50_us, r.lat_p99_us, r.util_cpu, r.util_engine,
+					    r.util_lock);
+				std::fflush(stdout);
+			}
+		}
+
+		size_t i = 0;
+		while (i < sweeps.size() && ++idx[i] == sweeps[i].values.size())
+			idx[i++] = 0;
+		if (i == sweeps.size())
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * model.cpp - the driver pipelines expressed as simulator operations
+ *
+ * Each request is turned into the sequence of steps the driver performs,
+ * holding the same resources the driver holds:
+ *
+ *   cpu     the harts that submit I/O (copies, cache flushes, MMIO, IRQs)
+ *   engine  the DMA engine(s)
+ *   lock    dma_mutex with its single bounce buffer; 'bounce_buffers' > 1
+ *           models a driver with that many independent buffers
+ *
+ * blk (omni_handle_request): dma_mutex is held for the whole request and
+ * every bio segment (at most 'blk_segment' bytes, a page) is one DMA of its
+ * own, with a memcpy to/from the bounce buffer.
+ *
+ * chr (omni_chardev_read/write): one DMA per bounce-buffer-sized chunk,
+ * with copy_{to,from}_user outside dma_mutex. 'split' models the
+ * cooperative CPU+DMA mode: the hart copies its share through the remote
+ * window while the engine moves the rest.
+ *
+ * Completion is either by interrupt ('irq' = 1: IRQ latency, handler and
+ * wake-up of the waiting thread) or by polling DMA_STATUS with the hart
+ * held for the whole transfer.
+ *
+ * Every step's time is scaled by a gamma-distributed factor with mean 1 and
+ * coefficient of variation 'jitter', drawn from an RNG seeded with 'seed',
+ * so latency percentiles reflect service-time variance and runs repeat.
+ * 'jitter' = 0 makes every request of a point take the same path.
+ */
+
+#include "model.h"
+#include "sim.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace omni {
+
+const std::vector<ParamInfo> &paramDefaults()
+{
+	/* Placeholders until measured on the prototype, see README.md */
+	static const std::vector<ParamInfo> defaults = {
+		{"mmio_write_ns", 150, "uncached MMIO register write"},
+		{"mmio_read_ns", 300, "uncached MMIO register read (round trip)"},
+		{"flush", 0, "flush the D-cache around DMA (CONFIG_OMNI_CACHE_FLUSH)"},
+		{"flush_line_ns", 20, "flush of one cache line"},
+		{"cache_line", 64, "cache line size in bytes"},
+		{"dma_bw_gbps", 1.0, "DMA engine streaming bandwidth (GB/s)"},
+		{"dma_latency_ns", 2000, "DMA start to first data, incl. link round trip"},
+		{"link_latency_ns", 0, "extra one-way link latency added per DMA"},
+		{"irq", 1, "1: interrupt completion, 0: poll DMA_STATUS"},
+		{"irq_latency_ns", 3000, "DMA done to handler entry"},
+		{"irq_handler_ns", 500, "handler body (status read, complete())"},
+		{"wakeup_ns", 4000, "complete() to the waiting thread running"},
+		{"poll_interval_ns", 1000, "DMA_STATUS poll period (polling mode)"},
+		{"memcpy_gbps", 2.0, "local memcpy / copy_{to,from}_user rate (GB/s)"},
+		{"cpu_copy_gbps", 0.5, "hart copy rate through the remote window (GB/s)"},
+		{"chunk_size", 1048576, "bounce buffer size (DMA_BUFFER_SIZE)"},
+		{"bounce_buffers", 1, "independent bounce buffers (1 = dma_mutex)"},
+		{"engines", 1, "DMA engines / channels"},
+		{"harts", 4, "harts submitting I/O"},
+		{"blk_segment", 4096, "bytes per bio segment (one DMA each)"},
+		{"blk_request_ns", 3000, "blk-mq submission and completion per request"},
+		{"syscall_ns", 1500, "read()/write() entry and exit"},
+		{"split", 0, "chr: cooperative CPU+DMA split transfers"},
+		{"split_min", 262144, "chr: smallest split transfer (split_min_kb)"},
+		{"jitter", 0.1, "coefficient of variation of every step's time (0: deterministic)"},
+		{"seed", 1, "random seed for the jitter"},
+	};
+	return defaults;
+}
+
+Params::Params()
+{
+	for (const auto &d : paramDefaults())
+		v_[d.name] = d.value;
+}
+
+double Params::operator[](const std::string &key) const
+{
+	auto it = v_.find(key);
+	if (it == v_.end())
+		throw std::invalid_argument("unknown parameter: " + key);
+	return it->second;
+}
+
+void Params::set(const std::string &key, const std::string &value)
+{
+	if (!v_.count(key))
+		throw std::invalid_argument("unknown parameter: " + key);
+	size_t used = 0;
+	double d = std::stod(value, &used);
+	if (used != value.size() || d < 0)
+		throw std::invalid_argument("bad value for " + key + ": " + value);
+	v_[key] = d;
+}
+
+/* key = value lines, '#' starts a comment */
+void Params::load(const std::string &path)
+{
+	std::ifstream in(path);
+	if (!in)
+		throw std::invalid_argument("cannot read " + path);
+
+	std::string line;
+	int lineno = 0;
+	while (std::getline(in, line)) {
+		lineno++;
+		line = line.substr(0, line.find('#'));
+		auto eq = line.find('=');
+		auto trim = [](std::string s) {
+			s.erase(0, s.find_first_not_of(" \t"));
+			s.erase(s.find_last_not_of(" \t\r") + 1);
+			return s;
+		};
+		if (trim(line).empty())
+			continue;
+		if (eq == std::string::npos)
+			throw std::invalid_argument(path + ":" + std::to_string(lineno) + ": expected key = value");
+		set(trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+	}
+}
+
+namespace {
+
+class Builder {
+public:
+	Builder(const Params &p, Resource &cpu, Resource &engine, Resource &lock, std::mt19937_64 &rng)
+		: p_(p), cpu_(cpu), engine_(engine), lock_(lock), rng_(rng) {}
+
+	std::vector<Op> blk(double size, bool write)
+	{
+		double seg = std::max(1.0, p_["blk_segment"]);
+
+		cpu(p_["blk_request_ns"]);
+		lockAcquire();
+		for (double off = 0; off < size; off += seg) {
+			double n = std::min(seg, size - off);
+			if (write)
+				cpu(copy(n));
+			dma(n);
+			if (!write)
+				cpu(copy(n));
+		}
+		lockRelease();
+		return std::move(ops_);
+	}
+
+	std::vector<Op> chr(double size, bool write)
+	{
+		double chunk = std::max(1.0, p_["chunk_size"]);
+
+		cpu(p_["syscall_ns"]);
+		for (double off = 0; off < size;) {
+			double remaining = size - off;
+			if (p_["split"] && remaining >= p_["split_min"]) {
+				off += splitStep(remaining, write);
+				continue;
+			}
+
+			double n = std::min(chunk, remaining);
+			if (write)
+				cpu(copy(n));
+			lockAcquire();
+			dma(n);
+			lockRelease();
+			if (!write)
+				cpu(copy(n));
+			off += n;
+		}
+		return std::move(ops_);
+	}
+
+private:
+	double copy(double n) const { return n / p_["memcpy_gbps"]; }
+
+	double flush(double n) const
+	{
+		return p_["flush"] ? std::ceil(n / p_["cache_line"]) * p_["flush_line_ns"] : 0;
+	}
+
+	double setup() const { return 7 * p_["mmio_write_ns"]; }	/* 6 registers + start */
+
+	double transfer(double n) const
+	{
+		return p_["dma_latency_ns"] + 2 * p_["link_latency_ns"] + n / p_["dma_bw_gbps"];
+	}
+
+	/* dt scaled by a random factor with mean 1 and CV 'jitter' */
+	double vary(double dt)
+	{
+		double cv = p_["jitter"];
+		if (dt <= 0 || cv <= 0)
+			return dt;
+		std::gamma_distribution<double> factor(1 / (cv * cv), cv * cv);
+		return dt * factor(rng_);
+	}
+
+	void cpu(double dt)
+	{
+		dt = vary(dt);
+		if (dt <= 0)
+			return;
+		if (holding_cpu_)
+			ops_.push_back({Op::Delay, nullptr, dt, {}});
+		else
+			ops_.push_back({Op::Use, &cpu_, dt, {}});
+	}
+
+	void lockAcquire() { ops_.push_back({Op::Acquire, &lock_, 0, {}}); }
+	void lockRelease() { ops_.push_back({Op::Release, &lock_, 0, {}}); }
+
+	/* Flush, program the engine, wait for completion, flush again */
+	void dma(double n)
+	{
+		if (p_["irq"]) {
+			cpu(flush(n) + setup());
+			ops_.push_back({Op::Use, &engine_, vary(transfer(n)), {}});
+			ops_.push_back({Op::Delay, nullptr, vary(p_["irq_latency_ns"]), {}});
+			cpu(p_["irq_handler_ns"]);
+			ops_.push_back({Op::Delay, nullptr, vary(p_["wakeup_ns"]), {}});
+			cpu(flush(n));
+		} else {
+			ops_.push_back({Op::Acquire, &cpu_, 0, {}});
+			holding_cpu_ = true;
+			cpu(flush(n) + setup());
+			ops_.push_back({Op::Use, &engine_, vary(transfer(n)), {}});
+			/* Found done on average half a poll period late */
+			cpu(p_["poll_interval_ns"] / 2 + p_["mmio_read_ns"] + flush(n));
+			holding_cpu_ = false;
+			ops_.push_back({Op::Release, &cpu_, 0, {}});
+		}
+	}
+
+	/*
+	 * One step of a split transfer: the engine takes up to a bounce buffer
+	 * while the hart copies a rate-balanced share through the window, as
+	 * the driver converges to with its measured rates.
+	 */
+	double splitStep(double remaining, bool write)
+	{
+		double share = p_["cpu_copy_gbps"] / (p_["cpu_copy_gbps"] + p_["dma_bw_gbps"]);
+		share = std::min(0.75, std::max(0.05, share));
+		double d = std::min(p_["chunk_size"], remaining * (1 - share));
+		double c = std::min(remaining - d, d * share / (1 - share));
+
+		if (write)
+			cpu(copy(d));
+		lockAcquire();
+		cpu(flush(d) + setup());
+
+		std::vector<Op> side = {{Op::Use, &engine_, vary(transfer(d)), {}}};
+		if (p_["irq"])
+			side.push_back({Op::Delay, nullptr, vary(p_["irq_latency_ns"]), {}});
+		ops_.push_back({Op::Fork, nullptr, 0, side});
+		cpu(c / p_["cpu_copy_gbps"] + copy(c));
+		ops_.push_back({Op::Join, nullptr, 0, {}});
+		cpu(p_["irq"] ? p_["irq_handler_ns"] + p_["wakeup_ns"] : p_["mmio_read_ns"]);
+
+		lockRelease();
+		cpu(flush(d) + (write ? 0 : copy(d)));
+		return d + c;
+	}
+
+	const Params &p_;
+	Resource &cpu_, &engine_, &lock_;
+	std::mt19937_64 &rng_;
+	std::vector<Op> ops_;
+	bool holding_cpu_ = false;
+};
+
+} /* namespace */
+
+Result simulate(const Params &p, const Workload &w)
+{
+	Simulator sim;
+	Resource cpu(sim, "cpu", std::max(1u, (unsigned)p["harts"]));
+	Resource engine(sim, "engine", std::max(1u, (unsigned)p["engines"]));
+	Resource lock(sim, "lock", std::max(1u, (unsigned)p["bounce_buffers"]));
+	std::mt19937_64 rng((uint64_t)p["seed"]);
+
+	const double warmup = w.duration_ms * 1e6 / 10;
+	const double end = warmup + w.duration_ms * 1e6;
+	std::vector<double> lat;
+	double bytes = 0;
+	unsigned long completed = 0;
+
+	/*
+	 * Closed loop: every client issues its next request as soon as the
+	 * previous one completes. blk requests larger than a bounce buffer are
+	 * split by the block layer (max_hw_sectors) and run concurrently.
+	 */
+	auto request = [&](auto &&self) -> void {
+		double start = sim.now();
+		double size = w.size;
+		unsigned parts = 1;
+		if (w.path == Path::Blk)
+			parts = (unsigned)std::ceil(size / std::max(1.0, p["chunk_size"]));
+
+		auto pending = std::make_shared<unsigned>(parts);
+		auto done = [&, start, pending, self]() {
+			if (--*pending)
+				return;
+			/* Throughput counts everything completed in the window,
+			 * latency only requests issued after the warmup */
+			if (sim.now() > warmup && sim.now() <= end) {
+				bytes += w.size;
+				completed++;
+				if (start >= warmup)
+					lat.push_back(sim.now() - start);
+			}
+			if (sim.now() < end)
+				self(self);
+		};
+
+		for (unsigned i = 0; i < parts; i++) {
+			Builder b(p, cpu, engine, lock, rng);
+			double n = w.path == Path::Blk ? std::min(p["chunk_size"], size - i * p["chunk_size"]) : size;
+			auto ops = w.path == Path::Blk ? b.blk(n, w.write) : b.chr(n, w.write);
+			(new Process(sim, std::move(ops), done))->start();
+		}
+	};
+
+	for (unsigned c = 0; c < std::max(1u, w.clients); c++)
+		sim.at(0, [&] { request(request); });
+	sim.run(end);
+
+	Result r;
+	double secs = (end - warmup) / 1e9;
+	r.completed = completed;
+	r.mbps = bytes / secs / 1e6;
+	r.iops = completed / secs;
+	/* No request fit entirely in the window: latency is unknown, not 0 */
+	r.lat_mean_us = r.lat_p50_us = r.lat_p99_us = NAN;
+	if (!lat.empty()) {
+		std::sort(lat.begin(), lat.end());
+		double sum = 0;
+		for (double l : lat)
+			sum += l;
+		r.lat_mean_us = sum / lat.size() / 1e3;
+		r.lat_p50_us = lat[(size_t)(0.50 * (lat.size() - 1))] / 1e3;
+		r.lat_p99_us = lat[(size_t)(0.99 * (lat.size() - 1))] / 1e3;
+	}
+	r.util_cpu = cpu.utilization();
+	r.util_engine = engine.utilization();
+	r.util_lock = lock.utilization();
+	return r;
+}
+
+} /* namespace omni */
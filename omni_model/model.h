@@ -0,0 +1,63 @@
+/*
+ * model.h - performance model of the OmniXtend driver DMA pipelines
+ */
+
+#ifndef OMNI_MODEL_MODEL_H
+#define OMNI_MODEL_MODEL_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace omni {
+
+/*
+ * Model parameters by name. Defaults and descriptions are in
+ * paramDefaults(); everything is in nanoseconds, bytes and GB/s (bytes/ns).
+ */
+class Params {
+public:
+	Params();
+
+	double operator[](const std::string &key) const;
+	/* Throws std::invalid_argument for unknown keys or bad values */
+	void set(const std::string &key, const std::string &value);
+	void load(const std::string &path);
+
+	const std::map<std::string, double> &values() const { return v_; }
+
+private:
+	std::map<std::string, double> v_;
+};
+
+struct ParamInfo {
+	const char *name;
+	double value;
+	const char *desc;
+};
+
+const std::vector<ParamInfo> &paramDefaults();
+
+enum class Path { Blk, Chr };
+
+struct Workload {
+	Path path = Path::Blk;
+	bool write = false;
+	double size = 4096;	/* bytes per read()/write() or per block I/O */
+	unsigned clients = 1;	/* closed-loop submitters (queue depth) */
+	double duration_ms = 100;	/* simulated time, after warmup */
+};
+
+struct Result {
+	double mbps = 0;
+	double iops = 0;
+	double lat_mean_us = 0, lat_p50_us = 0, lat_p99_us = 0;
+	double util_cpu = 0, util_engine = 0, util_lock = 0;
+	unsigned long completed = 0;
+};
+
+Result simulate(const Params &p, const Workload &w);
+
+} /* namespace omni */
+
+#endif /* OMNI_MODEL_MODEL_H */
@@ -0,0 +1,197 @@
+/*
+ * sim.h - minimal discrete-event simulation core for the OmniXtend model
+ *
+ * Time is in nanoseconds. Processes are flat lists of operations (acquire
+ * or release a resource, hold one for a time, or just wait) executed in
+ * order; the simulator advances them as resources become available.
+ */
+
+#ifndef OMNI_MODEL_SIM_H
+#define OMNI_MODEL_SIM_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace omni {
+
+using Time = double;
+
+class Simulator {
+public:
+	void at(Time t, std::function<void()> fn)
+	{
+		events_.push(Event{t, seq_++, std::move(fn)});
+	}
+
+	void after(Time dt, std::function<void()> fn) { at(now_ + dt, std::move(fn)); }
+
+	Time now() const { return now_; }
+
+	/* Run until no events are left or the clock passes until */
+	void run(Time until)
+	{
+		while (!events_.empty() && !stopped_) {
+			Event ev = events_.top();
+			if (ev.t > until)
+				break;
+			events_.pop();
+			now_ = ev.t;
+			ev.fn();
+		}
+	}
+
+	void stop() { stopped_ = true; }
+
+private:
+	struct Event {
+		Time t;
+		uint64_t seq;	/* FIFO among simultaneous events */
+		std::function<void()> fn;
+		bool operator>(const Event &o) const
+		{
+			return t != o.t ? t > o.t : seq > o.seq;
+		}
+	};
+
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+	Time now_ = 0;
+	uint64_t seq_ = 0;
+	bool stopped_ = false;
+};
+
+/* A pool of identical units (harts, DMA engines, bounce buffers, locks) */
+class Resource {
+public:
+	Resource(Simulator &sim, std::string name, unsigned capacity)
+		: sim_(sim), name_(std::move(name)), free_(capacity), capacity_(capacity) {}
+
+	void acquire(std::function<void()> granted)
+	{
+		if (free_ > 0 && waiters_.empty()) {
+			take();
+			sim_.after(0, std::move(granted));
+		} else {
+			waiters_.push_back(std::move(granted));
+		}
+	}
+
+	void release()
+	{
+		account();
+		free_++;
+		if (!waiters_.empty()) {
+			auto next = std::move(waiters_.front());
+			waiters_.pop_front();
+			take();
+			sim_.after(0, std::move(next));
+		}
+	}
+
+	/* Fraction of capacity in use, averaged over [0, now] */
+	double utilization() const
+	{
+		Time t = sim_.now();
+		double busy = busy_ + (capacity_ - free_) * (t - last_);
+		return t > 0 ? busy / (t * capacity_) : 0;
+	}
+
+	const std::string &name() const { return name_; }
+
+private:
+	void take()
+	{
+		account();
+		free_--;
+	}
+
+	void account()
+	{
+		busy_ += (capacity_ - free_) * (sim_.now() - last_);
+		last_ = sim_.now();
+	}
+
+	Simulator &sim_;
+	std::string name_;
+	unsigned free_, capacity_;
+	std::deque<std::function<void()>> waiters_;
+	double busy_ = 0;
+	Time last_ = 0;
+};
+
+struct Op {
+	enum Kind { Acquire, Release, Use, Delay, Fork, Join } kind;
+	Resource *res = nullptr;
+	Time dt = 0;
+	std::vector<Op> side;	/* Fork: runs alongside until the next Join */
+};
+
+/* Runs a list of operations, then calls done */
+class Process {
+public:
+	Process(Simulator &sim, std::vector<Op> ops, std::function<void()> done)
+		: sim_(sim), ops_(std::move(ops)), done_(std::move(done)) {}
+
+	void start() { step(); }
+
+private:
+	void step()
+	{
+		if (pc_ == ops_.size()) {
+			auto done = std::move(done_);
+			delete this;
+			done();
+			return;
+		}
+		const Op &op = ops_[pc_++];
+		switch (op.kind) {
+		case Op::Acquire:
+			op.res->acquire([this] { step(); });
+			break;
+		case Op::Release:
+			op.res->release();
+			step();
+			break;
+		case Op::Use:
+			op.res->acquire([this, &op] {
+				sim_.after(op.dt, [this, &op] {
+					op.res->release();
+					step();
+				});
+			});
+			break;
+		case Op::Delay:
+			sim_.after(op.dt, [this] { step(); });
+			break;
+		case Op::Fork:
+			side_done_ = false;
+			joining_ = false;
+			(new Process(sim_, op.side, [this] {
+				side_done_ = true;
+				if (joining_)
+					step();
+			}))->start();
+			step();
+			break;
+		case Op::Join:
+			if (side_done_)
+				step();
+			else
+				joining_ = true;
+			break;
+		}
+	}
+
+	Simulator &sim_;
+	std::vector<Op> ops_;
+	std::function<void()> done_;
+	size_t pc_ = 0;
+	bool side_done_ = true, joining_ = false;
+};
+
+} /* namespace omni */
+
+#endif /* OMNI_MODEL_SIM_H */
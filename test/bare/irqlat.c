@@ -0,0 +1,337 @@
+// See LICENSE for license details.
+
+//**************************************************************************
+// OmniXtend DMA interrupt latency benchmark
+//--------------------------------------------------------------------------
+//
+// Measures how long a DMA completion interrupt takes to reach software,
+// with a real machine external interrupt handler instead of the PLIC_CLAIM
+// polling of omni_scenario_test.c. handle_trap() below overrides the weak
+// one in syscalls.c; crt.S saves the registers and returns with mret.
+//
+// Every iteration timestamps with rdcycle:
+//
+//   start     just before the DMA_CONTROL write
+//   entry     first instruction of handle_trap (after crt.S saved x1-x31)
+//   claim     PLIC_CLAIM read returned
+//   complete  PLIC_CLAIM written back
+//   resume    the waiting loop saw the completion
+//
+// and runs three ways for each transfer size:
+//
+//   poll      interrupts masked, spin on DMA_STATUS: the DMA itself, the
+//             baseline the IRQ modes are compared with
+//   spin      interrupts on, busy loop: delivery to a running hart
+//   wfi       interrupts on, hart in wfi: delivery to an idle hart, as
+//             when the Linux drivers sleep in wait_for_completion()
+//
+// Results are in cycles; build with CPU_MHZ=<MHz> to also print ns.
+// IRQ delivery latency is roughly spin/wfi start->entry minus poll
+// start->done.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "util.h"
+
+#define DMA_BASE_ADDR    0x9000000UL
+#define DMA_SRC_ADDR_LO  (DMA_BASE_ADDR + 0x00)
+#define DMA_SRC_ADDR_HI  (DMA_BASE_ADDR + 0x04)
+#define DMA_DST_ADDR_LO  (DMA_BASE_ADDR + 0x08)
+#define DMA_DST_ADDR_HI  (DMA_BASE_ADDR + 0x0C)
+#define DMA_LENGTH_LO    (DMA_BASE_ADDR + 0x10)
+#define DMA_LENGTH_HI    (DMA_BASE_ADDR + 0x14)
+#define DMA_CONTROL      (DMA_BASE_ADDR + 0x18)
+#define DMA_STATUS       (DMA_BASE_ADDR + 0x1C)
+#define DMA_STATUS_DONE  0x1
+
+#define PLIC_BASE             0xC000000UL
+#define PLIC_PRIORITY(id)     (PLIC_BASE + 4*(id))
+#define PLIC_ENABLE(hart)     (PLIC_BASE + 0x2000 + 0x80*(hart))
+#define PLIC_THRESHOLD(hart)  (PLIC_BASE + 0x200000 + 0x1000*(hart))
+#define PLIC_CLAIM(hart)      (PLIC_BASE + 0x200004 + 0x1000*(hart))
+
+#define DMA_IRQ_NUM      1
+#define HART_ID          0
+
+#define MCAUSE_INT       (1UL << (__riscv_xlen - 1))
+
+#define OMNI_REMOTE_MEM_BASE  0x200000000UL
+
+#ifndef ITERATIONS
+#define ITERATIONS 5000
+#endif
+#ifndef WARMUP
+#define WARMUP 50
+#endif
+#ifndef CPU_MHZ
+#define CPU_MHZ 0
+#endif
+#define TIMEOUT_CYCLES 100000000UL
+#define MAX_SIZE 65536
+
+static const uint32_t sizes[] = { 64, 4096, MAX_SIZE };
+
+enum mode { MODE_POLL, MODE_SPIN, MODE_WFI };
+static const char *mode_names[] = { "poll", "spin", "wfi" };
+
+// Source of every transfer; the data does not matter, so it is never flushed
+static uint8_t src_buf[MAX_SIZE] __attribute__((aligned(64)));
+
+// Filled in by handle_trap
+static volatile uint64_t t_entry, t_claim, t_complete;
+static volatile int dma_irq_seen;
+static volatile unsigned long spurious;
+
+// Phases of the last run_once(), in cycles
+static uint32_t last_entry, last_claim, last_complete;
+
+// Samples, in cycles
+static uint32_t lat_total[ITERATIONS];
+static uint32_t lat_entry[ITERATIONS];
+static uint32_t lat_claim[ITERATIONS];
+static uint32_t lat_complete[ITERATIONS];
+
+static inline void write_reg_u32(uintptr_t addr, uint32_t value)
+{
+  *(volatile uint32_t *)addr = value;
+}
+
+static inline uint32_t read_reg_u32(uintptr_t addr)
+{
+  return *(volatile uint32_t *)addr;
+}
+
+uintptr_t handle_trap(uintptr_t cause, uintptr_t epc, uintptr_t regs[32])
+{
+  uint64_t entry = rdcycle();
+
+  if (cause != (MCAUSE_INT | IRQ_M_EXT)) {
+    printf("irqlat: unexpected trap, mcause=0x%lx mepc=0x%lx\n", cause, epc);
+    exit(1);
+  }
+
+  uint32_t irq = read_reg_u32(PLIC_CLAIM(HART_ID));
+  uint64_t claim = rdcycle();
+  if (irq)
+    write_reg_u32(PLIC_CLAIM(HART_ID), irq);
+  uint64_t complete = rdcycle();
+
+  if (irq == DMA_IRQ_NUM) {
+    t_entry = entry;
+    t_claim = claim;
+    t_complete = complete;
+    dma_irq_seen = 1;
+  } else {
+    spurious++;
+  }
+  return epc;
+}
+
+static void plic_init(void)
+{
+  write_reg_u32(PLIC_PRIORITY(DMA_IRQ_NUM), 3);
+  write_reg_u32(PLIC_THRESHOLD(HART_ID), 0);
+  uintptr_t enable = PLIC_ENABLE(HART_ID) + 4*(DMA_IRQ_NUM/32);
+  write_reg_u32(enable, read_reg_u32(enable) | (1 << (DMA_IRQ_NUM % 32)));
+
+  // Drop anything left pending from before
+  uint32_t irq;
+  while ((irq = read_reg_u32(PLIC_CLAIM(HART_ID))) != 0)
+    write_reg_u32(PLIC_CLAIM(HART_ID), irq);
+}
+
+static void dma_setup(uint64_t src, uint64_t dst, uint32_t len)
+{
+  write_reg_u32(DMA_SRC_ADDR_LO, (uint32_t)src);
+  write_reg_u32(DMA_SRC_ADDR_HI, (uint32_t)(src >> 32));
+  write_reg_u32(DMA_DST_ADDR_LO, (uint32_t)dst);
+  write_reg_u32(DMA_DST_ADDR_HI, (uint32_t)(dst >> 32));
+  write_reg_u32(DMA_LENGTH_LO, len);
+  write_reg_u32(DMA_LENGTH_HI, 0);
+}
+
+// One DMA; returns start->resume in cycles, or 0 on timeout
+static uint64_t run_once(enum mode mode, uint32_t len)
+{
+  uint64_t start, done = 0, deadline;
+  uint32_t irq;
+
+  dma_irq_seen = 0;
+  dma_setup((uintptr_t)src_buf, OMNI_REMOTE_MEM_BASE, len);
+
+  switch (mode) {
+  case MODE_POLL:
+    clear_csr(mie, MIP_MEIP);
+    start = rdcycle();
+    write_reg_u32(DMA_CONTROL, 1);
+    deadline = start + TIMEOUT_CYCLES;
+    while (!(read_reg_u32(DMA_STATUS) & DMA_STATUS_DONE))
+      if (rdcycle() > deadline)
+        return 0;
+    done = rdcycle();
+    // The interrupt is still raised at the PLIC; acknowledge it unmasked
+    do {
+      irq = read_reg_u32(PLIC_CLAIM(HART_ID));
+      if (irq)
+        write_reg_u32(PLIC_CLAIM(HART_ID), irq);
+    } while (irq != DMA_IRQ_NUM && rdcycle() < deadline);
+    set_csr(mie, MIP_MEIP);
+    return done - start;
+
+  case MODE_SPIN:
+    set_csr(mstatus, MSTATUS_MIE);
+    start = rdcycle();
+    write_reg_u32(DMA_CONTROL, 1);
+    deadline = start + TIMEOUT_CYCLES;
+    while (!dma_irq_seen)
+      if (rdcycle() > deadline)
+        break;
+    done = rdcycle();
+    clear_csr(mstatus, MSTATUS_MIE);
+    break;
+
+  case MODE_WFI:
+    // wfi wakes on a pending enabled interrupt even with mstatus.MIE clear,
+    // so the interrupt cannot slip in between the check and the wfi; it is
+    // then taken by briefly enabling MIE
+    clear_csr(mstatus, MSTATUS_MIE);
+    start = rdcycle();
+    write_reg_u32(DMA_CONTROL, 1);
+    while (!dma_irq_seen) {
+      asm volatile ("wfi");
+      set_csr(mstatus, MSTATUS_MIE);
+      clear_csr(mstatus, MSTATUS_MIE);
+    }
+    done = rdcycle();
+    break;
+  }
+
+  if (!dma_irq_seen)
+    return 0;
+  last_entry = t_entry - start;
+  last_claim = t_claim - t_entry;
+  last_complete = t_complete - t_claim;
+  return done - start;
+}
+
+static void sort_u32(uint32_t *a, int n)
+{
+  // Shell sort: no libc qsort here, and fine for a few thousand samples
+  for (int gap = n / 2; gap > 0; gap /= 2)
+    for (int i = gap; i < n; i++) {
+      uint32_t v = a[i];
+      int j = i;
+      for (; j >= gap && a[j - gap] > v; j -= gap)
+        a[j] = a[j - gap];
+      a[j] = v;
+    }
+}
+
+static void print_cycles(uint64_t c)
+{
+#if CPU_MHZ
+  printf(" %8lu (%6lu ns)", c, c * 1000 / CPU_MHZ);
+#else
+  printf(" %8lu", c);
+#endif
+}
+
+static void report(const char *what, uint32_t *lat, int n)
+{
+  static const int pct[] = { 500, 900, 990, 999 };
+  uint64_t sum = 0;
+
+  sort_u32(lat, n);
+  for (int i = 0; i < n; i++)
+    sum += lat[i];
+
+  printf("  %-16s min", what);
+  print_cycles(lat[0]);
+  printf(" avg");
+  print_cycles(sum / n);
+  for (int i = 0; i < (int)(sizeof(pct) / sizeof(pct[0])); i++) {
+    printf(" p%d.%d", pct[i] / 10, pct[i] % 10);
+    print_cycles(lat[(uint64_t)pct[i] * (n - 1) / 1000]);
+  }
+  printf(" max");
+  print_cycles(lat[n - 1]);
+  printf("\n");
+}
+
+static void histogram(const uint32_t *lat, int n)
+{
+  int buckets[32] = { 0 };
+
+  for (int i = 0; i < n; i++) {
+    uint32_t c = lat[i];
+    int b = 0;
+    while (c > 1 && b < 31) {
+      c >>= 1;
+      b++;
+    }
+    buckets[b]++;
+  }
+  for (int b = 0; b < 32; b++)
+    if (buckets[b])
+      printf("    %10lu .. %-10lu cycles %6d\n",
+             b ? 1UL << b : 0UL, (1UL << (b + 1)) - 1, buckets[b]);
+}
+
+static int run(enum mode mode, uint32_t len)
+{
+  int n = 0;
+
+  for (int i = 0; i < WARMUP + ITERATIONS; i++) {
+    uint64_t total = run_once(mode, len);
+    if (!total) {
+      printf("irqlat: %s %u bytes: no DMA completion after %lu cycles (status=0x%x)\n",
+             mode_names[mode], len, TIMEOUT_CYCLES, read_reg_u32(DMA_STATUS));
+      return -1;
+    }
+    if (i < WARMUP)
+      continue;
+    lat_total[n] = total;
+    if (mode != MODE_POLL) {
+      lat_entry[n] = last_entry;
+      lat_claim[n] = last_claim;
+      lat_complete[n] = last_complete;
+    }
+    n++;
+  }
+
+  printf("\n[%s] %u bytes, %d iterations\n", mode_names[mode], len, n);
+  if (mode == MODE_POLL) {
+    report("start->done", lat_total, n);
+  } else {
+    report("start->entry", lat_entry, n);
+    report("entry->claim", lat_claim, n);
+    report("claim->complete", lat_complete, n);
+    report("start->resume", lat_total, n);
+  }
+  histogram(lat_total, n);
+  return 0;
+}
+
+int main(void)
+{
+  printf("irqlat: DMA IRQ %d via PLIC 0x%lx, hart %d, %d iterations\n",
+         DMA_IRQ_NUM, PLIC_BASE, HART_ID, ITERATIONS);
+  if (!CPU_MHZ)
+    printf("irqlat: latencies in cycles (build with CPU_MHZ=<MHz> for ns)\n");
+
+  clear_csr(mstatus, MSTATUS_MIE);
+  plic_init();
+  set_csr(mie, MIP_MEIP);
+
+  for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+    // spin before wfi: a missing interrupt times out there instead of
+    // leaving the hart asleep forever
+    if (run(MODE_POLL, sizes[s]) || run(MODE_SPIN, sizes[s]) || run(MODE_WFI, sizes[s]))
+      return 1;
+  }
+
+  if (spurious)
+    printf("\nirqlat: %lu spurious external interrupts\n", spurious);
+  return 0;
+}
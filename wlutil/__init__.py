@@ -7,6 +7,8 @@ Utilities for dealing with FireSim workloads
 from .wlutil import *  # NOQA
 from .build import buildWorkload  # NOQA
 from .launch import launchWorkload  # NOQA
+from .devloop import devLoop  # NOQA
+from .daemon import serveDaemon, warmInitialize, loadConfigs  # NOQA
 from .test import testWorkload,testResult  # NOQA
 from .install import installWorkload  # NOQA
 from .config import ConfigManager  # NOQA
@@ -0,0 +1,227 @@
+"""Boot-phase timing reports built from a launch's uartlog.
+
+The report splits the boot into firmware, kernel early init, initcalls,
+userspace init and the workload run. Host-side timing (from 'script
+--timing') covers the parts of the boot that print no kernel timestamps,
+printk timestamps and initcall_debug cover the kernel itself.
+"""
+import re
+import logging
+
+# Kernel arguments needed for a complete report. initcall_debug prints at
+# KERN_DEBUG so the console loglevel has to let it through.
+bootArgs = "initcall_debug printk.time=1 loglevel=8"
+
+# Initcalls at least this slow (in usecs) are listed individually
+slowInitcallUs = 1000
+
+# Driver names that always get listed, regardless of how long they took
+mecaPattern = re.compile(r'omni|meca', re.IGNORECASE)
+
+_kTimeRe = re.compile(r'^\[\s*(\d+\.\d+)\]\s?(.*)$')
+_callingRe = re.compile(r'calling\s+(\S+?)(?:\+0x[0-9a-f]+/0x[0-9a-f]+)?(?:\s+\[(\S+)\])?\s+@')
+_returnedRe = re.compile(r'initcall\s+(\S+?)(?:\+0x[0-9a-f]+/0x[0-9a-f]+)?(?:\s+\[(\S+)\])?\s+returned\s+(-?\d+)\s+after\s+(\d+)\s+usecs')
+
+
+def cmdlineForced(config):
+    """Returns True if the workload's kernel ignores bootloader arguments
+    (CONFIG_CMDLINE_FORCE), in which case initcall_debug cannot be enabled
+    at launch time."""
+    forced = False
+    for kfrag in config.get('linux', {}).get('config', []):
+        try:
+            with open(kfrag, 'r') as f:
+                for line in f:
+                    line = line.strip()
+                    if line == 'CONFIG_CMDLINE_FORCE=y':
+                        forced = True
+                    elif line == '# CONFIG_CMDLINE_FORCE is not set':
+                        forced = False
+        except OSError:
+            continue
+    return forced
+
+
+def readTimedLines(uartLog, timingLog=None):
+    """Returns a list of (hostSeconds, line) for every line of the uartlog.
+
+    hostSeconds is the time since launch at which the line was completed, or
+    None if no timing log is available."""
+    with open(uartLog, 'rb') as f:
+        data = f.read()
+
+    # 'script' adds a header line that is not part of the timing data
+    start = 0
+    if data.startswith(b'Script started'):
+        start = data.find(b'\n') + 1
+
+    # Map every byte offset where a chunk ends to its host time
+    chunkEnds = []
+    if timingLog is not None:
+        try:
+            with open(timingLog, 'r') as f:
+                now = 0.0
+                off = start
+                for entry in f:
+                    fields = entry.split()
+                    if len(fields) != 2:
+                        continue
+                    now += float(fields[0])
+                    off += int(fields[1])
+                    chunkEnds.append((off, now))
+        except (OSError, ValueError):
+            chunkEnds = []
+
+    lines = []
+    chunk = 0
+    off = start
+    for raw in data[start:].split(b'\n'):
+        off += len(raw) + 1
+        while chunk < len(chunkEnds) and chunkEnds[chunk][0] <= off - 1:
+            chunk += 1
+        host = chunkEnds[chunk][1] if chunk < len(chunkEnds) else None
+        line = raw.decode('utf-8', errors='replace').strip('\r')
+        if line.startswith('Script done'):
+            break
+        lines.append((host, line))
+
+    return lines
+
+
+def parseBoot(lines):
+    """Extract phase boundaries and initcall timings from timed uartlog lines."""
+    boot = {
+        'firstOutput': None,
+        'opensbi': None,
+        'linux': None,
+        'firstInitcall': None,
+        'lastInitcall': None,
+        'runInit': None,
+        'runStart': None,
+        'runDone': None,
+        'end': None,
+        'initcalls': [],
+        'meca': []
+    }
+
+    for host, line in lines:
+        if host is not None:
+            if boot['firstOutput'] is None and line.strip() != '':
+                boot['firstOutput'] = host
+            boot['end'] = host
+
+        kTime = None
+        msg = line
+        m = _kTimeRe.match(line)
+        if m is not None:
+            kTime = float(m.group(1))
+            msg = m.group(2)
+
+        if boot['opensbi'] is None and 'OpenSBI' in msg:
+            boot['opensbi'] = (host, kTime)
+        elif boot['linux'] is None and msg.startswith('Linux version'):
+            boot['linux'] = (host, kTime)
+        elif 'Run /init as init process' in msg or 'Run /sbin/init as init process' in msg:
+            boot['runInit'] = (host, kTime)
+        elif msg.startswith('launching firemarshal workload run/command'):
+            boot['runStart'] = (host, kTime)
+        elif msg.startswith('firemarshal workload run/command done'):
+            boot['runDone'] = (host, kTime)
+
+        m = _callingRe.search(msg)
+        if m is not None:
+            if boot['firstInitcall'] is None:
+                boot['firstInitcall'] = (host, kTime)
+            continue
+
+        m = _returnedRe.search(msg)
+        if m is not None:
+            name, module, ret, usecs = m.group(1), m.group(2), int(m.group(3)), int(m.group(4))
+            boot['initcalls'].append({'name': name,
+                                      'module': module,
+                                      'ret': ret,
+                                      'usecs': usecs})
+            if module is None:
+                boot['lastInitcall'] = (host, kTime)
+            continue
+
+        if kTime is not None and mecaPattern.search(msg):
+            boot['meca'].append((kTime, msg))
+
+    return boot
+
+
+def _span(begin, end, idx):
+    """Duration between two (host, kernel) points using the given clock, or None"""
+    if begin is None or end is None or begin[idx] is None or end[idx] is None:
+        return None
+    return end[idx] - begin[idx]
+
+
+def _fmt(secs):
+    return "       n/a" if secs is None else f"{secs:10.3f}"
+
+
+def formatReport(boot):
+    HOST = 0
+    KERN = 1
+    initcalls = boot['initcalls']
+    builtin = [ic for ic in initcalls if ic['module'] is None]
+    modules = [ic for ic in initcalls if ic['module'] is not None]
+
+    firstOutput = None if boot['firstOutput'] is None else (boot['firstOutput'], None)
+    end = None if boot['end'] is None else (boot['end'], None)
+    kernStart = (None, 0.0) if boot['linux'] is not None else None
+
+    phases = [
+        ("simulator start to first output", _span((0.0, None), firstOutput, HOST)),
+        ("firmware (OpenSBI)", _span(boot['opensbi'] or firstOutput, boot['linux'], HOST)),
+        ("kernel early init", _span(kernStart, boot['firstInitcall'], KERN)),
+        ("built-in initcalls", sum(ic['usecs'] for ic in builtin) / 1e6 if builtin else None),
+        ("kernel late init", _span(boot['lastInitcall'], boot['runInit'], KERN)),
+        ("kernel total", _span(kernStart, boot['runInit'], KERN)),
+        ("userspace init", _span(boot['runInit'], boot['runStart'], HOST)),
+        ("workload run", _span(boot['runStart'], boot['runDone'], HOST)),
+        ("shutdown", _span(boot['runDone'], end, HOST)),
+        ("launch total (host)", _span((0.0, None), end, HOST)),
+    ]
+
+    out = ["Boot phase timing (seconds)", ""]
+    for name, secs in phases:
+        out.append(f"  {name:<34} {_fmt(secs)}")
+
+    slow = sorted([ic for ic in builtin if ic['usecs'] >= slowInitcallUs or mecaPattern.search(ic['name'])],
+                  key=lambda ic: ic['usecs'], reverse=True)
+    out += ["", f"Built-in initcalls >= {slowInitcallUs} us (and all MECA drivers): {len(slow)} of {len(builtin)}", ""]
+    for ic in slow:
+        mark = ' *' if mecaPattern.search(ic['name']) else ''
+        out.append(f"  {ic['usecs']:>10} us  {ic['name']}{'' if ic['ret'] == 0 else ' (returned ' + str(ic['ret']) + ')'}{mark}")
+
+    if modules:
+        out += ["", "Module init (insmod/modprobe)", ""]
+        for ic in sorted(modules, key=lambda ic: ic['usecs'], reverse=True):
+            mark = ' *' if mecaPattern.search(ic['name']) or mecaPattern.search(ic['module']) else ''
+            out.append(f"  {ic['usecs']:>10} us  {ic['name']} [{ic['module']}]{mark}")
+
+    if boot['meca']:
+        out += ["", "MECA driver and hotplug messages", ""]
+        for kTime, msg in boot['meca']:
+            out.append(f"  [{kTime:12.6f}] {msg}")
+
+    if not initcalls:
+        out += ["", "No initcall_debug output found. If the kernel uses CONFIG_CMDLINE_FORCE,",
+                f"add '{bootArgs}' to CONFIG_CMDLINE to get per-initcall timing."]
+
+    return "\n".join(out) + "\n"
+
+
+def writeReport(uartLog, timingLog, reportPath):
+    """Parse uartLog (and optionally the 'script' timing log) and write a
+    boot report to reportPath. Returns reportPath."""
+    lines = readTimedLines(uartLog, timingLog)
+    report = formatReport(parseBoot(lines))
+    with open(reportPath, 'w') as f:
+        f.write(report)
+
+    logging.getLogger().info("Boot report written to: " + str(reportPath))
+    return reportPath
@@ -5,7 +5,11 @@ import os
 import subprocess as sp
 import pathlib
 import contextlib
+import hashlib
+import json
 from . import wlutil
+from . import prune
+from . import manifest
 from . import launch as wllaunch
 
 taskLoader = None
@@ -27,6 +31,9 @@ def print_deps(task, changed):
 class doitLoader(doit.cmd_base.TaskLoader2):
     workloads = []
 
+    # Artifact content key -> the workload that builds it, see sharedArtifact()
+    artifacts = {}
+
     # Idempotent add (no duplicates)
     def addTask(self, tsk):
         if not any(t['name'] == tsk['name'] for t in self.workloads):
@@ -42,21 +49,57 @@ class doitLoader(doit.cmd_base.TaskLoader2):
         return task_list
 
 
+# Cache key for the current busybox build, see busyboxKey()
+_busyboxKey = None
+
+
+def busyboxKey():
+    """Content key for the busybox binary: busybox-config, the busybox source
+    fingerprint and the toolchain. Builds with the same key are
+    interchangeable, so they are cached (in gen-dir/busybox-cache) and shared
+    by every workload and board."""
+
+    global _busyboxKey
+    if _busyboxKey is None:
+        h = hashlib.sha256()
+        with open(wlutil.getOpt('wlutil-dir') / 'busybox-config', 'rb') as f:
+            h.update(f.read())
+        h.update(wlutil.sourceFingerprint(wlutil.getOpt('busybox-dir')).encode('utf-8'))
+        h.update(json.dumps(wlutil.getToolVersions(), sort_keys=True).encode('utf-8'))
+        h.update(sp.run(['riscv64-unknown-linux-gnu-gcc', '--version'],
+                        stdout=sp.PIPE, universal_newlines=True).stdout.encode('utf-8'))
+        _busyboxKey = h.hexdigest()[0:16]
+
+    return _busyboxKey
+
+
 def buildBusybox(config):
     """Builds the local copy of busybox (needed by linux initramfs).
 
     This is called as a doit task (added to the graph in buildDepGraph())
     """
+    log = logging.getLogger()
 
     try:
         wlutil.checkSubmodule(wlutil.getOpt('busybox-dir'))
     except wlutil.SubmoduleError as e:
         return doit.exceptions.TaskFailed(e)
 
-    shutil.copy(wlutil.getOpt('wlutil-dir') / 'busybox-config', wlutil.getOpt('busybox-dir') / '.config')
-    wlutil.run(['make', '-j' + str(wlutil.getOpt('jlevel'))], cwd=wlutil.getOpt('busybox-dir'))
-    shutil.copy(wlutil.getOpt('busybox-dir') / 'busybox', wlutil.getOpt('initramfs-dir') / 'disk' / 'bin/')
-    shutil.copy(wlutil.getOpt('busybox-dir') / 'busybox', wlutil.getOpt('initramfs-dir') / 'nodisk' / 'bin/')
+    cached = wlutil.getOpt('gen-dir') / 'busybox-cache' / busyboxKey() / 'busybox'
+    if cached.exists():
+        log.info("Using cached busybox build " + busyboxKey())
+    else:
+        shutil.copy(wlutil.getOpt('wlutil-dir') / 'busybox-config', wlutil.getOpt('busybox-dir') / '.config')
+        wlutil.run(['make', '-j' + str(wlutil.getOpt('jlevel'))], cwd=wlutil.getOpt('busybox-dir'))
+
+        # Copy then rename so that a partial binary never looks like a cache hit
+        cached.parent.mkdir(parents=True, exist_ok=True)
+        tmp = cached.parent / ('.busybox.' + str(os.getpid()))
+        shutil.copy(wlutil.getOpt('busybox-dir') / 'busybox', tmp)
+        os.replace(tmp, cached)
+
+    shutil.copy(cached, wlutil.getOpt('initramfs-dir') / 'disk' / 'bin/')
+    shutil.copy(cached, wlutil.getOpt('initramfs-dir') / 'nodisk' / 'bin/')
     return True
 
 
@@ -150,11 +193,16 @@ def fileDepsTask(name, taskDeps=None, overlay=None, files=None):
         if files is not None:
             deps += [f.src for f in files if not f.src.is_symlink()]
 
-        for dep in deps.copy():
+        # Directories are represented by their manifest digest (see
+        # manifest.py) rather than by every file in them
+        fdeps = []
+        for dep in deps:
             if dep.is_dir():
-                deps += [child for child in dep.glob('**/*') if not child.is_symlink()]
+                fdeps.append(manifest.treeDigest(dep))
+            else:
+                fdeps.append(dep)
 
-        return {'file_dep': [str(f) for f in deps if not f.is_dir()]}
+        return {'file_dep': [str(f) for f in fdeps]}
 
     task = {'name': 'calc_' + name + '_dep',
             'actions': [(fileDeps, [overlay, files])]}
@@ -165,6 +213,96 @@ def fileDepsTask(name, taskDeps=None, overlay=None, files=None):
     return task
 
 
+def artifactKey(fields):
+    """Content key for the artifact described by fields (a dict of its inputs,
+    paths and other objects are compared by their string form)"""
+    data = json.dumps(fields, sort_keys=True, default=str)
+    return hashlib.sha256(data.encode('utf-8')).hexdigest()[0:16]
+
+
+def binKey(config):
+    """Returns the content key of config's (disk) boot binary, or None if it
+    should not be shared. Workloads with equal keys build identical binaries:
+    the same kernel and firmware sources, fragments, modules and host-init."""
+
+    # use-parent-bin already copies, and post-bin may modify the binary
+    if 'linux' not in config or config['use-parent-bin'] or 'post-bin' in config:
+        return None
+
+    linux = dict(config['linux'])
+    # Fragments may be generated by host-init, those are compared by path
+    linux['config'] = [manifest.hashFile(f) if f.exists() else str(f) for f in linux.get('config', [])]
+
+    fields = {'linux': linux, 'firmware': config.get('firmware')}
+    if 'host-init' in config:
+        fields['host-init'] = [repr(config['host-init']), config['workdir']]
+
+    return artifactKey(fields)
+
+
+def imgKey(config):
+    """Returns the content key of config's rootfs image, or None if it should
+    not be shared (see binKey())."""
+
+    # guest-init boots the workload, which depends on far more of its config
+    if 'base-img' not in config or config['img-hardcoded'] or 'guest-init' in config:
+        return None
+
+    fields = {
+        'base-img': config['base-img'],
+        'img-sz': config['img-sz'],
+        'overlay': config.get('overlay'),
+        'files': [[f.src, f.dst] for f in config.get('files', [])],
+        'run': repr(config.get('runSpec')),
+        'distro': config.get('distro'),
+        'builder': type(config.get('builder')).__name__,
+        'post-bin': repr(config.get('post-bin'))
+        }
+    if 'host-init' in config:
+        fields['host-init'] = [repr(config['host-init']), config['workdir']]
+
+    return artifactKey(fields)
+
+
+def sharedArtifact(loader, kind, key, config):
+    """Returns the workload that builds the 'kind' artifact ('bin' or 'img')
+    for config, or None if config builds its own. The first workload added
+    with a given key builds it, later ones link to its output."""
+    if key is None:
+        return None
+
+    leader = loader.artifacts.setdefault(kind + '-' + key, config)
+    if leader['name'] == config['name']:
+        return None
+
+    logging.getLogger().debug(f"{config['name']}: sharing {kind} with {leader['name']} ({key})")
+    return leader
+
+
+def linkArtifact(src, dst, hardlink=True):
+    """Make dst a copy of src without duplicating its data if possible: a
+    reflink if the filesystem supports it, else a hard link (if allowed), else
+    a full copy. Artifacts that are modified in place (e.g. rootfs images
+    written by Qemu) must not be hard linked."""
+    dst.parent.mkdir(parents=True, exist_ok=True)
+    with contextlib.suppress(FileNotFoundError):
+        os.remove(dst)
+
+    if wlutil.run(['cp', '--reflink=always', str(src), str(dst)], check=False).returncode == 0:
+        return
+
+    with contextlib.suppress(FileNotFoundError):
+        os.remove(dst)
+    if hardlink:
+        try:
+            os.link(src, dst)
+            return
+        except OSError:
+            pass
+
+    shutil.copy(src, dst)
+
+
 def addDep(loader, config):
     """Adds 'config' to the doit dependency graph ('loader')"""
 
@@ -175,8 +313,7 @@ def addDep(loader, config):
         'targets': [wlutil.getOpt('initramfs-dir') / 'disk' / 'bin' / 'busybox',
                     wlutil.getOpt('initramfs-dir') / 'nodisk' / 'bin' / 'busybox'],
         'file_dep': [wlutil.getOpt('wlutil-dir') / 'busybox-config'],
-        'uptodate': [wlutil.config_changed(wlutil.checkGitStatus(wlutil.getOpt('busybox-dir'))),
-                     wlutil.config_changed(wlutil.getToolVersions())]
+        'uptodate': [wlutil.config_changed(busyboxKey())]
         })
 
     hostInit = []
@@ -220,17 +357,31 @@ def addDep(loader, config):
             moddeps.append(config['linux']['source'])
             bin_calc_dep_tsks.append(kmodDepsTask(config, name="_kmod_deps_"+config['name']))
 
-        for tsk in bin_calc_dep_tsks:
-            loader.addTask(tsk)
+        binLeader = sharedArtifact(loader, 'bin', binKey(config), config)
+        if binLeader is not None:
+            loader.addTask({
+                    'name': str(config['bin']),
+                    # Not hard linked: makeBin() rewrites bin and dwarf in place
+                    'actions': [(linkArtifact, [binLeader['bin'], config['bin']], {'hardlink': False}),
+                                (linkArtifact, [binLeader['dwarf'], config['dwarf']], {'hardlink': False})],
+                    'targets': targets,
+                    'file_dep': [binLeader['bin'], binLeader['dwarf']],
+                    'task_dep': bin_task_deps + [str(binLeader['bin'])],
+                    'uptodate': [wlutil.config_changed(str(binLeader['bin']))]
+                    })
+        else:
+            for tsk in bin_calc_dep_tsks:
+                loader.addTask(tsk)
 
-        loader.addTask({
-                'name': str(config['bin']),
-                'actions': [(makeBin, [config])],
-                'targets': targets,
-                'file_dep': bin_file_deps,
-                'task_dep': bin_task_deps,
-                'calc_dep': [tsk['name'] for tsk in bin_calc_dep_tsks]
-                })
+            loader.addTask({
+                    'name': str(config['bin']),
+                    'actions': [(makeBin, [config])],
+                    'targets': targets,
+                    'file_dep': bin_file_deps,
+                    'task_dep': bin_task_deps,
+                    'calc_dep': [tsk['name'] for tsk in bin_calc_dep_tsks],
+                    'uptodate': [wlutil.config_changed(str(config['bin']))]
+                    })
         diskBin = [str(config['bin'])]
 
     # Add a rule for the nodisk version if requested
@@ -252,6 +403,7 @@ def addDep(loader, config):
             uptodate.append(wlutil.config_changed(wlutil.checkGitStatus(config['firmware']['source'])))
         if 'linux' in config:
             uptodate.append(wlutil.config_changed(wlutil.checkGitStatus(config['linux']['source'])))
+        uptodate.append(wlutil.config_changed({'initramfs-prune': config.get('initramfs-prune', False)}))
 
         loader.addTask({
                 'name': str(wlutil.noDiskPath(config['bin'])),
@@ -280,7 +432,20 @@ def addDep(loader, config):
     img_task_deps = [] + hostInit + postBin + config['base-deps']
     img_calc_deps = []
     img_uptodate = []
+    imgLeader = None
     if 'img' in config:
+        imgLeader = sharedArtifact(loader, 'img', imgKey(config), config)
+
+    if imgLeader is not None:
+        loader.addTask({
+            'name': str(config['img']),
+            'actions': [(linkArtifact, [imgLeader['img'], config['img']], {'hardlink': False})],
+            'targets': [config['img']],
+            'file_dep': [imgLeader['img']],
+            'task_dep': img_task_deps + [str(imgLeader['img'])],
+            'uptodate': [wlutil.config_changed(str(imgLeader['img']))]
+            })
+    elif 'img' in config:
         if 'base-img' in config:
             img_file_deps.append(config['base-img'])
 
@@ -309,7 +474,7 @@ def addDep(loader, config):
             'file_dep': img_file_deps,
             'task_dep': img_task_deps,
             'calc_dep': img_calc_deps,
-            'uptodate': img_uptodate
+            'uptodate': img_uptodate + [wlutil.config_changed(str(config['img']))]
             })
 
 
@@ -342,7 +507,7 @@ def buildDepGraph(cfgs):
     return loader
 
 
-def buildWorkload(cfgName, cfgs, buildBin=True, buildImg=True, lspOnly=False):
+def buildWorkload(cfgName, cfgs, buildBin=True, buildImg=True, lspOnly=False, verifyReproducible=False):
     # This should only be built once (multiple builds will mess up doit)
     global taskLoader
     if taskLoader is None:
@@ -373,12 +538,18 @@ def buildWorkload(cfgName, cfgs, buildBin=True, buildImg=True, lspOnly=False):
 
     imgList = []
     binList = []
+    # Kernel debug info built alongside the binaries (only checked by verifyReproducible)
+    dwarfList = []
 
     if buildBin and 'bin' in config:
         if config['nodisk']:
             binList.append(wlutil.noDiskPath(config['bin']))
+            if 'dwarf' in config:
+                dwarfList.append(wlutil.noDiskPath(config['dwarf']))
         else:
             binList.append(config['bin'])
+            if 'dwarf' in config:
+                dwarfList.append(config['dwarf'])
 
     if 'img' in config and buildImg and not config['img-hardcoded']:
         imgList.append(config['img'])
@@ -387,8 +558,12 @@ def buildWorkload(cfgName, cfgs, buildBin=True, buildImg=True, lspOnly=False):
         for jCfg in config['jobs'].values():
             if buildBin:
                 binList.append(jCfg['bin'])
+                if 'dwarf' in jCfg:
+                    dwarfList.append(jCfg['dwarf'])
                 if jCfg['nodisk']:
                     binList.append(wlutil.noDiskPath(jCfg['bin']))
+                    if 'dwarf' in jCfg:
+                        dwarfList.append(wlutil.noDiskPath(jCfg['dwarf']))
 
             if 'img' in jCfg and buildImg and not jCfg['img-hardcoded']:
                 imgList.append(jCfg['img'])
@@ -396,7 +571,61 @@ def buildWorkload(cfgName, cfgs, buildBin=True, buildImg=True, lspOnly=False):
     doitHandle = doit.doit_cmd.DoitMain(taskLoader)
 
     # The order isn't critical here, we should have defined the dependencies correctly in loader
-    return doitHandle.run([str(p) for p in binList + imgList])
+    ccacheBefore = wlutil.ccacheStats()
+    ret = doitHandle.run([str(p) for p in binList + imgList])
+    reportCcache(ccacheBefore)
+
+    if ret == 0 and verifyReproducible:
+        outputs = binList + [d for d in dwarfList if d.exists()] + imgList
+        ret = verifyOutputs(taskLoader, binList + imgList, outputs)
+        if ret != 0 and len(imgList) != 0 and not wlutil.getOpt('reproducible-img'):
+            logging.getLogger().info("Images are only reproducible with the 'reproducible-img' option")
+
+    return ret
+
+
+def verifyOutputs(loader, targets, outputs):
+    """Rebuild targets (after a successful build) and check that the files in
+    outputs come out bit-identical. Only the workload's own build steps are
+    repeated; parent workloads, distro images and the kernel's object files
+    are reused. Returns 0 if every output matches."""
+    log = logging.getLogger()
+
+    first = {}
+    for out in outputs:
+        first[out] = manifest.hashFile(out)
+        os.remove(out)
+
+    log.info("Rebuilding to verify that the outputs are reproducible")
+    ret = doit.doit_cmd.DoitMain(loader).run([str(p) for p in targets])
+    if ret != 0:
+        return ret
+
+    differ = 0
+    for out in outputs:
+        if out.exists() and manifest.hashFile(out) == first[out]:
+            log.info("Reproducible: " + str(out))
+        else:
+            log.error("Not reproducible: " + str(out))
+            differ += 1
+
+    return 1 if differ != 0 else 0
+
+
+def reportCcache(before):
+    """Log the ccache hit rate since 'before' (a wlutil.ccacheStats() result)"""
+    after = wlutil.ccacheStats()
+    if before is None or after is None:
+        return
+
+    def delta(*names):
+        return sum(after.get(n, 0) - before.get(n, 0) for n in names)
+
+    # Counter names changed in ccache 4.0
+    hits = delta('direct_cache_hit', 'preprocessed_cache_hit', 'cache_hit_direct', 'cache_hit_preprocessed')
+    misses = delta('cache_miss')
+    if hits + misses != 0:
+        logging.getLogger().info(f"ccache: {hits} hits, {misses} misses ({100 * hits / (hits + misses):.0f}% hit rate)")
 
 
 def makeInitramfs(srcs, cpioDir, includeDevNodes=False):
@@ -431,12 +660,61 @@ def makeInitramfs(srcs, cpioDir, includeDevNodes=False):
     return finalPath
 
 
+# Memoized sourceFingerprint() of each kernel tree, see kconfigKey()
+_kernelFingerprints = {}
+
+
+def kconfigKey(kfrags, linuxSrc):
+    """Content key for the .config generated from kfrags in linuxSrc: the
+    kernel source (its Kconfig files and defconfig), the toolchain (Kconfig
+    records the compiler version), the make arguments and the contents of the
+    fragments in the order they are applied."""
+
+    if linuxSrc not in _kernelFingerprints:
+        _kernelFingerprints[linuxSrc] = wlutil.sourceFingerprint(linuxSrc)
+
+    h = hashlib.sha256()
+    h.update(_kernelFingerprints[linuxSrc].encode('utf-8'))
+    h.update(json.dumps(wlutil.getOpt('linux-make-args')).encode('utf-8'))
+    h.update(sp.run(['riscv64-unknown-linux-gnu-gcc', '--version'],
+                    stdout=sp.PIPE, universal_newlines=True).stdout.encode('utf-8'))
+    for frag in kfrags:
+        with open(frag, 'rb') as f:
+            h.update(hashlib.sha256(f.read()).digest())
+
+    return h.hexdigest()[0:16]
+
+
 def generateKConfig(kfrags, linuxSrc):
     """Generate the final .config in linuxSrc from the provided list of kernel
-    configuration fragments. Fragments will be applied on top of defconfig."""
+    configuration fragments. Fragments will be applied on top of defconfig.
+
+    Merged configs are cached in gen-dir/kconfig-cache (see kconfigKey()). The
+    .config in linuxSrc is only rewritten if its contents change, a touched
+    .config would make kbuild re-evaluate the whole tree."""
+    log = logging.getLogger()
     linuxCfg = linuxSrc / '.config'
     defCfg = wlutil.getOpt('gen-dir') / 'defconfig'
 
+    key = kconfigKey(kfrags, linuxSrc)
+    cached = wlutil.getOpt('gen-dir') / 'kconfig-cache' / key / '.config'
+
+    oldCfg = None
+    with contextlib.suppress(FileNotFoundError):
+        with open(linuxCfg, 'rb') as f:
+            oldCfg = f.read()
+        oldTimes = os.stat(linuxCfg)
+
+    if cached.exists():
+        log.debug("Using cached kernel config " + key)
+        with open(cached, 'rb') as f:
+            newCfg = f.read()
+        if newCfg != oldCfg:
+            # Installed with the current time (not the cached file's) so that
+            # kbuild regenerates include/config from it
+            shutil.copy(cached, linuxCfg)
+        return
+
     # Create a defconfig to use as reference
     wlutil.run(['make'] + wlutil.getOpt('linux-make-args') + ['defconfig'], cwd=linuxSrc)
     shutil.copy(linuxCfg, defCfg)
@@ -448,6 +726,18 @@ def generateKConfig(kfrags, linuxSrc):
     wlutil.run([linuxSrc / 'scripts/kconfig/merge_config.sh', str(defCfg)] +
                list(map(str, kfrags)), env=kconfigEnv, cwd=linuxSrc)
 
+    # Generating rewrites .config even if the result is unchanged
+    with open(linuxCfg, 'rb') as f:
+        newCfg = f.read()
+    if newCfg == oldCfg:
+        os.utime(linuxCfg, ns=(oldTimes.st_atime_ns, oldTimes.st_mtime_ns))
+
+    # Copy then rename so that a partial config never looks like a cache hit
+    cached.parent.mkdir(parents=True, exist_ok=True)
+    tmp = cached.parent / ('.config.' + str(os.getpid()))
+    shutil.copy(linuxCfg, tmp)
+    os.replace(tmp, cached)
+
 
 def makeInitramfsKfrag(src, dst):
     with open(dst, 'w') as f:
@@ -455,15 +745,21 @@ def makeInitramfsKfrag(src, dst):
         f.write('CONFIG_INITRAMFS_SOURCE="' + str(src) + '"\n')
 
 
-def makeModules(cfg):
+def makeModules(cfg, kfrags=None):
     """Build all the kernel modules for this config. The compiled kmods will be
-    put in the appropriate location in the initramfs staging area."""
+    put in the appropriate location in the initramfs staging area.
+
+    kfrags: kernel config fragments to build against (default: the workload's
+        linux.config). makeBin() passes the same list it builds the kernel
+        with so that .config does not change between the two steps."""
 
     linCfg = cfg['linux']
     drivers = []
+    if kfrags is None:
+        kfrags = linCfg['config']
 
     # Prepare the linux source with the proper config
-    generateKConfig(linCfg['config'], linCfg['source'])
+    generateKConfig(kfrags, linCfg['source'])
     cfg['out-dir'].mkdir(parents=True, exist_ok=True)
     shutil.copy(linCfg['source'] / '.config', cfg['out-dir'] / 'linux_module_config')
 
@@ -558,33 +854,45 @@ def makeBin(config, nodisk=False, lspOnly=False):
     if 'linux' in config:
         initramfsIncludes = []
 
+        config['out-dir'].mkdir(parents=True, exist_ok=True)
+        cpioDir = config['out-dir']
+        cpioDir = pathlib.Path(cpioDir)
+
+        # The initramfs fragment only names the archive, so it can be written
+        # before the archive exists. Modules and kernel then share one .config.
+        if lspOnly:
+            kfrags = config['linux']['config']
+        else:
+            makeInitramfsKfrag(cpioDir / 'initramfs.cpio', cpioDir / "initramfs.kfrag")
+            kfrags = config['linux']['config'] + [cpioDir / "initramfs.kfrag"]
+
         # Some submodules are only needed if building Linux
         try:
             wlutil.checkSubmodule(config['linux']['source'])
             wlutil.checkSubmodule(config['firmware']['source'])
 
-            makeModules(config)
+            makeModules(config, kfrags)
         except wlutil.SubmoduleError as err:
             return doit.exceptions.TaskFailed(err)
 
         initramfsIncludes.append(wlutil.getOpt('initramfs-dir') / 'drivers')
-        config['out-dir'].mkdir(parents=True, exist_ok=True)
-        cpioDir = config['out-dir']
-        cpioDir = pathlib.Path(cpioDir)
-        initramfsPath = ""
         if nodisk:
             initramfsIncludes += [wlutil.getOpt('initramfs-dir') / "nodisk"]
             with wlutil.mountImg(config['img'], wlutil.getOpt('mount-dir')):
                 initramfsIncludes = [wlutil.getOpt('mount-dir')] + initramfsIncludes
+                if config.get('initramfs-prune', False):
+                    initramfsIncludes = [prune.pruneInitramfs(initramfsIncludes, cpioDir / 'initramfs-root',
+                                                              config['initramfs-prune'],
+                                                              cpioDir / 'initramfs-prune-report')]
                 # This must be done while in the mountImg context
-                initramfsPath = makeInitramfs(initramfsIncludes, cpioDir, includeDevNodes=True)
+                makeInitramfs(initramfsIncludes, cpioDir, includeDevNodes=True)
         else:
             initramfsIncludes += [wlutil.getOpt('initramfs-dir') / "disk"]
-            initramfsPath = makeInitramfs(initramfsIncludes, cpioDir, includeDevNodes=True)
+            makeInitramfs(initramfsIncludes, cpioDir, includeDevNodes=True)
 
         if lspOnly:
             # For LSP mode, just generate compile_commands.json
-            generateKConfig(config['linux']['config'], config['linux']['source'])
+            generateKConfig(kfrags, config['linux']['source'])
             wlutil.run(['make'] + wlutil.getOpt('linux-make-args') + ['compile_commands.json'],
                        cwd=config['linux']['source'])
 
@@ -595,12 +903,12 @@ def makeBin(config, nodisk=False, lspOnly=False):
                         config['out-dir'] / 'linux_config')
         else:
             # Normal build process
-            makeInitramfsKfrag(initramfsPath, cpioDir / "initramfs.kfrag")
-            generateKConfig(config['linux']['config'] + [cpioDir / "initramfs.kfrag"], config['linux']['source'])
+            generateKConfig(kfrags, config['linux']['source'])
             wlutil.run(['make'] + wlutil.getOpt('linux-make-args') + ['vmlinux', 'Image', '-j' + str(wlutil.getOpt('jlevel'))], cwd=config['linux']['source'])
             # copy files needed to build linux (busybox copying is put here so that it is shown per linux build)
             shutil.copy(config['linux']['source'] / '.config', config['out-dir'] / 'linux_config')
-            shutil.copy(wlutil.getOpt('busybox-dir') / '.config', config['out-dir'] / 'busybox_config')
+            # Not busybox-dir/.config: a cached busybox build never writes it
+            shutil.copy(wlutil.getOpt('wlutil-dir') / 'busybox-config', config['out-dir'] / 'busybox_config')
 
             fw = makeOpenSBI(config, nodisk)
 
@@ -623,10 +931,13 @@ def makeImage(config):
     with contextlib.suppress(FileNotFoundError):
         os.remove(config['img'])
 
-    # Create new image from a copy of the base
+    # Create new image from a copy of the base (or a thin layer on top of it)
     if 'base-img' in config:
         config['img'].parent.mkdir(parents=True, exist_ok=True)
-        shutil.copy(config['base-img'], config['img'])
+        if wlutil.getOpt('img-format') == 'qcow2':
+            wlutil.createThinImg(config['img'], config['base-img'])
+        else:
+            shutil.copy(config['base-img'], config['img'])
 
     # Resize if needed
     if config['img-sz'] != 0:
@@ -673,3 +984,6 @@ def makeImage(config):
     # Tighten the image size if requested
     if config['img-sz'] == 0:
         wlutil.resizeFS(config['img'], 0)
+
+    if wlutil.getOpt('reproducible-img'):
+        wlutil.normalizeImg(config['img'])
@@ -6,6 +6,8 @@ import humanfriendly as hf
 from . import wlutil
 import pathlib
 import copy
+from . import prune
+from . import bootreport
 
 # This is a comprehensive list of all user-defined config options
 # Note that paths direct from a config file are relative to workdir, but will
@@ -77,6 +79,12 @@ configUser = [
         'mem',
         # Testing-related options
         'testing',
+        # Shrink the nodisk initramfs (bool or map, see prune.pruneDefaults)
+        'initramfs-prune',
+        # (bool) Share the run's results directory with the guest over virtio-9p
+        'live-outputs',
+        # (bool) Build the kernel so that 'launch --boot-report' can pass it arguments
+        'boot-report',
         # Flag to indicate the workload is a distro (rather than a derived workload).
         'isDistro',
         # The builder object from the distro. This option is only set by distros.
@@ -146,7 +154,10 @@ configInherit = [
         'rootfs-size',
         'qemu-args',
         'cpus',
-        'mem']
+        'mem',
+        'initramfs-prune',
+        'live-outputs',
+        'boot-report']
 
 # Default constants, may be overridden by the user
 # These take the post-processing form (e.g. if the user can provide a string,
@@ -465,6 +476,9 @@ class Config(collections.abc.MutableMapping):
         if 'outputs' in self.cfg:
             self.cfg['outputs'] = [pathlib.Path(f) for f in self.cfg['outputs']]
 
+        if 'initramfs-prune' in self.cfg:
+            self.cfg['initramfs-prune'] = prune.initOpts(self.cfg['initramfs-prune'], self.cfg.get('cfg-file'))
+
         if 'firesim' in self.cfg:
             if 'simulation_outputs' in self.cfg['firesim']:
                 self.cfg['firesim']['simulation_outputs'] = [pathlib.Path(f) for f in self.cfg['firesim']['simulation_outputs']]
@@ -553,6 +567,18 @@ class Config(collections.abc.MutableMapping):
         inheritLinuxOpts(self.cfg, baseCfg)
         inheritFirmwareOpts(self.cfg, baseCfg)
 
+        if self.cfg.get('live-outputs', False) and 'linux' in self.cfg:
+            # The guest needs 9p support to mount the shared results dir
+            liveKfrag = wlutil.getOpt('wlutil-dir') / 'live-outputs-kfrag'
+            kfrags = self.cfg['linux'].get('config', [])
+            if liveKfrag not in kfrags:
+                self.cfg['linux']['config'] = kfrags + [liveKfrag]
+
+        if self.cfg.get('boot-report', False) and 'linux' in self.cfg and bootreport.cmdlineForced(self.cfg):
+            # Qemu's -append would be ignored, let it extend CONFIG_CMDLINE
+            reportKfrag = wlutil.getOpt('wlutil-dir') / 'boot-report-kfrag'
+            self.cfg['linux']['config'] = self.cfg['linux'].get('config', []) + [reportKfrag]
+
         if 'linux' in self.cfg:
             # Linux workloads get their own binary, whether from scratch or a
             # copy of their parent's
@@ -617,9 +643,6 @@ def findConfig(targetName, searchPaths):
 
 # The configuration of sw-manager is derived from the *.json files in workloads/
 class ConfigManager(collections.abc.MutableMapping):
-    # This contains all currently loaded configs, indexed by config file path
-    cfgs = {}
-
     def __init__(self, configNames, searchPaths):
         """Initialize this class with the set of configs to use. Note that configs
         that don't parse will issue a warning but be ignored otherwise.
@@ -633,6 +656,10 @@ class ConfigManager(collections.abc.MutableMapping):
         """
         log = logging.getLogger()
 
+        # This contains all currently loaded configs, indexed by config file
+        # path. It is per-instance so that a long-lived process (e.g. the build
+        # daemon) can load several independent sets of workloads.
+        self.cfgs = {}
         self.searchPaths = searchPaths
 
         # Load the explicitly provided workloads
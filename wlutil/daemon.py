@@ -0,0 +1,565 @@
+"""Long-lived build server ('marshal daemon') and its caches.
+
+Every marshal invocation normally starts from scratch: it imports wlutil and
+doit, re-reads the marshal and workload configs, queries the toolchain and
+runs 'git status' on the (large) kernel, firmware and buildroot submodules.
+The daemon does that work once and keeps the results until their inputs
+change:
+
+  - The marshal context is rebuilt only when a marshal-config.yaml or a
+    MARSHAL_* environment variable changes.
+  - Tool versions are re-queried only when the cross compiler changes.
+  - Loaded workloads (ConfigManager) are reused until one of the files they
+    were loaded from changes.
+  - checkGitStatus() results are kept until inotify reports a change anywhere
+    in the repo's tracked directories or its git directory.
+
+Requests arrive over a Unix socket from the thin client at the top of
+'marshal'. The client passes its stdin/stdout/stderr, so output goes straight
+to the user's terminal. Command lines are parsed and workloads are loaded in
+the daemon itself (so the caches fill up), then the command runs in a forked
+child that inherits all of that state. Git statuses computed by the child
+(e.g. by the build tasks) are sent back to the daemon when it exits.
+"""
+import os
+import sys
+import json
+import errno
+import random
+import socket
+import struct
+import ctypes
+import shutil
+import logging
+import pathlib
+import traceback
+import contextlib
+import subprocess as sp
+from . import wlutil
+from .config import ConfigManager
+
+# The currently running daemon (only set in the daemon and its children)
+_server = None
+
+# Seconds between checks for exited children while idle
+pollInterval = 1.0
+
+# Largest request the client may send (command line plus environment)
+maxRequest = 1 << 20
+
+
+class Inotify():
+    """Minimal ctypes wrapper for the Linux inotify API"""
+
+    # From <sys/inotify.h>
+    IN_ATTRIB = 0x00000004
+    IN_CLOSE_WRITE = 0x00000008
+    IN_MOVED_FROM = 0x00000040
+    IN_MOVED_TO = 0x00000080
+    IN_CREATE = 0x00000100
+    IN_DELETE = 0x00000200
+    IN_DELETE_SELF = 0x00000400
+    IN_MOVE_SELF = 0x00000800
+    IN_Q_OVERFLOW = 0x00004000
+    IN_IGNORED = 0x00008000
+    IN_ONLYDIR = 0x01000000
+
+    # Anything that can change what 'git status' reports
+    watchMask = (IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO |
+                 IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+    # Events after which a watch no longer covers its directory
+    lostMask = IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED
+
+    _event = struct.Struct('iIII')
+
+    def __init__(self):
+        self.libc = ctypes.CDLL(None, use_errno=True)
+        self.fd = self.libc.inotify_init1(os.O_NONBLOCK | os.O_CLOEXEC)
+        if self.fd < 0:
+            err = ctypes.get_errno()
+            raise OSError(err, "inotify_init1: " + os.strerror(err))
+
+    def addWatch(self, path):
+        wd = self.libc.inotify_add_watch(self.fd, os.fsencode(str(path)), self.watchMask)
+        if wd < 0:
+            err = ctypes.get_errno()
+            raise OSError(err, os.strerror(err), str(path))
+        return wd
+
+    def rmWatch(self, wd):
+        self.libc.inotify_rm_watch(self.fd, wd)
+
+    def read(self):
+        """Returns all pending events as a list of (wd, mask). A wd of -1
+        means events were dropped (queue overflow)."""
+        events = []
+        while True:
+            try:
+                buf = os.read(self.fd, 64 * 1024)
+            except BlockingIOError:
+                return events
+
+            off = 0
+            while off < len(buf):
+                wd, mask, cookie, nameLen = self._event.unpack_from(buf, off)
+                off += self._event.size + nameLen
+                events.append((-1 if mask & self.IN_Q_OVERFLOW else wd, mask))
+
+    def close(self):
+        os.close(self.fd)
+
+
+class _Repo():
+    def __init__(self):
+        # Bumped on every change event under this repo
+        self.gen = 0
+        self.wds = []
+        # (gen, status) of the last cached checkGitStatus() result
+        self.status = None
+
+
+class GitStatusCache():
+    """checkGitStatus() results, invalidated by inotify.
+
+    Every directory containing tracked files (plus the git directory) is
+    watched. Build outputs written next to sources also count as changes, so
+    the first status check after a build re-runs 'git status' once."""
+
+    def __init__(self):
+        self.log = logging.getLogger()
+        self.inotify = Inotify()
+        self.repos = {}
+        self.byWd = {}
+        self.inChild = False
+        # Results computed in a forked child, reported back when it exits
+        self.fresh = {}
+
+    def _watch(self, key):
+        repo = _Repo()
+        self.repos[key] = repo
+        try:
+            files = sp.run(['git', '-C', key, 'ls-files', '-z'],
+                           stdout=sp.PIPE, stderr=sp.DEVNULL, check=True).stdout
+            gitDir = sp.run(['git', '-C', key, 'rev-parse', '--absolute-git-dir'],
+                            stdout=sp.PIPE, stderr=sp.DEVNULL, check=True,
+                            universal_newlines=True).stdout.strip()
+        except sp.CalledProcessError:
+            # Not a repo (yet). Uninitialized submodules are never cached.
+            del self.repos[key]
+            return None
+
+        dirs = {key, gitDir, os.path.join(gitDir, 'refs', 'heads')}
+        for f in files.split(b'\0'):
+            if f:
+                dirs.add(os.path.join(key, os.path.dirname(os.fsdecode(f))))
+
+        try:
+            for d in dirs:
+                if os.path.isdir(d):
+                    wd = self.inotify.addWatch(d)
+                    self.byWd[wd] = repo
+                    repo.wds.append(wd)
+        except OSError as e:
+            if e.errno == errno.ENOSPC:
+                self.log.warning(f"Not caching git status of {key}: out of inotify watches "
+                                 "(see /proc/sys/fs/inotify/max_user_watches)")
+            else:
+                self.log.warning(f"Not caching git status of {key}: {e}")
+            self._forget(key)
+            self.repos[key] = None
+
+        return repo
+
+    def _forget(self, key):
+        repo = self.repos.pop(key, None)
+        if repo is None:
+            return
+        for wd in repo.wds:
+            self.inotify.rmWatch(wd)
+            self.byWd.pop(wd, None)
+
+    def drain(self):
+        """Process pending inotify events"""
+        lost = set()
+        for wd, mask in self.inotify.read():
+            if wd == -1:
+                lost.update(k for k, r in self.repos.items() if r is not None)
+                continue
+
+            repo = self.byWd.get(wd)
+            if repo is None:
+                continue
+            repo.gen += 1
+            if mask & Inotify.lostMask:
+                # Part of the tree is no longer watched, start over next time
+                lost.update(k for k, r in self.repos.items() if r is repo)
+
+        for key in lost:
+            self._forget(key)
+
+    def get(self, submodule, readStatus):
+        key = str(pathlib.Path(submodule).resolve())
+
+        if not self.inChild:
+            self.drain()
+            if key not in self.repos:
+                self._watch(key)
+        repo = self.repos.get(key)
+
+        if repo is not None and repo.status is not None and repo.status[0] == repo.gen:
+            status = dict(repo.status[1])
+        else:
+            gen = None if repo is None else repo.gen
+            status = readStatus(submodule)
+            cached = {k: status[k] for k in ['sha', 'dirty', 'init']}
+            if self.inChild:
+                self.fresh[key] = (gen, cached)
+            elif repo is not None and status['init']:
+                repo.status = (gen, cached)
+
+        # checkGitStatus() contract: dirty or missing repos never look uptodate
+        status['rebuild'] = random.random() if status['dirty'] or not status['init'] else 0
+        return status
+
+    def fork(self):
+        """Called in a newly forked child"""
+        self.inChild = True
+        self.fresh = {}
+        self.inotify.close()
+
+    def merge(self, fresh):
+        """Adopt results computed by a child. They are only kept if nothing
+        changed in the repo since the child was forked."""
+        self.drain()
+        for key, (gen, status) in fresh.items():
+            if key not in self.repos:
+                # Unwatched when the child ran, cache it next time around
+                self._watch(key)
+                continue
+
+            repo = self.repos[key]
+            if repo is not None and gen == repo.gen and status['init']:
+                repo.status = (gen, status)
+
+    def epoch(self):
+        """Changes whenever any cached status may have"""
+        return tuple(sorted((k, id(r), r.gen) for k, r in self.repos.items() if r is not None))
+
+
+def _mtime(path):
+    try:
+        return os.stat(path).st_mtime_ns
+    except OSError:
+        return None
+
+
+def _exitCode(e):
+    """Process exit status for a SystemExit exception"""
+    if e.code is None:
+        return 0
+    elif isinstance(e.code, int):
+        return e.code
+    else:
+        print(e.code, file=sys.stderr)
+        return 1
+
+
+def _send(conn, msg):
+    conn.sendall((json.dumps(msg) + "\n").encode())
+
+
+@contextlib.contextmanager
+def _clientContext(fds, cwd, env):
+    """Temporarily run the daemon with the client's stdio, cwd and environment"""
+    saved = [os.dup(i) for i in range(3)]
+    savedCwd = os.getcwd()
+    savedEnv = dict(os.environ)
+
+    sys.stdout.flush()
+    sys.stderr.flush()
+    for i, fd in enumerate(fds):
+        os.dup2(fd, i)
+    os.chdir(cwd)
+    os.environ.clear()
+    os.environ.update(env)
+    try:
+        yield
+    finally:
+        sys.stdout.flush()
+        sys.stderr.flush()
+        for i, fd in enumerate(saved):
+            os.dup2(fd, i)
+            os.close(fd)
+        os.chdir(savedCwd)
+        os.environ.clear()
+        os.environ.update(savedEnv)
+
+
+@contextlib.contextmanager
+def _savedLogging():
+    """Undo the request's logging setup (initLogging() in prepare) once it
+    returns, so that its log file, verbosity and --werr don't leak into the
+    daemon or later requests"""
+    rootLogger = logging.getLogger()
+    savedHandlers = list(rootLogger.handlers)
+    savedFilters = list(rootLogger.filters)
+    savedGlobals = (wlutil.fileHandler, wlutil.consoleHandler)
+    try:
+        yield
+    finally:
+        for h in rootLogger.handlers:
+            if h not in savedHandlers:
+                h.close()
+        rootLogger.handlers = savedHandlers
+        rootLogger.filters = savedFilters
+        wlutil.fileHandler, wlutil.consoleHandler = savedGlobals
+
+
+class Daemon():
+    def __init__(self, sockPath, prepare, run):
+        self.log = logging.getLogger()
+        self.sockPath = pathlib.Path(sockPath)
+        self.prepare = prepare
+        self.run = run
+        self.running = False
+        self.sock = None
+
+        # pid -> read end of the pipe that returns the child's git statuses
+        self.children = {}
+
+        self.ctx = None
+        self.ctxStamp = None
+        self.toolStamp = None
+        self.cfgCache = {}
+
+        self.git = GitStatusCache()
+        wlutil.gitStatusCache = self.git
+
+    def initialize(self):
+        """wlutil.initialize(), skipped if no marshal config input changed"""
+        root = pathlib.Path(sys.modules['__main__'].__file__).parent.resolve()
+        localCfg = pathlib.Path('marshal-config.yaml').resolve()
+        stamp = (_mtime(pathlib.Path(__file__).parent / 'default-config.yaml'),
+                 localCfg if localCfg.exists() else None, _mtime(localCfg),
+                 _mtime(root / 'marshal-config.yaml'),
+                 sorted((k, v) for k, v in os.environ.items() if k.startswith('MARSHAL_')))
+
+        if self.ctx is None or stamp != self.ctxStamp:
+            wlutil.initialize()
+            self.ctx = wlutil.getCtx()
+            self.ctxStamp = stamp
+            self.cfgCache = {}
+        else:
+            wlutil.ctx = self.ctx
+            self.ctx['run-name'] = ""
+
+        gcc = shutil.which('riscv64-unknown-linux-gnu-gcc')
+        toolStamp = (gcc, _mtime(gcc) if gcc else None)
+        if toolStamp != self.toolStamp:
+            wlutil._toolVersions = None
+            if gcc is not None:
+                wlutil.getToolVersions()
+            self.toolStamp = toolStamp
+
+    def _cfgStamp(self, cfgs, searchPaths):
+        paths = [str(p) for p in searchPaths]
+        for cfg in cfgs.cfgs.values():
+            if 'cfg-file' in cfg:
+                paths.append(str(cfg['cfg-file']))
+                paths.append(str(cfg['cfg-file'].parent))
+            distro = cfg.get('distro')
+            if isinstance(distro, dict) and isinstance(distro.get('opts'), dict):
+                paths += [str(c) for c in distro['opts'].get('configs', [])]
+
+        return (id(self.ctx), self.git.epoch(), tuple((p, _mtime(p)) for p in sorted(set(paths))))
+
+    def loadConfigs(self, configNames, searchPaths):
+        key = (tuple(str(c) for c in configNames), tuple(str(p) for p in searchPaths))
+        if key in self.cfgCache:
+            stamp, cfgs = self.cfgCache[key]
+            if stamp == self._cfgStamp(cfgs, searchPaths):
+                self.log.debug("Reusing loaded workloads")
+                return cfgs
+
+        cfgs = ConfigManager(configNames, searchPaths)
+        self.cfgCache[key] = (self._cfgStamp(cfgs, searchPaths), cfgs)
+        return cfgs
+
+    def _runChild(self, conn, fds, req, state, pipeW):
+        code = 1
+        try:
+            self.sock.close()
+            self.sock = None
+            self.git.fork()
+
+            # Own session so that the client can interrupt the whole command
+            os.setsid()
+            for i, fd in enumerate(fds):
+                os.dup2(fd, i)
+            os.chdir(req['cwd'])
+            os.environ.clear()
+            os.environ.update(req['env'])
+            _send(conn, {'pid': os.getpid()})
+
+            try:
+                self.run(*state)
+                code = 0
+            except SystemExit as e:
+                code = _exitCode(e)
+            except BaseException:
+                traceback.print_exc()
+                code = 1
+
+            sys.stdout.flush()
+            sys.stderr.flush()
+            with contextlib.suppress(OSError):
+                _send(conn, {'exit': code})
+            os.write(pipeW, json.dumps(self.git.fresh).encode())
+        finally:
+            os._exit(code)
+
+    def handle(self, conn):
+        creds = conn.getsockopt(socket.SOL_SOCKET, socket.SO_PEERCRED, struct.calcsize('3i'))
+        if struct.unpack('3i', creds)[1] != os.getuid():
+            self.log.warning("Ignoring request from another user")
+            return
+
+        data, fds, flags, addr = socket.recv_fds(conn, maxRequest, 3)
+        try:
+            while not data.endswith(b'\n') and len(data) < maxRequest:
+                chunk = conn.recv(maxRequest)
+                if not chunk:
+                    return
+                data += chunk
+            req = json.loads(data)
+
+            if req.get('stop', False):
+                self.running = False
+                _send(conn, {'exit': 0})
+                return
+            if len(fds) != 3:
+                _send(conn, {'exit': 1})
+                return
+
+            self.log.info("Request: marshal " + ' '.join(req['argv']))
+            with _clientContext(fds, req['cwd'], req['env']), _savedLogging():
+                try:
+                    state = self.prepare(req['argv'])
+                except SystemExit as e:
+                    state = None
+                    code = _exitCode(e)
+                except Exception:
+                    traceback.print_exc()
+                    state = None
+                    code = 1
+
+            if state is None:
+                _send(conn, {'exit': code})
+                return
+
+            pipeR, pipeW = os.pipe()
+            pid = os.fork()
+            if pid == 0:
+                os.close(pipeR)
+                self._runChild(conn, fds, req, state, pipeW)
+            os.close(pipeW)
+            self.children[pid] = pipeR
+        finally:
+            for fd in fds:
+                os.close(fd)
+
+    def reap(self):
+        while self.children:
+            try:
+                pid, status = os.waitpid(-1, os.WNOHANG)
+            except ChildProcessError:
+                break
+            if pid == 0:
+                break
+
+            pipeR = self.children.pop(pid, None)
+            if pipeR is None:
+                continue
+            with os.fdopen(pipeR, 'rb') as f:
+                data = f.read()
+            try:
+                self.git.merge(json.loads(data) if data else {})
+            except ValueError:
+                pass
+
+    def serve(self):
+        if self.sockPath.exists():
+            probe = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                probe.connect(str(self.sockPath))
+                raise RuntimeError("A marshal daemon is already running on " + str(self.sockPath))
+            except ConnectionRefusedError:
+                # Left over from a daemon that did not exit cleanly
+                self.sockPath.unlink()
+            finally:
+                probe.close()
+
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        oldMask = os.umask(0o077)
+        try:
+            self.sock.bind(str(self.sockPath))
+        finally:
+            os.umask(oldMask)
+        self.sock.listen()
+        self.sock.settimeout(pollInterval)
+        wlutil.registerCleanUp(self.close)
+
+        self.log.info("marshal daemon listening on " + str(self.sockPath))
+        self.running = True
+        try:
+            while self.running:
+                self.reap()
+                try:
+                    conn, addr = self.sock.accept()
+                except socket.timeout:
+                    continue
+
+                with conn:
+                    conn.settimeout(None)
+                    try:
+                        self.handle(conn)
+                    except (OSError, ValueError, KeyError) as e:
+                        self.log.warning("Dropped a malformed request: " + repr(e))
+        finally:
+            self.close()
+
+    def close(self):
+        if self.sock is not None:
+            self.sock.close()
+            self.sock = None
+            with contextlib.suppress(FileNotFoundError):
+                self.sockPath.unlink()
+
+
+def serveDaemon(sockPath, prepare, run):
+    """Serve marshal requests on the Unix socket sockPath until stopped.
+
+    prepare(argv) is called in the daemon for every request and returns a
+    tuple of arguments for run(), which executes the command in a forked
+    child. Both may raise SystemExit to set the command's exit status."""
+    global _server
+    _server = Daemon(sockPath, prepare, run)
+    _server.serve()
+
+
+def warmInitialize():
+    """wlutil.initialize(), reusing the daemon's context when possible"""
+    if _server is None:
+        wlutil.initialize()
+    else:
+        _server.initialize()
+
+
+def loadConfigs(configNames, searchPaths):
+    """ConfigManager(configNames, searchPaths), reusing the daemon's
+    previously loaded workloads when none of their files changed"""
+    if _server is None:
+        return ConfigManager(configNames, searchPaths)
+    else:
+        return _server.loadConfigs(configNames, searchPaths)
@@ -0,0 +1,233 @@
+"""Kernel module edit-test loop against a running qemu guest.
+
+The workload is booted once with its results directory shared over virtio-9p
+(see 'live-outputs'). The host then watches the source directories in
+linux.modules. When one changes, only that module is rebuilt against the
+prepared kernel tree, and the new .ko is pushed into the share. A small
+agent in the guest reloads it with rmmod/insmod and re-runs the test command.
+"""
+import os
+import time
+import string
+import shutil
+import logging
+import subprocess as sp
+from . import wlutil
+from . import build
+from . import launch
+
+# Source files that trigger a rebuild when they change
+srcPatterns = ['*.c', '*.h', '*.S', 'Makefile', 'Kbuild']
+
+# Seconds to wait for the guest agent (boot) and for each reload+test
+bootTimeout = 600
+testTimeout = 300
+
+# Layout of the shared directory (all relative to the share root)
+agentScript = 'devloop.sh'
+readyFile = 'devloop.ready'
+cmdFile = 'devloop.cmd'
+modDir = 'devloop-modules'
+reqDir = 'devloop-requests'
+resDir = 'devloop-results'
+
+# Guest side of the loop. Run by the Buildroot S99run script instead of the
+# workload's run script when it is present in the share. Requests are
+# numbered files containing either "reload <module>..." or "quit".
+agentTemplate = string.Template("""#!/bin/sh
+cd /firemarshal || exit 1
+n=0
+touch ${ready}
+echo "firemarshal dev loop agent ready"
+while :; do
+    if [ ! -f ${reqs}/$$n ]; then
+        usleep 200000
+        continue
+    fi
+    read -r action mods < ${reqs}/$$n
+    if [ "$$action" = quit ]; then
+        echo "firemarshal dev loop agent done"
+        poweroff
+        exit 0
+    fi
+
+    rc=0
+    {
+        for m in $$mods; do
+            echo "== reloading $$m"
+            rmmod $$m 2>/dev/null
+            insmod ${mods}/$$m.ko || rc=1
+        done
+        if [ $$rc -eq 0 ] && [ -f ${cmd} ]; then
+            echo "== running test command"
+            sh ${cmd} || rc=$$?
+        fi
+    } > ${results}/$$n.log 2>&1
+    echo $$rc > ${results}/$$n.rc.tmp
+    mv ${results}/$$n.rc.tmp ${results}/$$n.rc
+    n=$$((n + 1))
+done
+""")
+
+
+def _srcMtimes(driverDir):
+    mtimes = {}
+    for pattern in srcPatterns:
+        for src in driverDir.rglob(pattern):
+            if not src.name.endswith('.mod.c'):
+                mtimes[src] = src.stat().st_mtime_ns
+    return mtimes
+
+
+class DevLoop():
+    def __init__(self, config, testCmd=None, interval=1.0):
+        if 'linux' not in config or len(config['linux'].get('modules', {})) == 0:
+            raise wlutil.ConfigurationError("The dev loop needs a Linux workload with 'linux.modules'")
+        if not config.get('live-outputs', False):
+            raise wlutil.ConfigurationError("The dev loop needs the 'live-outputs' option (the guest kernel must support virtio-9p)")
+
+        self.config = config
+        self.testCmd = testCmd
+        self.interval = interval
+        self.log = logging.getLogger()
+        self.share = wlutil.getOpt('res-dir') / wlutil.getOpt('run-name') / config['name']
+        self.proc = None
+        self.reqNum = 0
+
+    def prepareKernel(self):
+        """Make the kernel tree match this workload so modules can be built
+        without a clean (the same preparation as makeModules())."""
+        linCfg = self.config['linux']
+        kfrags = linCfg['config']
+        initramfsKfrag = self.config['out-dir'] / 'initramfs.kfrag'
+        if initramfsKfrag.exists():
+            kfrags = kfrags + [initramfsKfrag]
+        build.generateKConfig(kfrags, linCfg['source'])
+        wlutil.run(["make"] + wlutil.getOpt('linux-make-args') +
+                   ["modules_prepare", '-j' + str(wlutil.getOpt('jlevel'))],
+                   cwd=linCfg['source'])
+
+    def buildModule(self, driverDir):
+        """Incrementally rebuild one module and copy it to the share. Returns
+        the list of module names built, or None if the build failed."""
+        makeCmd = "make KBUILD_MODPOST_WARN=1 LINUXSRC=" + str(self.config['linux']['source'])
+        try:
+            wlutil.run(makeCmd, cwd=driverDir, shell=True, level=logging.INFO)
+        except sp.CalledProcessError:
+            self.log.error(f"Build failed in {driverDir}")
+            return None
+
+        names = []
+        for ko in driverDir.glob("*.ko"):
+            shutil.copy(ko, self.share / modDir / ko.name)
+            names.append(ko.stem)
+        return names
+
+    def boot(self):
+        self.share.mkdir(parents=True)
+        for d in [modDir, reqDir, resDir]:
+            (self.share / d).mkdir()
+
+        with open(self.share / agentScript, 'w') as f:
+            f.write(agentTemplate.substitute(ready=readyFile, reqs=reqDir, mods=modDir,
+                                             results=resDir, cmd=cmdFile))
+        os.chmod(self.share / agentScript, 0o755)
+
+        if self.testCmd is not None:
+            with open(self.share / cmdFile, 'w') as f:
+                f.write(self.testCmd + "\n")
+
+        cmd = launch.getQemuCmd(self.config, self.config['nodisk'], self.share)
+        uartLog = self.share / "uartlog"
+        self.log.info("Booting: " + cmd)
+        self.log.info("Guest console output is in: " + str(uartLog))
+        self.proc = sp.Popen(["bash", "-c", f'script -f -q -c "{cmd}" {uartLog}'],
+                             stdin=sp.DEVNULL, stdout=sp.DEVNULL, stderr=sp.STDOUT)
+        wlutil.registerCleanUp(self.stop)
+
+        deadline = time.time() + bootTimeout
+        while not (self.share / readyFile).exists():
+            if self.proc.poll() is not None:
+                raise RuntimeError("qemu exited before the dev loop agent started, see " + str(uartLog))
+            if time.time() > deadline:
+                raise RuntimeError("Timed out waiting for the dev loop agent, is this a Buildroot workload?")
+            time.sleep(0.5)
+
+    def request(self, line):
+        """Send a request to the guest agent and return its number"""
+        num = self.reqNum
+        self.reqNum += 1
+        tmp = self.share / reqDir / f".{num}.tmp"
+        with open(tmp, 'w') as f:
+            f.write(line + "\n")
+        os.rename(tmp, self.share / reqDir / str(num))
+        return num
+
+    def reload(self, modules):
+        start = time.time()
+        num = self.request("reload " + ' '.join(modules))
+        rcPath = self.share / resDir / f"{num}.rc"
+        deadline = start + testTimeout
+        while not rcPath.exists():
+            if self.proc.poll() is not None:
+                raise RuntimeError("qemu exited during the test (kernel panic?), see " + str(self.share / "uartlog"))
+            if time.time() > deadline:
+                self.log.error(f"Timed out waiting for reload/test #{num}")
+                return False
+            time.sleep(0.2)
+
+        rc = int(rcPath.read_text().strip() or 1)
+        with open(self.share / resDir / f"{num}.log", 'r') as f:
+            for line in f:
+                self.log.info("  | " + line.rstrip())
+        status = "PASS" if rc == 0 else f"FAIL (rc={rc})"
+        self.log.info(f"[{num}] {' '.join(modules) or 'baseline'}: {status} in {time.time() - start:.1f}s")
+        return rc == 0
+
+    def run(self):
+        self.prepareKernel()
+        self.boot()
+
+        modDirs = list(self.config['linux']['modules'].values())
+        seen = {d: _srcMtimes(d) for d in modDirs}
+        self.log.info("Watching " + ', '.join(str(d) for d in modDirs) + " (Ctrl-C to stop)")
+        if self.testCmd is not None:
+            self.reload([])
+
+        while True:
+            if self.proc.poll() is not None:
+                raise RuntimeError("qemu exited, see " + str(self.share / "uartlog"))
+
+            for driverDir in modDirs:
+                current = _srcMtimes(driverDir)
+                if current == seen[driverDir]:
+                    continue
+                seen[driverDir] = current
+
+                self.log.info(f"Change detected in {driverDir}, rebuilding")
+                names = self.buildModule(driverDir)
+                if names:
+                    self.reload(names)
+            time.sleep(self.interval)
+
+    def stop(self):
+        if self.proc is None or self.proc.poll() is not None:
+            return
+        self.request("quit")
+        try:
+            self.proc.wait(timeout=30)
+        except sp.TimeoutExpired:
+            self.proc.terminate()
+
+
+def devLoop(config, testCmd=None, interval=1.0):
+    """Boot config in qemu and reload its kernel modules into the running guest
+    whenever their sources change, re-running testCmd after each reload.
+    Runs until interrupted."""
+    loop = DevLoop(config, testCmd, interval)
+    try:
+        loop.run()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        loop.stop()
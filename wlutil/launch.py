@@ -1,8 +1,10 @@
 import socket
 import logging
 import os
+import contextlib
 import subprocess as sp
 from . import wlutil
+from . import bootreport
 
 jobProcs = []
 
@@ -44,7 +46,7 @@ def getSpikeCmd(config, nodisk=False):
         else:
             spikeArgs += '--extlib=libspikedevices.so ' +\
                          "--device=\"iceblk," +\
-                         'img=' + str(config.get('img', '')) + "\" "
+                         'img=' + str(wlutil.rawImg(config['img'])) + "\" "
 
     if 'spike' in config:
         spikeBin = str(config['spike'])
@@ -64,8 +66,16 @@ def getSpikeCmd(config, nodisk=False):
     return " ".join(cmd)
 
 
+# Mount tag of the host-shared results directory (see 'live-outputs')
+liveOutputsTag = 'firemarshal'
+
+# File in the shared directory listing the 'outputs' the guest should copy there
+liveOutputsList = '.outputs'
+
+
 # Returns a command string to luanch the given config in qemu. Must be called with shell=True.
-def getQemuCmd(config, nodisk=False):
+# shareDir: Optional host directory to export to the guest over virtio-9p
+def getQemuCmd(config, nodisk=False, shareDir=None):
     launch_port = get_free_tcp_port()
 
     if nodisk:
@@ -92,12 +102,16 @@ def getQemuCmd(config, nodisk=False):
 
     if 'img' in config and not nodisk:
         cmd = cmd + ['-device', 'virtio-blk-device,drive=hd0',
-                     '-drive', 'file=' + str(config['img']) + ',format=raw,id=hd0']
+                     '-drive', 'file=' + str(config['img']) + ',format=' + wlutil.imgFormat(config['img']) + ',id=hd0']
+
+    if shareDir is not None:
+        cmd = cmd + ['-fsdev', 'local,id=fmshare,security_model=none,path=' + str(shareDir),
+                     '-device', 'virtio-9p-device,fsdev=fmshare,mount_tag=' + liveOutputsTag]
 
     return " ".join(cmd) + " " + config.get('qemu-args', '')
 
 
-def launchWorkload(baseConfig, jobs=None, spike=False, silent=False):
+def launchWorkload(baseConfig, jobs=None, spike=False, silent=False, bootReport=False):
     """Launches the specified workload in functional simulation.
 
     cfgName: unique name of the workload in the cfgs
@@ -108,6 +122,8 @@ def launchWorkload(baseConfig, jobs=None, spike=False, silent=False):
     silent: If false, the output from the simulator will be displayed to
         stdout. If true, only the uartlog will be written (it is written live and
         unbuffered so users can still 'tail' the output if they'd like).
+    bootReport: Boot with initcall_debug and printk timestamps and write a
+        boot-phase timing report ('bootreport') next to each job's uartlog.
 
     Returns: Path of output directory
     """
@@ -128,6 +144,7 @@ def launchWorkload(baseConfig, jobs=None, spike=False, silent=False):
 
     screenIdentifiers = {}
     uartlogs = []
+    timingLogs = []
 
     try:
         for config in configs:
@@ -137,17 +154,40 @@ def launchWorkload(baseConfig, jobs=None, spike=False, silent=False):
                 uartlogs.append(uartLog)
                 os.makedirs(runResDir)
 
+                shareDir = None
+                if config.get('live-outputs', False):
+                    if spike:
+                        log.warning("Spike does not support virtio-9p, 'live-outputs' will be ignored")
+                    else:
+                        shareDir = runResDir
+                        with open(shareDir / liveOutputsList, 'w') as f:
+                            f.writelines(str(o) + '\n' for o in config.get('outputs', []))
+
                 if spike:
                     cmd = getSpikeCmd(config, config['nodisk'])
                 else:
-                    cmd = getQemuCmd(config, config['nodisk'])
+                    cmd = getQemuCmd(config, config['nodisk'], shareDir)
+
+                timingArg = ''
+                if bootReport:
+                    if spike:
+                        log.warning("Spike cannot pass kernel arguments, the boot report will not include initcall timing")
+                    else:
+                        if bootreport.cmdlineForced(config):
+                            log.warning("This kernel uses CONFIG_CMDLINE_FORCE and would ignore '" + bootreport.bootArgs +
+                                        "'. Set 'boot-report' in the workload and rebuild it to get initcall timing in the boot report.")
+                        else:
+                            cmd += " -append '" + bootreport.bootArgs + "'"
+                    timingLog = runResDir / "uartlog.timing"
+                    timingLogs.append((uartLog, timingLog))
+                    timingArg = f'--timing={timingLog} '
 
                 log.info(f"\nLaunching job {config['name']}")
                 log.info(f'Running: {cmd}')
                 if silent:
                     log.info("For live output see: " + str(uartLog))
 
-                scriptCmd = f'script -f -c "{cmd}" {uartLog}'
+                scriptCmd = f'script -f {timingArg}-c "{cmd}" {uartLog}'
 
                 if not silent and len(configs) == 1:
                     jobProcs.append(sp.Popen(["bash", "-c", scriptCmd], stderr=sp.STDOUT))
@@ -166,6 +206,12 @@ def launchWorkload(baseConfig, jobs=None, spike=False, silent=False):
         for proc in jobProcs:
             proc.wait()
 
+        for uartLog, timingLog in timingLogs:
+            try:
+                bootreport.writeReport(uartLog, timingLog, uartLog.parent / "bootreport")
+            except Exception as e:
+                log.warning(f"Failed to generate boot report for {uartLog}: {e}")
+
         for uartlog in uartlogs:
             try:
                 with open(uartlog, 'r') as f:
@@ -180,9 +226,30 @@ def launchWorkload(baseConfig, jobs=None, spike=False, silent=False):
         raise
 
     for config in configs:
+        if not config['launch']:
+            continue
+
+        runResDir = baseResDir / config['name']
+        with contextlib.suppress(FileNotFoundError):
+            os.remove(runResDir / liveOutputsList)
+
         if 'outputs' in config:
-            outputSpec = [wlutil.FileSpec(src=f, dst=runResDir) for f in config['outputs']]
-            wlutil.copyImgFiles(config['img'], outputSpec, direction='out')
+            # Outputs the guest already copied to the shared directory don't
+            # need to be extracted from the image
+            missing = [f for f in config['outputs'] if not (runResDir / f.name).exists()]
+            if len(missing) == 0:
+                continue
+            elif config['nodisk']:
+                log.warning("Nodisk runs don't write back to the image, these outputs are copied from the image " +
+                            "as it was before the run (use 'live-outputs' to get them from the guest): " +
+                            ', '.join(str(f) for f in missing))
+            elif config.get('live-outputs', False) and not spike:
+                log.warning("Some outputs were not found in the shared directory, copying them out of the image")
+
+            # Spike ran on the raw version of the image
+            runImg = wlutil.rawImg(config['img']) if spike else config['img']
+            outputSpec = [wlutil.FileSpec(src=f, dst=runResDir) for f in missing]
+            wlutil.copyImgFiles(runImg, outputSpec, direction='out')
 
     if 'post_run_hook' in baseConfig:
         prhCmd = [baseConfig['post_run_hook'].path] + baseConfig['post_run_hook'].args + [baseResDir]
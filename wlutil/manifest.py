@@ -0,0 +1,172 @@
+"""Cached content manifests for overlay and 'files' directories.
+
+Image tasks depend on every file in their overlay and 'files' directories.
+Listing those trees to doit means a walk plus a hash of each file on every
+build, which dominates no-op builds with large overlays (toolchains, datasets,
+benchmarks). Instead, each tree gets a manifest in gen-dir/manifests that
+records every entry (path, type, size, mtime, ctime, inode, mode, owner and
+content hash) and a digest file summarizing the tree's contents. The digest
+file is the only file_dep doit sees.
+
+Manifests are updated incrementally: directories whose mtime and inode are
+unchanged reuse their recorded listing, and files whose size, mtimes and inode
+are unchanged reuse their recorded hash. Stats and hashes of large trees run in
+a thread pool. The digest file is only rewritten when the digest changes, so
+doit finds it up to date after a no-op build.
+"""
+import os
+import stat
+import json
+import hashlib
+import logging
+import pathlib
+import concurrent.futures
+from . import wlutil
+
+# Bump when the manifest format changes (old manifests are discarded)
+manifestVersion = 1
+
+# Stat or hash in a thread pool once there are this many entries to process
+parallelThreshold = 64
+
+
+def manifestPath(root):
+    """Returns the (manifest, digest file) paths for the tree at root"""
+    key = hashlib.sha256(str(root).encode('utf-8')).hexdigest()[0:16]
+    base = wlutil.getOpt('gen-dir') / 'manifests' / (root.name + '-' + key)
+    return (base.with_suffix('.json'), base.with_suffix('.digest'))
+
+
+def hashFile(path):
+    h = hashlib.sha256()
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            h.update(chunk)
+    return h.hexdigest()
+
+
+def describe(st):
+    """The manifest entry for a stat result (without the content)"""
+    if stat.S_ISDIR(st.st_mode):
+        kind = 'd'
+    elif stat.S_ISLNK(st.st_mode):
+        kind = 'l'
+    else:
+        kind = 'f'
+
+    return {'type': kind, 'mode': st.st_mode, 'uid': st.st_uid, 'gid': st.st_gid,
+            'size': st.st_size, 'mtime': st.st_mtime_ns, 'ctime': st.st_ctime_ns, 'ino': st.st_ino}
+
+
+def sameFile(old, new):
+    return old is not None and all(old.get(k) == new[k] for k in ['type', 'size', 'mtime', 'ctime', 'ino'])
+
+
+def mapMaybeParallel(pool, fn, items):
+    """[fn(i) for i in items], in the pool for long lists. Items are handed
+    out in batches, a future per stat() would cost more than the stat."""
+    if len(items) < parallelThreshold:
+        return [fn(i) for i in items]
+
+    batch = max(parallelThreshold // 4, len(items) // (wlutil.getOpt('jlevel') * 4))
+    batches = [items[i:i + batch] for i in range(0, len(items), batch)]
+    results = []
+    for res in pool.map(lambda b: [fn(i) for i in b], batches):
+        results += res
+    return results
+
+
+def scanTree(root, old, pool):
+    """Returns the entries of the tree at root, reusing listings and hashes
+    from 'old' (a previous result) where they are still valid.
+
+    Entries map paths relative to root to describe() dicts. Directories also
+    have 'children' (sorted names), files 'hash' and symlinks 'target'."""
+
+    entries = {'.': describe(os.lstat(root))}
+    level = ['.']
+    while len(level) != 0:
+        # List this level's directories, or reuse an unchanged listing
+        children = []
+        for rel in level:
+            ent = entries[rel]
+            prev = old.get(rel)
+            if prev is not None and prev['type'] == 'd' and prev['mtime'] == ent['mtime'] and prev['ino'] == ent['ino']:
+                ent['children'] = prev['children']
+            else:
+                ent['children'] = sorted(os.listdir(root / rel))
+            children += [os.path.normpath(os.path.join(rel, name)) for name in ent['children']]
+
+        stats = mapMaybeParallel(pool, lambda rel: describe(os.lstat(root / rel)), children)
+
+        level = []
+        toHash = []
+        for rel, ent in zip(children, stats):
+            entries[rel] = ent
+            prev = old.get(rel)
+            if ent['type'] == 'd':
+                level.append(rel)
+            elif ent['type'] == 'l':
+                ent['target'] = os.readlink(root / rel)
+            elif sameFile(prev, ent):
+                ent['hash'] = prev['hash']
+            else:
+                toHash.append(rel)
+
+        hashes = mapMaybeParallel(pool, lambda rel: hashFile(root / rel), toHash)
+        for rel, h in zip(toHash, hashes):
+            entries[rel]['hash'] = h
+
+    return entries
+
+
+def treeDigest(root):
+    """Update the manifest for the directory at root and return the path of
+    its digest file (suitable as a doit file_dep). The digest covers every
+    entry's path, type, permissions, owner and contents, but not its
+    timestamps or inode."""
+    log = logging.getLogger()
+    root = pathlib.Path(root).resolve()
+    mPath, dPath = manifestPath(root)
+
+    old = {}
+    try:
+        with open(mPath, 'r') as f:
+            prev = json.load(f)
+        if prev.get('version') == manifestVersion and prev.get('root') == str(root):
+            old = prev['entries']
+    except (FileNotFoundError, json.JSONDecodeError):
+        pass
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=wlutil.getOpt('jlevel')) as pool:
+        entries = scanTree(root, old, pool)
+
+    h = hashlib.sha256()
+    for rel in sorted(entries):
+        ent = entries[rel]
+        h.update(json.dumps([rel, ent['type'], ent['mode'], ent['uid'], ent['gid'],
+                             ent.get('hash'), ent.get('target')]).encode('utf-8'))
+    digest = h.hexdigest()
+
+    mPath.parent.mkdir(parents=True, exist_ok=True)
+    if entries != old:
+        log.debug("Updating manifest for " + str(root))
+        writeAtomic(mPath, json.dumps({'version': manifestVersion, 'root': str(root), 'entries': entries}))
+
+    try:
+        with open(dPath, 'r') as f:
+            oldDigest = f.read().strip()
+    except FileNotFoundError:
+        oldDigest = None
+    if digest != oldDigest:
+        writeAtomic(dPath, digest + '\n')
+
+    return dPath
+
+
+def writeAtomic(path, data):
+    """Write then rename so that readers never see a partial file"""
+    tmp = path.parent / ('.' + path.name + '.' + str(os.getpid()))
+    with open(tmp, 'w') as f:
+        f.write(data)
+    os.replace(tmp, path)
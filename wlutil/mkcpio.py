@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Write a reproducible cpio archive of the current directory to stdout.
+
+Usage: mkcpio.py EPOCH
+
+The archive is in the 'newc' format that the kernel's initramfs unpacker
+expects. Unlike 'find | cpio', the output only depends on the names, modes
+and contents of the files:
+  - entries are sorted by name (byte order, like LC_ALL=C sort)
+  - every entry is owned by root and has mtime EPOCH
+  - inode numbers are renumbered from 1, hard links within the tree are kept
+
+This is a standalone script (no wlutil imports) so that toCpio() can run it
+as root to read files that the user can't.
+"""
+import os
+import stat
+import sys
+
+trailer = 'TRAILER!!!'
+
+
+def pad(n):
+    return b'\0' * (-n % 4)
+
+
+def writeEntry(out, name, mode=0, ino=0, nlink=1, mtime=0, size=0, rdev=0, data=None):
+    """Write one header (and the data, if any). data is a file object to
+    copy size bytes from, or the bytes themselves."""
+    nameBytes = os.fsencode(name) + b'\0'
+    fields = [ino, mode, 0, 0, nlink, mtime, size, 0, 0,
+              os.major(rdev), os.minor(rdev), len(nameBytes), 0]
+    hdr = b'070701' + b''.join(b'%08X' % f for f in fields)
+    out.write(hdr + nameBytes + pad(len(hdr) + len(nameBytes)))
+
+    if isinstance(data, bytes):
+        out.write(data)
+    elif data is not None:
+        left = size
+        while left > 0:
+            chunk = data.read(min(left, 1 << 20))
+            if not chunk:
+                raise RuntimeError(name + " changed while it was being archived")
+            out.write(chunk)
+            left -= len(chunk)
+    out.write(pad(size))
+
+
+def main():
+    epoch = int(sys.argv[1])
+    out = sys.stdout.buffer
+
+    names = ['.']
+    for dirpath, dirnames, filenames in os.walk('.'):
+        names += [os.path.normpath(os.path.join(dirpath, n)) for n in dirnames + filenames]
+    names.sort(key=os.fsencode)
+
+    stats = {name: os.lstat(name) for name in names}
+
+    # Hard links: number of entries and the last one (which carries the data)
+    links = {}
+    for name in names:
+        st = stats[name]
+        if stat.S_ISREG(st.st_mode) and st.st_nlink > 1:
+            links.setdefault((st.st_dev, st.st_ino), []).append(name)
+
+    inos = {}
+    for name in names:
+        st = stats[name]
+        key = (st.st_dev, st.st_ino)
+        ino = inos.setdefault(key, len(inos) + 1)
+        group = links.get(key, [name])
+        hdr = {'mode': st.st_mode, 'ino': ino, 'nlink': len(group), 'mtime': epoch}
+
+        if stat.S_ISREG(st.st_mode) and name == group[-1]:
+            with open(name, 'rb') as f:
+                writeEntry(out, name, size=st.st_size, data=f, **hdr)
+        elif stat.S_ISLNK(st.st_mode):
+            target = os.fsencode(os.readlink(name))
+            writeEntry(out, name, size=len(target), data=target, **hdr)
+        elif stat.S_ISCHR(st.st_mode) or stat.S_ISBLK(st.st_mode):
+            writeEntry(out, name, rdev=st.st_rdev, **hdr)
+        else:
+            # Directories, fifos, sockets and all but the last of each set of
+            # hard links have no data
+            writeEntry(out, name, **hdr)
+
+    writeEntry(out, trailer)
+    out.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,259 @@
+"""Initramfs footprint reduction for nodisk builds.
+
+The nodisk initramfs normally packs the whole rootfs image verbatim. When a
+workload sets 'initramfs-prune', the initramfs sources are first merged into
+a staging directory where debug info is stripped, excluded files are dropped
+and identical files are hard-linked together.
+"""
+import os
+import stat
+import shutil
+import fnmatch
+import hashlib
+import logging
+import pathlib
+from . import wlutil
+
+# Defaults for the 'initramfs-prune' workload option. 'exclude' globs are
+# matched against absolute guest paths ('*' also matches '/').
+pruneDefaults = {
+        'strip': True,
+        'dedupe': True,
+        'exclude': [
+            '/usr/share/doc/*',
+            '/usr/share/man/*',
+            '/usr/share/info/*',
+            '/usr/include/*',
+            '/usr/lib/*.a',
+            '/usr/lib/*.la',
+            ],
+        'report': 20,
+        }
+
+stripCmd = 'riscv64-unknown-linux-gnu-strip'
+
+# Number of files handed to each strip invocation
+stripBatch = 256
+
+
+def initOpts(opts, cfgPath):
+    """Convert the user-provided 'initramfs-prune' option to its canonical
+    form (a dict with every key of pruneDefaults), or False if pruning is
+    explicitly disabled (so that it is not inherited from the base)."""
+    from .config import WorkloadConfigError
+
+    if opts is None or opts is False:
+        return False
+    elif opts is True:
+        opts = {}
+    elif not isinstance(opts, dict):
+        raise WorkloadConfigError(cfgPath, 'initramfs-prune', "must be a boolean or a map of pruning options")
+
+    for k in opts:
+        if k not in pruneDefaults:
+            raise WorkloadConfigError(cfgPath, 'initramfs-prune', f"unrecognized pruning option '{k}'")
+
+    return {**pruneDefaults, **opts}
+
+
+def _stageTree(src, dst, dirModes):
+    """Copy src over dst the way the kernel unpacks concatenated cpio
+    archives: later entries replace earlier ones of a different type.
+    Directory permissions are recorded in dirModes and applied once pruning
+    is done (read-only directories would get in the way until then).
+    Returns the number of special files skipped."""
+    skipped = 0
+    for entry in os.scandir(src):
+        target = dst / entry.name
+        if entry.is_dir(follow_symlinks=False):
+            if target.is_symlink() or (target.exists() and not target.is_dir()):
+                target.unlink()
+            target.mkdir(exist_ok=True)
+            os.chmod(target, 0o755)
+            dirModes[target] = entry.stat(follow_symlinks=False)
+            skipped += _stageTree(entry.path, target, dirModes)
+        elif entry.is_symlink() or entry.is_file(follow_symlinks=False):
+            if target.is_dir() and not target.is_symlink():
+                shutil.rmtree(target)
+            elif target.is_symlink() or target.exists():
+                target.unlink()
+
+            if entry.is_symlink():
+                os.symlink(os.readlink(entry.path), target)
+            else:
+                shutil.copy2(entry.path, target)
+        else:
+            # Device nodes etc. come from devNodes.cpio instead
+            skipped += 1
+
+    return skipped
+
+
+def _guestPath(stageDir, path):
+    return '/' + str(pathlib.Path(path).relative_to(stageDir))
+
+
+def _dropExcluded(stageDir, patterns):
+    """Remove everything matching the exclude globs. Returns the number of
+    bytes removed."""
+    removed = 0
+    for root, dirs, files in os.walk(stageDir):
+        for name in list(dirs):
+            path = pathlib.Path(root) / name
+            if any(fnmatch.fnmatchcase(_guestPath(stageDir, path), p) for p in patterns):
+                dirs.remove(name)
+                if path.is_symlink():
+                    path.unlink()
+                else:
+                    removed += _treeSize(path)
+                    shutil.rmtree(path)
+
+        for name in files:
+            path = pathlib.Path(root) / name
+            if any(fnmatch.fnmatchcase(_guestPath(stageDir, path), p) for p in patterns):
+                removed += path.lstat().st_size
+                path.unlink()
+
+    return removed
+
+
+def _regularFiles(stageDir):
+    for root, dirs, files in os.walk(stageDir):
+        for name in files:
+            path = pathlib.Path(root) / name
+            st = path.lstat()
+            if stat.S_ISREG(st.st_mode):
+                yield path, st
+
+
+def _treeSize(path):
+    """Bytes used by regular files under path, counting hard links once"""
+    inodes = {(st.st_dev, st.st_ino): st.st_size for _, st in _regularFiles(path)}
+    return sum(inodes.values())
+
+
+def _stripDebug(stageDir):
+    """Strip debug info from every ELF file. Returns the number of bytes saved."""
+    if shutil.which(stripCmd) is None:
+        logging.getLogger().warning(f"{stripCmd} not found, not stripping the initramfs")
+        return 0
+
+    elfs = []
+    for path, st in _regularFiles(stageDir):
+        if st.st_size < 4:
+            continue
+        with open(path, 'rb') as f:
+            if f.read(4) == b'\x7fELF':
+                elfs.append(path)
+
+    before = sum(p.stat().st_size for p in elfs)
+    for i in range(0, len(elfs), stripBatch):
+        # strip complains about (and skips) foreign or damaged ELFs, that's fine
+        wlutil.run([stripCmd, '--strip-debug'] + elfs[i:i + stripBatch], check=False)
+
+    return before - sum(p.stat().st_size for p in elfs)
+
+
+def _dedupe(stageDir):
+    """Hard-link files with identical contents and permissions. Returns the
+    number of bytes saved."""
+    bySize = {}
+    for path, st in _regularFiles(stageDir):
+        if st.st_size > 0:
+            bySize.setdefault(st.st_size, []).append(path)
+
+    saved = 0
+    for size, paths in bySize.items():
+        if len(paths) < 2:
+            continue
+
+        canonical = {}
+        for path in paths:
+            h = hashlib.sha256()
+            with open(path, 'rb') as f:
+                for chunk in iter(lambda: f.read(1 << 20), b''):
+                    h.update(chunk)
+            key = (h.digest(), stat.S_IMODE(path.lstat().st_mode))
+            if key in canonical:
+                path.unlink()
+                os.link(canonical[key], path)
+                saved += size
+            else:
+                canonical[key] = path
+
+    return saved
+
+
+def _writeReport(stageDir, reportPath, nTop, summary):
+    """Write the largest files and directories in the staged tree."""
+    files = []
+    dirSizes = {}
+    seen = set()
+    for path, st in _regularFiles(stageDir):
+        if (st.st_dev, st.st_ino) in seen:
+            continue
+        seen.add((st.st_dev, st.st_ino))
+
+        guest = _guestPath(stageDir, path)
+        files.append((st.st_size, guest))
+        parent = pathlib.PurePosixPath(guest).parent
+        while True:
+            dirSizes[str(parent)] = dirSizes.get(str(parent), 0) + st.st_size
+            if parent == parent.parent:
+                break
+            parent = parent.parent
+
+    lines = summary + ["", f"Largest files (top {nTop})"]
+    lines += [f"  {size:>12}  {guest}" for size, guest in sorted(files, reverse=True)[:nTop]]
+    lines += ["", f"Largest directories (top {nTop})"]
+    lines += [f"  {size:>12}  {d}" for d, size in sorted(dirSizes.items(), key=lambda d: d[1], reverse=True)[:nTop]]
+
+    with open(reportPath, 'w') as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def pruneInitramfs(srcs, stageDir, opts, reportPath):
+    """Merge the initramfs source directories into stageDir and shrink the
+    result according to opts (the canonical 'initramfs-prune' option).
+    Returns stageDir, ready to be passed to makeInitramfs()."""
+    log = logging.getLogger()
+
+    if stageDir.exists():
+        # A previous run restored the guest's (possibly read-only) dir modes
+        for root, dirs, files in os.walk(stageDir):
+            for d in dirs:
+                if not os.path.islink(os.path.join(root, d)):
+                    os.chmod(os.path.join(root, d), 0o755)
+        shutil.rmtree(stageDir)
+    stageDir.mkdir(parents=True)
+
+    dirModes = {}
+    skipped = 0
+    for src in srcs:
+        skipped += _stageTree(src, stageDir, dirModes)
+    if skipped != 0:
+        log.debug(f"Skipped {skipped} special files while staging the initramfs")
+
+    original = _treeSize(stageDir)
+    summary = [f"Initramfs size before pruning: {original} bytes"]
+
+    excluded = _dropExcluded(stageDir, opts['exclude'])
+    summary.append(f"  excluded files:      -{excluded}")
+    if opts['strip']:
+        summary.append(f"  stripped debug info: -{_stripDebug(stageDir)}")
+    if opts['dedupe']:
+        summary.append(f"  hard-linked dups:    -{_dedupe(stageDir)}")
+
+    for path, st in sorted(dirModes.items(), reverse=True):
+        if path.exists():
+            os.chmod(path, stat.S_IMODE(st.st_mode))
+            os.utime(path, ns=(st.st_atime_ns, st.st_mtime_ns))
+
+    summary.append(f"Initramfs size after pruning: {_treeSize(stageDir)} bytes")
+
+    _writeReport(stageDir, reportPath, opts['report'], summary)
+    for line in summary:
+        log.info(line)
+    log.info("Initramfs space report written to: " + str(reportPath))
+
+    return stageDir
@@ -12,9 +12,11 @@ import git
 import json
 import hashlib
 import humanfriendly
+import contextlib
 from contextlib import contextmanager
 import yaml
 import re
+import shutil
 import pprint
 import doit
 import importlib.util
@@ -133,6 +135,7 @@ def cleanPaths(opts, baseDir=pathlib.Path('.')):
         ('log-dir', True),
         ('res-dir', True),
         ('mount-dir', False),
+        ('ccache-dir', False),
         ('workload-dirs', True)
     ]
 
@@ -168,7 +171,15 @@ userOpts = [
         'res-dir',
         'jlevel',  # int or str from user, converted to '-jN' after loading
         'rootfs-margin',  # int or str from user, converted to int bytes after loading
+        'img-format',  # 'raw' or 'qcow2', format of derived rootfs images
+        'ccache',  # bool, compile through ccache
+        'ccache-dir',  # cache directory (None for ccache's default)
+        'ccache-max-size',  # str, passed to ccache as CCACHE_MAXSIZE
+        'source-date-epoch',  # int, timestamp of build outputs (None for the last commit)
+        'reproducible-img',  # bool, rebuild raw images deterministically
         'doitOpts',  # Dictionary of options to pass to doit (for the 'run' section)
+        'prototype-image',  # Output format of the 'prototype' install target
+        'prototype-image-compress',  # bool, run-length encode segmented prototype images
         ]
 
 # These represent all available derived options (constants and those generated
@@ -332,6 +343,8 @@ class marshalCtx(collections.abc.MutableMapping):
         self['command-script'] = self['gen-dir'] / "_command.sh"
         self['run-name'] = ""
         self['rootfs-margin'] = humanfriendly.parse_size(str(self['rootfs-margin']))
+        if self['img-format'] not in ['raw', 'qcow2']:
+            raise ConfigurationOptionError('img-format', "must be 'raw' or 'qcow2'")
 
         self['driver-dirs'] = list(self['board-dir'].glob('drivers/*'))
         self['opensbi-dir'] = self['board-dir'] / 'firmware' / 'opensbi'
@@ -341,6 +354,35 @@ class marshalCtx(collections.abc.MutableMapping):
         self['buildroot-dir'] = self['wlutil-dir'] / 'br' / 'buildroot'
         self['linux-make-args'] = ["ARCH=riscv", "CROSS_COMPILE=riscv64-unknown-linux-gnu-"]
 
+        global buildEnv
+        buildEnv = {}
+        if self['source-date-epoch'] is None:
+            self['source-date-epoch'] = lastCommitTime(self['wlutil-dir'])
+        self['source-date-epoch'] = int(self['source-date-epoch'])
+        if self['reproducible-img'] and self['img-format'] != 'raw':
+            raise ConfigurationOptionError('reproducible-img', "requires img-format 'raw'")
+
+        # Fixed build identity so that identical inputs give identical outputs
+        epoch = self['source-date-epoch']
+        buildEnv['SOURCE_DATE_EPOCH'] = str(epoch)
+        buildEnv['E2FSPROGS_FAKE_TIME'] = str(epoch)
+        buildEnv['KBUILD_BUILD_TIMESTAMP'] = time.strftime('%a %b %d %H:%M:%S UTC %Y', time.gmtime(epoch))
+        buildEnv['KBUILD_BUILD_USER'] = 'marshal'
+        buildEnv['KBUILD_BUILD_HOST'] = 'firemarshal'
+        buildEnv['KBUILD_BUILD_VERSION'] = '1'
+
+        if self['ccache']:
+            if shutil.which('ccache') is None:
+                raise ConfigurationOptionError('ccache', "ccache is enabled but was not found on the PATH")
+
+            # Makefiles outside of kbuild (drivers, bare-metal tests) pick up
+            # the wrapper from $CCACHE, see run()
+            buildEnv['CCACHE'] = 'ccache'
+            buildEnv['CCACHE_MAXSIZE'] = str(self['ccache-max-size'])
+            if self['ccache-dir'] is not None:
+                buildEnv['CCACHE_DIR'] = str(self['ccache-dir'])
+            self['linux-make-args'].append("CC=ccache riscv64-unknown-linux-gnu-gcc")
+
         if self['doitOpts']['dep_file'] == '':
             self['doitOpts']['dep_file'] = str(self['gen-dir'] / 'marshaldb')
 
@@ -472,6 +514,8 @@ def initLogging(verbose, logPath=None, werr=False):
 
     if werr:
         rootLogger.addFilter(WErrFilt)
+    else:
+        rootLogger.removeFilter(WErrFilt)
 
     # Create a unique log name
     if logPath is None:
@@ -480,6 +524,7 @@ def initLogging(verbose, logPath=None, werr=False):
     # formatting for log to file
     if fileHandler is not None:
         rootLogger.removeHandler(fileHandler)
+        fileHandler.close()
 
     fileHandler = logging.FileHandler(str(logPath))
     fileLogFormatter = logging.Formatter("%(asctime)s [%(funcName)-12.12s] [%(levelname)-5.5s]  %(message)s")
@@ -501,6 +546,11 @@ def initLogging(verbose, logPath=None, werr=False):
     rootLogger.addHandler(consoleHandler)
 
 
+# Environment for commands run through run(): the fixed build identity and, when
+# the 'ccache' option is set, ccache's settings (set by marshalCtx.deriveOpts())
+buildEnv = {}
+
+
 def run(*args, level=logging.DEBUG, check=True, **kwargs):
     """Run subcommands and handle logging etc. The arguments are identical to those for subprocess.call().
         level - The logging level to use
@@ -508,6 +558,9 @@ def run(*args, level=logging.DEBUG, check=True, **kwargs):
 
     log = logging.getLogger()
 
+    if len(buildEnv) != 0:
+        kwargs['env'] = {**kwargs.get('env', os.environ), **buildEnv}
+
     if isinstance(args[0], str):
         prettyCmd = args[0]
     else:
@@ -529,6 +582,26 @@ def run(*args, level=logging.DEBUG, check=True, **kwargs):
     return p
 
 
+def ccacheStats():
+    """Returns ccache's statistics counters (a dict of ints), or None if the
+    'ccache' option is off or ccache can't report them (older than 3.7)."""
+    if 'CCACHE' not in buildEnv:
+        return None
+
+    p = sp.run(['ccache', '--print-stats'], env={**os.environ, **buildEnv},
+               stdout=sp.PIPE, stderr=sp.DEVNULL, universal_newlines=True)
+    if p.returncode != 0:
+        return None
+
+    stats = {}
+    for line in p.stdout.splitlines():
+        name, _, value = line.partition('\t')
+        if value.strip().isdigit():
+            stats[name] = int(value)
+
+    return stats
+
+
 def run_with_retries(command, level=logging.DEBUG, num_attempts=3, polling_interval_s=1.0):
     """ Repeatedly tries to run a command, initially tolerating failure
         num_attempts -> The maximum number of invocations of the command
@@ -601,7 +674,10 @@ def mountImg(imgPath, mntPath):
     uid = sp.run(['id', '-u'], capture_output=True, text=True).stdout.strip()
     gid = sp.run(['id', '-g'], capture_output=True, text=True).stdout.strip()
 
-    if pwdlessSudoCmd:
+    # Only guestmount can read qcow2 images
+    qcow2 = imgFormat(imgPath) == 'qcow2'
+
+    if pwdlessSudoCmd and not qcow2:
         # use faster mount without firesim script since we have pwdless sudo
         run(pwdlessSudoCmd + ["mount", "-o", "loop", imgPath, mntPath])
         run(pwdlessSudoCmd + ["chown", "-R", f"{uid}:{gid}", mntPath])
@@ -614,7 +690,7 @@ def mountImg(imgPath, mntPath):
         fsimMountCmd = '/usr/local/bin/firesim-mount-with-uid-gid'
         fsimUnmountCmd = '/usr/local/bin/firesim-unmount'
 
-        if existsAndRunnableWithSudo(fsimMountCmd) and existsAndRunnableWithSudo(fsimUnmountCmd):
+        if not qcow2 and existsAndRunnableWithSudo(fsimMountCmd) and existsAndRunnableWithSudo(fsimUnmountCmd):
             run(sudoCmd + [fsimMountCmd, imgPath, mntPath, uid, gid])
             try:
                 yield mntPath
@@ -626,7 +702,8 @@ def mountImg(imgPath, mntPath):
             assert "nfs" not in fstype, f"Guestmount does not support {fstype} filesystems, change mount-dir to a non-NFS filesystem"
 
             pidPath = './guestmount.pid'
-            run(['guestmount', '--pid-file', pidPath, '-o', f'uid={uid}', '-o', f'gid={gid}', '-a', imgPath, '-m', '/dev/sda', mntPath])
+            run(['guestmount', '--pid-file', pidPath, '-o', f'uid={uid}', '-o', f'gid={gid}',
+                 '--format=' + imgFormat(imgPath), '-a', imgPath, '-m', '/dev/sda', mntPath])
             try:
                 with open(pidPath, 'r') as pidFile:
                     mntPid = int(pidFile.readline())
@@ -642,20 +719,113 @@ def mountImg(imgPath, mntPath):
 
 
 def toCpio(src, dst):
+    """Archive the directory src into the cpio file dst. Entries are sorted
+    and normalized (see mkcpio.py), so the archive only depends on the names,
+    modes and contents of the files in src."""
     global sudoCmd
     global pwdlessSudoCmd
 
     log = logging.getLogger()
     log.debug("Creating Cpio archive from " + str(src))
 
-    fsimCpioCmd = '/usr/local/bin/firesim-cpio'
-    if existsAndRunnableWithSudo(fsimCpioCmd):
+    mkcpio = pathlib.Path(__file__).parent / 'mkcpio.py'
+    with open(dst, 'wb') as outCpio:
+        p = sp.run(pwdlessSudoCmd + [sys.executable, mkcpio, str(getOpt('source-date-epoch'))],
+                   stderr=sp.PIPE, stdout=outCpio, cwd=src)
+    log.debug(p.stderr.decode('utf-8'))
+
+    if p.returncode != 0:
+        # Without passwordless sudo, some files may only be readable through
+        # the firesim-cpio helper (which does not normalize the archive)
+        fsimCpioCmd = '/usr/local/bin/firesim-cpio'
+        if not existsAndRunnableWithSudo(fsimCpioCmd):
+            raise sp.CalledProcessError(p.returncode, 'mkcpio.py')
+        log.warning("Unable to archive " + str(src) + ", falling back to firesim-cpio (the archive will not be reproducible)")
         run(sudoCmd + [fsimCpioCmd, src, dst])
-    else:
-        with open(dst, 'wb') as outCpio:
-            p = sp.run(pwdlessSudoCmd + ["sh", "-c", "find -print0 | cpio --owner root:root --null -ov --format=newc"],
-                       stderr=sp.PIPE, stdout=outCpio, cwd=src)
-            log.debug(p.stderr.decode('utf-8'))
+
+
+def imgFormat(img):
+    """Returns the format of the rootfs image at img ('raw' or 'qcow2')"""
+    with open(img, 'rb') as f:
+        magic = f.read(4)
+
+    return 'qcow2' if magic == b'QFI\xfb' else 'raw'
+
+
+def createThinImg(img, base):
+    """Create img as a qcow2 image backed by the rootfs image at base.
+
+    Launching a workload writes to its image, which would corrupt every image
+    layered on top of it. img is therefore backed by a read-only snapshot of
+    base (see backingImg()) rather than by base itself."""
+    backing = backingImg(base)
+    run(['qemu-img', 'create', '-q', '-f', 'qcow2', '-F', imgFormat(backing), '-b', backing, img])
+
+
+def backingImg(img):
+    """Returns a read-only snapshot of the rootfs image at img (img-backing),
+    refreshing it if img has changed since it was taken. The snapshot is a
+    reflink where the filesystem supports it. Snapshots of qcow2 images only
+    contain their own layer, so they are small either way.
+
+    Images layered on an older snapshot are out of date (they depend on img),
+    they must be rebuilt before being launched again."""
+    backing = appendPath(img, '-backing')
+    st = os.stat(img)
+    with contextlib.suppress(FileNotFoundError):
+        bst = os.stat(backing)
+        if (bst.st_size, bst.st_mtime_ns) == (st.st_size, st.st_mtime_ns):
+            return backing
+
+    tmp = appendPath(backing, '.' + str(os.getpid()))
+    run(['cp', '--reflink=auto', '--preserve=timestamps', img, tmp])
+    os.chmod(tmp, 0o444)
+    os.replace(tmp, backing)
+    return backing
+
+
+def rawImg(img):
+    """Returns a raw version of the rootfs image at img for tools that can't
+    read qcow2 (Spike, FireSim). qcow2 images are converted to a sparse raw
+    image next to them (img-raw), which is regenerated whenever img is newer."""
+    if imgFormat(img) == 'raw':
+        return img
+
+    raw = appendPath(img, '-raw')
+    if not raw.exists() or raw.stat().st_mtime_ns < os.stat(img).st_mtime_ns:
+        run(['qemu-img', 'convert', '-f', 'qcow2', '-O', 'raw', img, raw])
+
+    return raw
+
+
+def resizeThinFS(img, newSize=0):
+    """resizeFS() for qcow2 images. Thin images are never shrunk (free space
+    costs nothing), newSize=0 grows the image until rootfs-margin is free."""
+    log = logging.getLogger()
+    fish = ['guestfish', '--format=qcow2', '-a', str(img)]
+
+    info = sp.run(['qemu-img', 'info', '--output=json', str(img)], stdout=sp.PIPE, check=True)
+    origSz = json.loads(info.stdout)['virtual-size']
+
+    if newSize == 0:
+        out = sp.run(fish + ['--ro', '-m', '/dev/sda', 'statvfs', '/'],
+                     stdout=sp.PIPE, universal_newlines=True, check=True).stdout
+        stat = dict(line.split(': ') for line in out.splitlines() if ': ' in line)
+        free = int(stat['bavail']) * int(stat['frsize'])
+        if free >= getOpt('rootfs-margin'):
+            return
+        newSize = origSz + getOpt('rootfs-margin') - free
+
+    if origSz > newSize:
+        log.warn("Cannot shrink image file " + str(img) +
+                 ": current size=" + humanfriendly.format_size(origSz, binary=True) +
+                 " requested size=" + humanfriendly.format_size(newSize, binary=True))
+        return
+    elif origSz == newSize:
+        return
+
+    run(['qemu-img', 'resize', '-q', '-f', 'qcow2', img, str(newSize)])
+    run(fish + ['run', ':', 'e2fsck-f', '/dev/sda', ':', 'resize2fs', '/dev/sda'])
 
 
 def resizeFS(img, newSize=0):
@@ -666,6 +836,9 @@ def resizeFS(img, newSize=0):
       size + rootfs-margin
     """
     log = logging.getLogger()
+    if imgFormat(img) == 'qcow2':
+        return resizeThinFS(img, newSize)
+
     chkfsCmd = ['e2fsck', '-f', '-p', str(img)]
     ret = run(chkfsCmd, check=False).returncode
     if ret >= 4:
@@ -690,6 +863,87 @@ def resizeFS(img, newSize=0):
     return
 
 
+def normalizeImg(img):
+    """Rebuild the ext4 filesystem in the raw image at img from its contents so
+    that the image bytes only depend on the files in it (for the
+    'reproducible-img' option). Edits through a mount leave behind inode
+    allocation, change times and journal contents that differ on every build.
+
+    The new filesystem keeps img's size, UUID, hash seed and features. Times
+    newer than 'source-date-epoch' are clamped to it and files are owned by
+    root."""
+    log = logging.getLogger()
+    epoch = getOpt('source-date-epoch')
+
+    fsInfo = {}
+    p = sp.run(['dumpe2fs', '-h', str(img)], stdout=sp.PIPE, stderr=sp.DEVNULL, universal_newlines=True, check=True)
+    for line in p.stdout.splitlines():
+        key, _, value = line.partition(':')
+        fsInfo[key.strip()] = value.strip()
+
+    features = [f for f in fsInfo['Filesystem features'].split() if f not in ['needs_recovery', 'orphan_present']]
+
+    staging = getOpt('gen-dir') / 'img-staging'
+
+    def removeStaging():
+        if staging.exists():
+            run(['chmod', '-R', 'u+rwX', staging])
+            shutil.rmtree(staging)
+
+    removeStaging()
+    staging.mkdir(parents=True)
+
+    log.debug("Normalizing image " + str(img))
+    with mountImg(img, getOpt('mount-dir')):
+        run(['cp', '-a', str(getOpt('mount-dir')) + '/.', staging])
+
+    # Clamp times and list every entry for debugfs
+    entries = [str(staging)]
+    for dirpath, dirnames, filenames in os.walk(staging):
+        entries += [os.path.join(dirpath, name) for name in dirnames + filenames]
+
+    paths = []
+    for path in entries:
+        st = os.lstat(path)
+        os.utime(path, (epoch, min(int(st.st_mtime), epoch)), follow_symlinks=False)
+        rel = os.path.relpath(path, staging)
+        paths.append('/' if rel == '.' else '/' + rel)
+
+    size = os.path.getsize(img)
+    os.remove(img)
+    with open(img, 'wb'):
+        pass
+    os.truncate(img, size)
+
+    mkfsCmd = ['mke2fs', '-q', '-F', '-t', 'ext4',
+               '-O', ','.join(['none'] + features),
+               '-b', fsInfo['Block size'],
+               '-I', fsInfo['Inode size'],
+               '-N', fsInfo['Inode count'],
+               '-U', fsInfo['Filesystem UUID'],
+               '-E', 'hash_seed=' + fsInfo['Directory Hash Seed'] + ',nodiscard',
+               '-d', staging]
+    if fsInfo['Filesystem volume name'] != '<none>':
+        mkfsCmd += ['-L', fsInfo['Filesystem volume name']]
+    run(mkfsCmd + [img, str(size // int(fsInfo['Block size']))])
+
+    # mke2fs copies change and access times from the staging directory, which
+    # can't be set from user space. Reset them (and the owner) in the image.
+    script = getOpt('gen-dir') / 'img-normalize.debugfs'
+    with open(script, 'w') as f:
+        for path in sorted(paths):
+            if '"' in path or '\n' in path:
+                log.warning("Unable to normalize " + path + " in " + str(img))
+                continue
+            for field in ['ctime', 'atime']:
+                f.write(f'sif "{path}" {field} @{epoch}\n')
+            for field in ['uid', 'gid']:
+                f.write(f'sif "{path}" {field} 0\n')
+    run(['debugfs', '-w', '-f', script, img])
+
+    removeStaging()
+
+
 def copyImgFiles(img, files, direction):
     """Copies a list of type FileSpec ('files') to/from the destination image (img).
 
@@ -749,7 +1003,7 @@ def applyOverlay(img, overlay):
     """Apply the overlay directory "overlay" to the filesystem image "img"
        Note that all paths must be absolute"""
     flist = []
-    for f in overlay.glob('*'):
+    for f in sorted(overlay.glob('*')):
         flist.append(FileSpec(src=f, dst=pathlib.Path('/')))
 
     copyImgFiles(img, flist, 'in')
@@ -794,6 +1048,11 @@ def getToolVersions():
 # only warn once per-submodule (if it's included by multiple workloads)
 checkGitStatusWarned = []
 
+# Optional cache for checkGitStatus() results. The build daemon installs one
+# (see daemon.py) that stays valid until the repo changes on disk. It must
+# provide get(submodule, readStatus).
+gitStatusCache = None
+
 
 def checkGitStatus(submodule):
     """Returns a dictionary representing the status of a git repo.
@@ -813,6 +1072,15 @@ def checkGitStatus(submodule):
     has changed since the last time it ran. The 'sha' or 'rebuild' fields will
     change if the repo has changed (or we can't tell if it's changed)."""
 
+    if gitStatusCache is not None and submodule is not None:
+        return gitStatusCache.get(submodule, readGitStatus)
+
+    return readGitStatus(submodule)
+
+
+def readGitStatus(submodule):
+    """Uncached implementation of checkGitStatus()"""
+
     log = logging.getLogger()
 
     if submodule is None:
@@ -852,6 +1120,48 @@ def checkGitStatus(submodule):
     return status
 
 
+def sourceFingerprint(src):
+    """Returns a string that identifies the contents of the source tree at src.
+
+    Unlike checkGitStatus(), this is deterministic for dirty repos: it covers
+    the HEAD commit, uncommitted changes and untracked (non-ignored) files.
+    Directories that are not git repos are fingerprinted by their file
+    contents. Build outputs ignored by git do not affect the result."""
+
+    src = pathlib.Path(src)
+    status = checkGitStatus(src)
+    if status['init'] and not status['dirty']:
+        return status['sha']
+
+    h = hashlib.sha256()
+    if status['init']:
+        h.update(status['sha'].encode('utf-8'))
+        h.update(sp.run(['git', 'diff', '--binary', 'HEAD'], cwd=src,
+                        stdout=sp.PIPE, check=True).stdout)
+        untracked = sp.run(['git', 'ls-files', '-z', '--others', '--exclude-standard'], cwd=src,
+                           stdout=sp.PIPE, check=True).stdout
+        files = [src / os.fsdecode(f) for f in untracked.split(b'\0') if f]
+    else:
+        files = [f for f in src.glob('**/*') if f.is_file() and not f.is_symlink()]
+
+    for f in sorted(files):
+        h.update(str(f.relative_to(src)).encode('utf-8') + b'\0')
+        with open(f, 'rb') as fd:
+            h.update(hashlib.sha256(fd.read()).digest())
+
+    return h.hexdigest()
+
+
+def lastCommitTime(path):
+    """Returns the commit time of HEAD in the repo containing path (0 if path
+    isn't in a git repo). This is the default 'source-date-epoch'."""
+    try:
+        repo = git.Repo(path, search_parent_directories=True)
+        return repo.head.commit.committed_date
+    except (git.InvalidGitRepositoryError, git.exc.NoSuchPathError, ValueError):
+        return 0
+
+
 def checkSubmodule(s):
     """Check whether a submodule is present and initialized.
 